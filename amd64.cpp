@@ -3,7 +3,7 @@
 namespace bx {
 namespace amd64 {
 
-int Pseudo::__last_pseudo_id = 0;
+thread_local int Pseudo::__last_pseudo_id = 0;
 
 std::ostream &operator<<(std::ostream &out, Pseudo const &p) {
   if (!p.binding.has_value())
@@ -50,7 +50,7 @@ struct Pseudo {
   bool operator==(Pseudo const &other) const noexcept { return id == other.id; }
 
 private:
-  static int __last_pseudo_id;
+  static thread_local int __last_pseudo_id;
 };
 
 std::ostream &operator<<(std::ostream &out, Pseudo const &p);
@@ -89,6 +89,10 @@ private:
                std::vector<Label> const &dests, std::string const &repr)
       : use{use}, def{def}, jump_dests{dests}, repr_template{repr} {}
 
+  static std::string displacement(int32_t disp) {
+    return disp == 0 ? std::string{} : std::to_string(disp);
+  }
+
 public:
   static ptr directive(std::string const &directive) {
     return std::shared_ptr<Asm>(
@@ -115,6 +119,7 @@ public:
   ARITH_BINOP(and)
   ARITH_BINOP(or)
   ARITH_BINOP(xor)
+  ARITH_BINOP(imul)
 #undef ARITH_BINOP
 
   static ptr movq_reg2mem(Pseudo const &src, std::string const &mem_lab) {
@@ -140,6 +145,32 @@ public:
         {addr}, {dest}, {}, "\tmovq " + std::to_string(offset) + "(`s0), `d0"});
   }
 
+  /** Load the address disp(base) or disp(base,index,scale) into dest */
+  static ptr leaq(int32_t disp, Pseudo const &base, Pseudo const &dest) {
+    return std::shared_ptr<Asm>(new Asm{
+        {base}, {dest}, {}, "\tleaq " + displacement(disp) + "(`s0), `d0"});
+  }
+
+  static ptr leaq(int32_t disp, Pseudo const &base, Pseudo const &index,
+                  int scale, Pseudo const &dest) {
+    return std::shared_ptr<Asm>(
+        new Asm{{base, index},
+                {dest},
+                {},
+                "\tleaq " + displacement(disp) + "(`s0,`s1," +
+                    std::to_string(scale) + "), `d0"});
+  }
+
+  static ptr leaq(int32_t disp, Pseudo const &index, int scale,
+                  Pseudo const &dest) {
+    return std::shared_ptr<Asm>(
+        new Asm{{index},
+                {dest},
+                {},
+                "\tleaq " + std::to_string(disp) + "(,`s0," +
+                    std::to_string(scale) + "), `d0"});
+  }
+
   static ptr cqo() {
     return std::shared_ptr<Asm>(new Asm{
         {Pseudo{reg::rax}}, {Pseudo{reg::rax}, Pseudo{reg::rdx}}, {}, "\tcqo"});
@@ -170,6 +201,11 @@ public:
     return std::shared_ptr<Asm>(new Asm{{arg}, {}, {}, repr});
   }
 
+  static ptr testq(Pseudo const &arg1, Pseudo const &arg2) {
+    return std::shared_ptr<Asm>(
+        new Asm{{arg1, arg2}, {}, {}, "\ttestq `s0, `s1"});
+  }
+
 #define ARITH_UNOP(mnemonic)                                                   \
   static ptr mnemonic##q(Pseudo const &arg) {                                  \
     return std::shared_ptr<Asm>(                                               \
@@ -177,6 +213,8 @@ public:
   }
   ARITH_UNOP(neg)
   ARITH_UNOP(not)
+  ARITH_UNOP(inc)
+  ARITH_UNOP(dec)
 #undef ARITH_UNOP
 
   static ptr pushq(Pseudo const &arg) {
@@ -191,6 +229,10 @@ public:
   static ptr mnemonic##q(Pseudo const &dest) {                                 \
     return std::shared_ptr<Asm>(                                               \
         new Asm{{Pseudo{reg::rcx}}, {dest}, {}, "\t" #mnemonic "q %cl, `d0"}); \
+  }                                                                            \
+  static ptr mnemonic##q(int imm, Pseudo const &dest) {                        \
+    std::string repr = "\t" #mnemonic "q $" + std::to_string(imm) + ", `d0";   \
+    return std::shared_ptr<Asm>(new Asm{{dest}, {dest}, {}, repr});            \
   }
   SHIFTOP(sar)
   SHIFTOP(shr) // not really used in this course
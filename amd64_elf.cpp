@@ -0,0 +1,741 @@
+/**
+ * Encoding amd64 assembly into an ELF object
+ *
+ * Every Asm line is read back from its template: the mnemonic selects the
+ * encoding and the operands are the pseudos of the line, bound to registers
+ * or stack slots, plus immediates, %rip-relative globals and labels. The
+ * templates are only looked at through string_views, since the lines outlive
+ * the encoder.
+ *
+ * Everything but the jumps goes straight into one code buffer; the jumps and
+ * the labels are positions in that buffer. Once all the lines are in, the
+ * jumps are laid out, starting in their 2-byte form and growing to the rel32
+ * form when their target is too far, until no more jump grows.
+ *
+ * References to globals and calls are left to the linker as relocations
+ * against their symbols, which is all that is needed for the runtime
+ * functions that live in another object.
+ */
+
+#include <elf.h>
+
+#include <algorithm>
+#include <charconv>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <unordered_set>
+#include <variant>
+
+#include "amd64_elf.h"
+
+namespace bx {
+namespace amd64 {
+
+namespace {
+
+using Bytes = std::vector<uint8_t>;
+using Text = std::string_view;
+
+// Operands
+
+struct Gpr {
+  int num;
+};
+struct Mem {
+  int base; // -1 when there is only an index
+  int32_t disp;
+  int index = -1;
+  int scale = 1;
+};
+struct RipMem {
+  Text symbol;
+};
+struct Imm {
+  int64_t value;
+};
+struct Sym {
+  Text name;
+};
+using Operand = std::variant<Gpr, Mem, RipMem, Imm, Sym>;
+
+int reg_num(Text name) {
+  // %rax ... %rdi are numbered 0 to 7 in this order, then %r8 ... %r15
+  static const char low[8][2] = {{'a', 'x'}, {'c', 'x'}, {'d', 'x'},
+                                 {'b', 'x'}, {'s', 'p'}, {'b', 'p'},
+                                 {'s', 'i'}, {'d', 'i'}};
+  if (name == "%cl")
+    return 1;
+  if (name.size() >= 3 && name[0] == '%' && name[1] == 'r') {
+    if (name.size() == 4)
+      for (int i = 0; i < 8; i++)
+        if (name[2] == low[i][0] && name[3] == low[i][1])
+          return i;
+    if (name[2] >= '0' && name[2] <= '9') {
+      int n = 0;
+      auto res = std::from_chars(name.data() + 2, name.data() + name.size(), n);
+      if (res.ptr == name.data() + name.size() && n >= 8 && n <= 15)
+        return n;
+    }
+  }
+  throw std::runtime_error("Unknown register: " + std::string{name});
+}
+
+constexpr int rcx = 1, rbp = 5;
+
+int64_t number(Text t) {
+  int64_t v = 0;
+  auto res = std::from_chars(t.data(), t.data() + t.size(), v);
+  if (res.ec != std::errc{} || res.ptr != t.data() + t.size())
+    throw std::runtime_error("Bad number: " + std::string{t});
+  return v;
+}
+
+Operand pseudo_operand(Pseudo const &ps) {
+  if (!ps.binding.has_value())
+    throw std::runtime_error("Cannot encode an unbound pseudo");
+  auto const &b = ps.binding.value();
+  if (auto reg = std::get_if<Reg>(&b))
+    return Gpr{reg_num(*reg)};
+  return Mem{rbp, -8 * std::get<StackSlot>(b)};
+}
+
+/** The operand text op of line, with its `s, `d and `j references */
+Operand parse_operand(Asm const &line, Text op) {
+  auto ref = [&](std::size_t at) -> Pseudo const & {
+    auto idx = static_cast<std::size_t>(op[at + 2] - '0');
+    return op[at + 1] == 's' ? line.use.at(idx) : line.def.at(idx);
+  };
+  if (op[0] == '$')
+    return Imm{number(op.substr(1))};
+  if (op[0] == '`') {
+    if (op[1] == 'j')
+      return Sym{line.jump_dests.at(op[2] - '0')};
+    return pseudo_operand(ref(0));
+  }
+  if (op[0] == '%')
+    return Gpr{reg_num(op)};
+  auto paren = op.find('(');
+  if (paren == Text::npos)
+    return Sym{op};
+  auto inner = op.substr(paren + 1, op.size() - paren - 2);
+  if (inner == "%rip")
+    return RipMem{op.substr(0, paren)};
+  // base, then optionally index and scale
+  auto reg_at = [&](std::size_t at, Text name) {
+    auto r = name[0] == '`' ? pseudo_operand(ref(at)) : Operand{Gpr{reg_num(name)}};
+    if (!std::holds_alternative<Gpr>(r))
+      throw std::runtime_error("Bad address: " + std::string{op});
+    return std::get<Gpr>(r).num;
+  };
+  auto comma = inner.find(',');
+  Mem m{-1, paren == 0 ? 0 : static_cast<int32_t>(number(op.substr(0, paren)))};
+  if (comma != 0)
+    m.base = reg_at(paren + 1, inner.substr(0, comma));
+  if (comma != Text::npos) {
+    auto rest = inner.substr(comma + 1);
+    auto comma2 = rest.find(',');
+    m.index = reg_at(paren + comma + 2, rest.substr(0, comma2));
+    if (comma2 != Text::npos)
+      m.scale = static_cast<int>(number(rest.substr(comma2 + 1)));
+  }
+  return m;
+}
+
+bool fits8(int64_t v) { return v >= INT8_MIN && v <= INT8_MAX; }
+bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+void put32(Bytes &b, uint32_t v) {
+  for (int i = 0; i < 4; i++)
+    b.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+void put64(Bytes &b, uint64_t v) {
+  for (int i = 0; i < 8; i++)
+    b.push_back(static_cast<uint8_t>(v >> (8 * i)));
+}
+
+/** A relocation against a symbol, at a position in the code buffer */
+struct Fixup {
+  std::size_t offset;
+  Text symbol;
+  uint32_t type;
+  int64_t addend;
+};
+
+struct Jump {
+  std::size_t pos; // the jump goes just before this byte of the buffer
+  int target;      // label number
+  int cc;          // condition code, -1 for jmp
+  bool near;       // the rel32 form
+
+  std::size_t size() const { return near ? (cc == -1 ? 5 : 6) : 2; }
+};
+
+struct TextLabel {
+  Text name;
+  bool defined = false;
+  std::size_t pos = 0;          // in the buffer
+  std::size_t jumps_before = 0; // the number of jumps before pos
+};
+
+// Mnemonics
+
+enum class Form {
+  ALU, MOVABS, IMUL, F7, SHIFT, PUSH, POP, CQO, RET, CALL, JUMP, LEA, FF
+};
+
+struct Encoding {
+  Form form;
+  uint8_t store = 0, load = 0; // ALU: op r/m, r and op r, r/m
+  int ext = 0;                 // the /digit of the r/m only forms
+  int cc = -1;                 // JUMP: condition code, -1 for jmp
+};
+
+const std::unordered_map<Text, Encoding> encodings = {
+    {"movq", {Form::ALU, 0x89, 0x8B, 0}},
+    {"addq", {Form::ALU, 0x01, 0x03, 0}},
+    {"subq", {Form::ALU, 0x29, 0x2B, 5}},
+    {"andq", {Form::ALU, 0x21, 0x23, 4}},
+    {"orq", {Form::ALU, 0x09, 0x0B, 1}},
+    {"xorq", {Form::ALU, 0x31, 0x33, 6}},
+    {"cmpq", {Form::ALU, 0x39, 0x3B, 7}},
+    {"testq", {Form::ALU, 0x85, 0x85}},
+    {"leaq", {Form::LEA}},
+    {"incq", {Form::FF, 0, 0, 0}},
+    {"decq", {Form::FF, 0, 0, 1}},
+    {"movabsq", {Form::MOVABS}},
+    {"imulq", {Form::IMUL, 0, 0, 5}},
+    {"idivq", {Form::F7, 0, 0, 7}},
+    {"negq", {Form::F7, 0, 0, 3}},
+    {"notq", {Form::F7, 0, 0, 2}},
+    {"salq", {Form::SHIFT, 0, 0, 4}},
+    {"sarq", {Form::SHIFT, 0, 0, 7}},
+    {"shrq", {Form::SHIFT, 0, 0, 5}},
+    {"pushq", {Form::PUSH}},
+    {"popq", {Form::POP}},
+    {"cqo", {Form::CQO}},
+    {"ret", {Form::RET}},
+    {"call", {Form::CALL}},
+    {"jmp", {Form::JUMP}},
+    {"je", {Form::JUMP, 0, 0, 0, 0x4}},
+    {"jne", {Form::JUMP, 0, 0, 0, 0x5}},
+    {"jl", {Form::JUMP, 0, 0, 0, 0xC}},
+    {"jge", {Form::JUMP, 0, 0, 0, 0xD}},
+    {"jle", {Form::JUMP, 0, 0, 0, 0xE}},
+    {"jg", {Form::JUMP, 0, 0, 0, 0xF}}};
+
+class Encoder {
+private:
+  Bytes code;
+  std::vector<Fixup> relocs;
+  std::vector<Jump> jumps;
+  std::vector<TextLabel> labels;
+  std::unordered_map<Text, int> label_num;
+  Bytes data;
+  std::unordered_map<Text, std::size_t> data_labels;
+  std::unordered_set<Text> globals;
+  bool in_text = true;
+
+  int label(Text name) {
+    auto it = label_num.find(name);
+    if (it != label_num.end())
+      return it->second;
+    int n = static_cast<int>(labels.size());
+    labels.emplace_back();
+    labels.back().name = name;
+    label_num.insert({name, n});
+    return n;
+  }
+
+  void rex(bool w, int reg, Operand const &rm) {
+    int b = 0, x = 0;
+    if (auto g = std::get_if<Gpr>(&rm)) {
+      b = g->num >> 3;
+    } else if (auto m = std::get_if<Mem>(&rm)) {
+      b = m->base >= 0 ? m->base >> 3 : 0;
+      x = m->index >= 0 ? m->index >> 3 : 0;
+    }
+    uint8_t prefix = 0x40 | (w ? 8 : 0) | ((reg >> 3) << 2) | (x << 1) | b;
+    if (prefix != 0x40)
+      code.push_back(prefix);
+  }
+
+  /** The ModRM byte and what follows it; imm_size bytes come after that */
+  void modrm(int reg, Operand const &rm, int imm_size = 0) {
+    int r = (reg & 7) << 3;
+    if (auto g = std::get_if<Gpr>(&rm)) {
+      code.push_back(static_cast<uint8_t>(0xC0 | r | (g->num & 7)));
+    } else if (auto m = std::get_if<Mem>(&rm)) {
+      int base = m->base < 0 ? rbp : m->base & 7;
+      int mod = m->base < 0 ? 0
+                : m->disp == 0 && base != rbp ? 0
+                : fits8(m->disp)              ? 1
+                                              : 2;
+      if (m->index < 0 && base != 4) {
+        code.push_back(static_cast<uint8_t>((mod << 6) | r | base));
+      } else {
+        // SIB; an index of 4 means none, for a base of %rsp or %r12
+        static const int ss[9] = {0, 0, 1, 0, 2, 0, 0, 0, 3};
+        int index = m->index < 0 ? 4 : m->index & 7;
+        code.push_back(static_cast<uint8_t>((mod << 6) | r | 4));
+        code.push_back(static_cast<uint8_t>((ss[m->scale] << 6) | (index << 3) | base));
+      }
+      if (m->base < 0)
+        put32(code, static_cast<uint32_t>(m->disp));
+      else if (mod == 1)
+        code.push_back(static_cast<uint8_t>(m->disp));
+      else if (mod == 2)
+        put32(code, static_cast<uint32_t>(m->disp));
+    } else if (auto rip = std::get_if<RipMem>(&rm)) {
+      code.push_back(static_cast<uint8_t>(r | 5));
+      relocs.push_back({code.size(), rip->symbol, R_X86_64_PC32, -4 - imm_size});
+      put32(code, 0);
+    } else {
+      throw std::runtime_error("Bad memory operand");
+    }
+  }
+
+  void op_rm(std::initializer_list<uint8_t> opcode, int reg, Operand const &rm,
+             int imm_size = 0) {
+    rex(true, reg, rm);
+    code.insert(code.end(), opcode);
+    modrm(reg, rm, imm_size);
+  }
+
+  void imm(int64_t v, int size) {
+    if (size == 1)
+      code.push_back(static_cast<uint8_t>(v));
+    else
+      put32(code, static_cast<uint32_t>(v));
+  }
+
+  static int64_t checked32(Imm const &i) {
+    if (!fits32(i.value))
+      throw std::runtime_error("Immediate out of range: " +
+                               std::to_string(i.value));
+    return i.value;
+  }
+
+  static int gpr(Operand const &op, Text mn) {
+    if (auto g = std::get_if<Gpr>(&op))
+      return g->num;
+    throw std::runtime_error(std::string{mn} + " needs a register operand");
+  }
+
+  void alu(Text mn, Encoding const &enc, Operand const &src,
+           Operand const &dest) {
+    bool mov = enc.store == 0x89;
+    if (auto i = std::get_if<Imm>(&src)) {
+      auto v = checked32(*i);
+      int size = !mov && fits8(v) ? 1 : 4;
+      op_rm({static_cast<uint8_t>(mov ? 0xC7 : size == 1 ? 0x83 : 0x81)},
+            enc.ext, dest, size);
+      imm(v, size);
+    } else if (auto s = std::get_if<Gpr>(&src)) {
+      op_rm({enc.store}, s->num, dest);
+    } else if (auto d = std::get_if<Gpr>(&dest)) {
+      op_rm({enc.load}, d->num, src);
+    } else {
+      throw std::runtime_error("Two memory operands for " + std::string{mn});
+    }
+  }
+
+  void instruction(Text mn, Encoding const &enc, Operand const *ops,
+                   std::size_t n) {
+    static const std::size_t arity[] = {2, 2, 0, 1, 2, 1, 1, 0, 0, 1, 1, 2, 1};
+    auto expected = arity[static_cast<int>(enc.form)];
+    if (n != expected && !(enc.form == Form::IMUL && (n == 1 || n == 2)))
+      throw std::runtime_error("Wrong number of operands for " +
+                               std::string{mn});
+    switch (enc.form) {
+    case Form::ALU:
+      alu(mn, enc, ops[0], ops[1]);
+      break;
+    case Form::MOVABS: {
+      int d = gpr(ops[1], mn);
+      code.push_back(static_cast<uint8_t>(0x48 | (d >> 3)));
+      code.push_back(static_cast<uint8_t>(0xB8 | (d & 7)));
+      put64(code, static_cast<uint64_t>(std::get<Imm>(ops[0]).value));
+    } break;
+    case Form::IMUL:
+      if (n == 1) {
+        op_rm({0xF7}, enc.ext, ops[0]);
+      } else if (auto i = std::get_if<Imm>(&ops[0])) {
+        int d = gpr(ops[1], mn);
+        auto v = checked32(*i);
+        int size = fits8(v) ? 1 : 4;
+        op_rm({static_cast<uint8_t>(size == 1 ? 0x6B : 0x69)}, d, Gpr{d}, size);
+        imm(v, size);
+      } else {
+        op_rm({0x0F, 0xAF}, gpr(ops[1], mn), ops[0]);
+      }
+      break;
+    case Form::F7:
+      op_rm({0xF7}, enc.ext, ops[0]);
+      break;
+    case Form::FF:
+      op_rm({0xFF}, enc.ext, ops[0]);
+      break;
+    case Form::LEA:
+      if (!std::holds_alternative<Mem>(ops[0]))
+        throw std::runtime_error("leaq needs an address");
+      op_rm({0x8D}, gpr(ops[1], mn), ops[0]);
+      break;
+    case Form::SHIFT:
+      if (auto i = std::get_if<Imm>(&ops[0])) {
+        if (i->value == 1) {
+          op_rm({0xD1}, enc.ext, ops[1]);
+        } else {
+          op_rm({0xC1}, enc.ext, ops[1], 1);
+          imm(i->value & 63, 1);
+        }
+      } else if (gpr(ops[0], mn) == rcx) {
+        op_rm({0xD3}, enc.ext, ops[1]);
+      } else {
+        throw std::runtime_error("Shift counts must be in %cl");
+      }
+      break;
+    case Form::PUSH:
+    case Form::POP: {
+      bool push = enc.form == Form::PUSH;
+      if (auto g = std::get_if<Gpr>(&ops[0])) {
+        if (g->num >= 8)
+          code.push_back(0x41);
+        code.push_back(
+            static_cast<uint8_t>((push ? 0x50 : 0x58) | (g->num & 7)));
+      } else {
+        rex(false, 0, ops[0]);
+        code.push_back(push ? 0xFF : 0x8F);
+        modrm(push ? 6 : 0, ops[0]);
+      }
+    } break;
+    case Form::CQO:
+      code.insert(code.end(), {0x48, 0x99});
+      break;
+    case Form::RET:
+      code.push_back(0xC3);
+      break;
+    case Form::CALL:
+      code.push_back(0xE8);
+      relocs.push_back(
+          {code.size(), std::get<Sym>(ops[0]).name, R_X86_64_PLT32, -4});
+      put32(code, 0);
+      break;
+    case Form::JUMP:
+      jumps.push_back(
+          {code.size(), label(std::get<Sym>(ops[0]).name), enc.cc, false});
+      break;
+    }
+  }
+
+  void directive(Text d) {
+    auto space = d.find(' ');
+    auto name = d.substr(0, space);
+    auto arg = space == Text::npos ? Text{} : d.substr(space + 1);
+    if (name == ".globl") {
+      globals.insert(arg);
+    } else if (name == ".section") {
+      in_text = arg == ".text";
+      if (!in_text && arg != ".data" && arg.substr(0, 15) != ".note.GNU-stack")
+        throw std::runtime_error("Unknown section " + std::string{arg});
+    } else if (name == ".align" && !in_text) {
+      auto align = static_cast<std::size_t>(number(arg));
+      while (data.size() % align != 0)
+        data.push_back(0);
+    } else if (name == ".quad" && !in_text) {
+      put64(data, static_cast<uint64_t>(number(arg)));
+    } else {
+      throw std::runtime_error("Cannot encode directive " + std::string{d});
+    }
+  }
+
+public:
+  explicit Encoder(std::size_t num_lines) {
+    code.reserve(4 * num_lines);
+    label_num.reserve(num_lines / 2);
+  }
+
+  void line(Asm const &l) {
+    Text t = l.repr_template;
+    if (t.empty())
+      return;
+    if (t[0] != '\t') { // label:
+      auto name = t.substr(0, t.size() - 1);
+      if (in_text) {
+        auto &tl = labels[label(name)];
+        tl.defined = true;
+        tl.pos = code.size();
+        tl.jumps_before = jumps.size();
+      } else {
+        data_labels[name] = data.size();
+      }
+      return;
+    }
+    auto body = t.substr(1);
+    if (body[0] == '.') {
+      directive(body);
+      return;
+    }
+    if (!in_text)
+      throw std::runtime_error("Instruction outside .text: " +
+                               std::string{body});
+    auto space = body.find(' ');
+    auto mn = body.substr(0, space);
+    auto enc = encodings.find(mn);
+    if (enc == encodings.end())
+      throw std::runtime_error("Cannot encode " + std::string{mn});
+    Operand ops[2];
+    std::size_t n = 0;
+    if (space != Text::npos) {
+      auto rest = body.substr(space + 1);
+      while (true) {
+        if (n == 2)
+          throw std::runtime_error("Too many operands: " + std::string{body});
+        auto comma = rest.find(", ");
+        ops[n++] = parse_operand(l, rest.substr(0, comma));
+        if (comma == Text::npos)
+          break;
+        rest = rest.substr(comma + 2);
+      }
+    }
+    instruction(mn, enc->second, ops, n);
+  }
+
+  MachineCode finish();
+};
+
+MachineCode Encoder::finish() {
+  for (auto const &tl : labels)
+    if (!tl.defined)
+      throw std::runtime_error("Undefined label " + std::string{tl.name});
+
+  // Lay out the jumps; shift[k] is the size of the first k jumps
+  std::vector<std::size_t> shift(jumps.size() + 1);
+  auto offset = [&](TextLabel const &tl) {
+    return static_cast<int64_t>(tl.pos + shift[tl.jumps_before]);
+  };
+  auto displacement = [&](std::size_t k) {
+    auto const &j = jumps[k];
+    return offset(labels[j.target]) -
+           static_cast<int64_t>(j.pos + shift[k] + j.size());
+  };
+  bool grown = true;
+  while (grown) {
+    grown = false;
+    for (std::size_t k = 0; k < jumps.size(); k++)
+      shift[k + 1] = shift[k] + jumps[k].size();
+    for (std::size_t k = 0; k < jumps.size(); k++)
+      if (!jumps[k].near && !fits8(displacement(k)))
+        jumps[k].near = grown = true;
+  }
+
+  MachineCode mc;
+  auto &text = mc.text;
+  text.reserve(code.size() + shift.back());
+  std::size_t copied = 0;
+  for (std::size_t k = 0; k < jumps.size(); k++) {
+    auto const &j = jumps[k];
+    text.insert(text.end(), code.begin() + copied, code.begin() + j.pos);
+    copied = j.pos;
+    auto disp = displacement(k);
+    if (!j.near) {
+      text.push_back(static_cast<uint8_t>(j.cc == -1 ? 0xEB : 0x70 | j.cc));
+      text.push_back(static_cast<uint8_t>(disp));
+    } else {
+      if (j.cc == -1)
+        text.push_back(0xE9);
+      else
+        text.insert(text.end(), {0x0F, static_cast<uint8_t>(0x80 | j.cc)});
+      put32(text, static_cast<uint32_t>(disp));
+    }
+  }
+  text.insert(text.end(), code.begin() + copied, code.end());
+  mc.data = std::move(data);
+
+  // Only the globals and the targets of relocations are kept as symbols
+  auto add_symbol = [&](Text name) {
+    auto &sym = mc.symbols[std::string{name}];
+    sym.global = globals.count(name) > 0;
+    auto in_code = label_num.find(name);
+    auto in_data = data_labels.find(name);
+    if (in_code != label_num.end()) {
+      sym.section = MachineCode::TEXT;
+      sym.offset = static_cast<std::size_t>(offset(labels[in_code->second]));
+    } else if (in_data != data_labels.end()) {
+      sym.section = MachineCode::DATA;
+      sym.offset = in_data->second;
+    } else {
+      sym.section = MachineCode::UNDEF;
+      sym.global = true;
+    }
+  };
+  for (auto name : globals)
+    add_symbol(name);
+  for (auto const &r : relocs) {
+    auto after = std::upper_bound(
+        jumps.begin(), jumps.end(), r.offset,
+        [](std::size_t o, Jump const &j) { return o < j.pos; });
+    mc.relocs.push_back({r.offset + shift[after - jumps.begin()],
+                         std::string{r.symbol}, r.type, r.addend});
+    add_symbol(r.symbol);
+  }
+  return mc;
+}
+
+} // namespace
+
+MachineCode encode(std::vector<Asm::ptr> const &prog) {
+  Encoder enc{prog.size()};
+  for (auto const &l : prog)
+    enc.line(*l);
+  return enc.finish();
+}
+
+void MachineCode::append(MachineCode const &more) {
+  auto text_base = text.size();
+  while (data.size() % 8 != 0)
+    data.push_back(0);
+  auto data_base = data.size();
+  text.insert(text.end(), more.text.begin(), more.text.end());
+  data.insert(data.end(), more.data.begin(), more.data.end());
+  for (auto const &entry : more.symbols) {
+    auto sym = entry.second;
+    if (sym.section == TEXT)
+      sym.offset += text_base;
+    else if (sym.section == DATA)
+      sym.offset += data_base;
+    auto known = symbols.find(entry.first);
+    if (known == symbols.end() || sym.section != UNDEF)
+      symbols[entry.first] = sym;
+  }
+  for (auto r : more.relocs) {
+    r.offset += text_base;
+    relocs.push_back(std::move(r));
+  }
+}
+
+void write_object(std::ostream &out, std::vector<Asm::ptr> const &prog) {
+  write_object(out, encode(prog));
+}
+
+void write_object(std::ostream &out, MachineCode const &mc) {
+  // Symbols: the locals first, then the globals and the undefined symbols
+  enum { TEXT = 1, DATA, NOTE, RELA, SYMTAB, STRTAB, SHSTRTAB, NUM_SECTIONS };
+  std::string strtab{'\0'};
+  std::vector<Elf64_Sym> symbols(1);
+  std::unordered_map<std::string, std::size_t> symbol_index;
+  for (bool global : {false, true})
+    for (auto const &entry : mc.symbols) {
+      auto const &info = entry.second;
+      if (info.global != global)
+        continue;
+      Elf64_Sym sym{};
+      sym.st_name = static_cast<Elf64_Word>(strtab.size());
+      strtab += entry.first;
+      strtab += '\0';
+      unsigned char type = STT_NOTYPE;
+      if (info.section == MachineCode::TEXT) {
+        sym.st_shndx = TEXT;
+        type = STT_FUNC;
+      } else if (info.section == MachineCode::DATA) {
+        sym.st_shndx = DATA;
+        type = STT_OBJECT;
+      } else {
+        sym.st_shndx = SHN_UNDEF;
+      }
+      sym.st_value = info.offset;
+      sym.st_info = ELF64_ST_INFO(global ? STB_GLOBAL : STB_LOCAL, type);
+      symbol_index[entry.first] = symbols.size();
+      symbols.push_back(sym);
+    }
+  auto first_global = std::count_if(
+      mc.symbols.begin(), mc.symbols.end(),
+      [](auto const &entry) { return !entry.second.global; }) + 1;
+
+  std::vector<Elf64_Rela> relas;
+  for (auto const &r : mc.relocs) {
+    Elf64_Rela rela{};
+    rela.r_offset = r.offset;
+    rela.r_info = ELF64_R_INFO(symbol_index.at(r.symbol), r.type);
+    rela.r_addend = r.addend;
+    relas.push_back(rela);
+  }
+
+  std::string shstrtab{'\0'};
+  auto section_name = [&](char const *name) {
+    auto off = static_cast<Elf64_Word>(shstrtab.size());
+    shstrtab += name;
+    shstrtab += '\0';
+    return off;
+  };
+
+  // Section contents follow the ELF header; the section headers come last
+  Bytes file(sizeof(Elf64_Ehdr));
+  auto append = [&](void const *p, std::size_t n, std::size_t align) {
+    while (file.size() % align != 0)
+      file.push_back(0);
+    auto off = file.size();
+    auto bytes = static_cast<uint8_t const *>(p);
+    file.insert(file.end(), bytes, bytes + n);
+    return off;
+  };
+  std::vector<Elf64_Shdr> sections(NUM_SECTIONS);
+  auto section = [&](int idx, char const *name, Elf64_Word type,
+                     Elf64_Xword flags, void const *p, std::size_t n,
+                     std::size_t align, Elf64_Xword entsize = 0) {
+    auto &sh = sections[idx];
+    sh.sh_name = section_name(name);
+    sh.sh_type = type;
+    sh.sh_flags = flags;
+    sh.sh_offset = append(p, n, align);
+    sh.sh_size = n;
+    sh.sh_addralign = align;
+    sh.sh_entsize = entsize;
+  };
+  section(TEXT, ".text", SHT_PROGBITS, SHF_ALLOC | SHF_EXECINSTR,
+          mc.text.data(), mc.text.size(), 16);
+  section(DATA, ".data", SHT_PROGBITS, SHF_ALLOC | SHF_WRITE, mc.data.data(),
+          mc.data.size(), 8);
+  section(NOTE, ".note.GNU-stack", SHT_PROGBITS, 0, nullptr, 0, 1);
+  section(RELA, ".rela.text", SHT_RELA, SHF_INFO_LINK, relas.data(),
+          relas.size() * sizeof(Elf64_Rela), 8, sizeof(Elf64_Rela));
+  sections[RELA].sh_link = SYMTAB;
+  sections[RELA].sh_info = TEXT;
+  section(SYMTAB, ".symtab", SHT_SYMTAB, 0, symbols.data(),
+          symbols.size() * sizeof(Elf64_Sym), 8, sizeof(Elf64_Sym));
+  sections[SYMTAB].sh_link = STRTAB;
+  sections[SYMTAB].sh_info = static_cast<Elf64_Word>(first_global);
+  section(STRTAB, ".strtab", SHT_STRTAB, 0, strtab.data(), strtab.size(), 1);
+  sections[SHSTRTAB].sh_name = section_name(".shstrtab");
+  sections[SHSTRTAB].sh_type = SHT_STRTAB;
+  sections[SHSTRTAB].sh_offset = append(shstrtab.data(), shstrtab.size(), 1);
+  sections[SHSTRTAB].sh_size = shstrtab.size();
+  sections[SHSTRTAB].sh_addralign = 1;
+  auto shoff =
+      append(sections.data(), sections.size() * sizeof(Elf64_Shdr), 8);
+
+  Elf64_Ehdr eh{};
+  std::memcpy(eh.e_ident, ELFMAG, SELFMAG);
+  eh.e_ident[EI_CLASS] = ELFCLASS64;
+  eh.e_ident[EI_DATA] = ELFDATA2LSB;
+  eh.e_ident[EI_VERSION] = EV_CURRENT;
+  eh.e_ident[EI_OSABI] = ELFOSABI_SYSV;
+  eh.e_type = ET_REL;
+  eh.e_machine = EM_X86_64;
+  eh.e_version = EV_CURRENT;
+  eh.e_shoff = shoff;
+  eh.e_ehsize = sizeof(Elf64_Ehdr);
+  eh.e_shentsize = sizeof(Elf64_Shdr);
+  eh.e_shnum = NUM_SECTIONS;
+  eh.e_shstrndx = SHSTRTAB;
+  std::memcpy(file.data(), &eh, sizeof eh);
+
+  out.write(reinterpret_cast<char const *>(file.data()),
+            static_cast<std::streamsize>(file.size()));
+}
+
+} // namespace amd64
+} // namespace bx
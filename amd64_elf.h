@@ -0,0 +1,62 @@
+#pragma once
+
+/**
+ * Machine code for amd64 assembly
+ *
+ * The Asm lines produced by the compiler are encoded straight into x86-64
+ * bytes, which are either written as a relocatable ELF object, so that no
+ * assembler has to re-read their text, or loaded in memory and run. Only the
+ * instructions and directives that the compiler emits are understood; anything
+ * else is an error.
+ */
+
+#include <cstdint>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "amd64.h"
+
+namespace bx {
+namespace amd64 {
+
+/** Encoded text and data, with what a linker still has to fill in */
+struct MachineCode {
+  enum Section { UNDEF, TEXT, DATA };
+  struct Symbol {
+    Section section = UNDEF;
+    std::size_t offset = 0;
+    bool global = false;
+  };
+  struct Reloc {
+    std::size_t offset; // in text
+    std::string symbol;
+    uint32_t type; // R_X86_64_PC32 or R_X86_64_PLT32
+    int64_t addend;
+  };
+
+  std::vector<uint8_t> text, data;
+  /** The globals and the targets of the relocations */
+  std::map<std::string, Symbol> symbols;
+  std::vector<Reloc> relocs;
+
+  /**
+   * Put more code after this one, as if both had been encoded together: the
+   * symbols that either defines are resolved and the rest stay undefined.
+   * Jumps never cross the boundary, so the code can come one callable at a
+   * time.
+   */
+  void append(MachineCode const &more);
+};
+
+MachineCode encode(std::vector<Asm::ptr> const &prog);
+
+/** Write encoded code to out as an ELF64 object file */
+void write_object(std::ostream &out, MachineCode const &mc);
+
+/** Encode the lines and write them to out as an ELF64 object file */
+void write_object(std::ostream &out, std::vector<Asm::ptr> const &prog);
+
+} // namespace amd64
+} // namespace bx
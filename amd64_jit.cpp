@@ -0,0 +1,124 @@
+/**
+ * In-process execution of amd64 machine code
+ *
+ * A single mapping holds the text, a stub for every runtime function and
+ * the data, in this order. The runtime functions live in the compiler, which
+ * may be further than the 2GB that a call can reach, so calls to them go
+ * through their stub: an indirect jmp through the 64-bit address stored
+ * right after it. Every relocation then has its target within the mapping.
+ * The text and the stubs are made executable and read-only before main is
+ * called; the data stays writable.
+ */
+
+#include <elf.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <unordered_map>
+
+#include "amd64_elf.h"
+#include "amd64_jit.h"
+
+extern "C" {
+void bx_panic();
+void bx_print_int(int64_t x);
+void bx_print_bool(int64_t x);
+}
+
+namespace bx {
+namespace amd64 {
+
+namespace {
+
+const std::unordered_map<std::string, void *> runtime = {
+    {"bx_panic", reinterpret_cast<void *>(&bx_panic)},
+    {"bx_print_int", reinterpret_cast<void *>(&bx_print_int)},
+    {"bx_print_bool", reinterpret_cast<void *>(&bx_print_bool)}};
+
+constexpr std::size_t stub_size = 16; // jmp *0(%rip); .quad target; padding
+
+std::size_t round_up(std::size_t n, std::size_t align) {
+  return (n + align - 1) / align * align;
+}
+
+/** A mapping of anonymous memory, unmapped when it goes out of scope */
+class Mapping {
+public:
+  uint8_t *base;
+  std::size_t size;
+
+  explicit Mapping(std::size_t size) : size{size} {
+    auto p = mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                  MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED)
+      throw std::runtime_error("Cannot map memory for the program");
+    base = static_cast<uint8_t *>(p);
+  }
+  Mapping(Mapping const &) = delete;
+  Mapping &operator=(Mapping const &) = delete;
+  ~Mapping() { munmap(base, size); }
+};
+
+} // namespace
+
+void run(std::vector<Asm::ptr> const &prog) { run(encode(prog)); }
+
+void run(MachineCode const &mc) {
+  auto page = static_cast<std::size_t>(sysconf(_SC_PAGESIZE));
+
+  std::unordered_map<std::string, std::size_t> stubs;
+  for (auto const &entry : mc.symbols)
+    if (entry.second.section == MachineCode::UNDEF) {
+      if (runtime.count(entry.first) == 0)
+        throw std::runtime_error("Undefined symbol " + entry.first);
+      stubs.insert({entry.first, stubs.size()});
+    }
+  auto stubs_start = round_up(mc.text.size(), stub_size);
+  auto data_start = round_up(stubs_start + stubs.size() * stub_size, page);
+  Mapping mem{round_up(data_start + mc.data.size() + 1, page)};
+
+  std::memcpy(mem.base, mc.text.data(), mc.text.size());
+  for (auto const &stub : stubs) {
+    auto p = mem.base + stubs_start + stub.second * stub_size;
+    static const uint8_t jmp[6] = {0xFF, 0x25, 0, 0, 0, 0};
+    std::memcpy(p, jmp, sizeof jmp);
+    auto target = runtime.at(stub.first);
+    std::memcpy(p + sizeof jmp, &target, sizeof target);
+  }
+  std::memcpy(mem.base + data_start, mc.data.data(), mc.data.size());
+
+  auto address = [&](std::string const &name) -> uint8_t * {
+    auto const &sym = mc.symbols.at(name);
+    switch (sym.section) {
+    case MachineCode::TEXT:
+      return mem.base + sym.offset;
+    case MachineCode::DATA:
+      return mem.base + data_start + sym.offset;
+    default:
+      return mem.base + stubs_start + stubs.at(name) * stub_size;
+    }
+  };
+  for (auto const &r : mc.relocs) {
+    if (r.type != R_X86_64_PC32 && r.type != R_X86_64_PLT32)
+      throw std::runtime_error("Unsupported relocation");
+    auto place = mem.base + r.offset;
+    auto value = address(r.symbol) + r.addend - place;
+    auto rel = static_cast<int32_t>(value);
+    std::memcpy(place, &rel, sizeof rel);
+  }
+
+  if (mc.symbols.count("main") == 0 ||
+      mc.symbols.at("main").section != MachineCode::TEXT)
+    throw std::runtime_error("No main to run");
+  if (mprotect(mem.base, data_start, PROT_READ | PROT_EXEC) != 0)
+    throw std::runtime_error("Cannot make the program executable");
+  auto main_fn = reinterpret_cast<void (*)()>(address("main"));
+  main_fn();
+  std::fflush(stdout);
+}
+
+} // namespace amd64
+} // namespace bx
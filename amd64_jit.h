@@ -0,0 +1,25 @@
+#pragma once
+
+/**
+ * Running amd64 assembly in the compiler's own process
+ *
+ * The encoded program is placed in freshly mapped memory, linked there
+ * against the runtime functions of bxrt.c, and its main is called directly.
+ */
+
+#include <vector>
+
+#include "amd64.h"
+#include "amd64_elf.h"
+
+namespace bx {
+namespace amd64 {
+
+/** Load prog into executable memory and call its main */
+void run(std::vector<Asm::ptr> const &prog);
+
+/** The same for code that is already encoded */
+void run(MachineCode const &mc);
+
+} // namespace amd64
+} // namespace bx
@@ -0,0 +1,548 @@
+#include "amd64_peephole.h"
+
+#include <cstdint>
+#include <optional>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace bx {
+namespace amd64 {
+
+namespace {
+
+/** A set of machine registers, bit n for the register numbered n */
+using Regs = uint32_t;
+
+// The x86 numbering, which is also that of the encoder
+const Reg reg_order[16] = {reg::rax, reg::rcx, reg::rdx, reg::rbx,
+                           reg::rsp, reg::rbp, reg::rsi, reg::rdi,
+                           reg::r8,  reg::r9,  reg::r10, reg::r11,
+                           reg::r12, reg::r13, reg::r14, reg::r15};
+
+Regs bit(std::string const &name) {
+  for (int n = 0; n < 16; n++)
+    if (name == reg_order[n])
+      return Regs{1} << n;
+  throw std::runtime_error("Unknown register: " + name);
+}
+
+const Regs all_regs = 0xFFFF;
+const Regs frame_regs = bit(reg::rsp) | bit(reg::rbp);
+const Regs arg_regs = bit(reg::rdi) | bit(reg::rsi) | bit(reg::rdx) |
+                      bit(reg::rcx) | bit(reg::r8) | bit(reg::r9);
+const Regs caller_saved = arg_regs | bit(reg::rax) | bit(reg::r10) |
+                          bit(reg::r11);
+const Regs callee_saved = bit(reg::rbx) | bit(reg::r12) | bit(reg::r13) |
+                          bit(reg::r14) | bit(reg::r15);
+
+/** An operand, as it is printed once the pseudos are bound */
+struct Operand {
+  enum Kind { REG, SLOT, GLOBAL, IMM, OTHER } kind = OTHER;
+  std::string text;
+  /** for REG and SLOT, the pseudo to rebuild an instruction with */
+  std::optional<Pseudo> pseudo;
+  int64_t imm = 0;
+  /** the registers it mentions */
+  Regs regs = 0;
+};
+
+struct Line {
+  enum Kind { LABEL, DIRECTIVE, INSTR } kind;
+  /** the mnemonic, or the label */
+  std::string name;
+  std::vector<Operand> ops;
+  Asm::ptr line;
+  bool deleted = false;
+};
+
+std::string to_text(Pseudo const &p) {
+  if (!p.binding.has_value())
+    throw std::runtime_error("Peephole optimisation needs allocated pseudos");
+  auto b = p.binding.value();
+  if (auto reg = std::get_if<0>(&b))
+    return *reg;
+  return std::to_string(-8 * std::get<1>(b)) + "(%rbp)";
+}
+
+Regs regs_of(std::string const &text) {
+  Regs regs = 0;
+  for (auto pct = text.find('%'); pct != std::string::npos;
+       pct = text.find('%', pct + 1)) {
+    auto end = text.find_first_of(",)", pct);
+    auto name = text.substr(pct, end == std::string::npos ? end : end - pct);
+    if (name != "%rip")
+      regs |= bit(name == "%cl" ? reg::rcx : name);
+  }
+  return regs;
+}
+
+Operand decode_operand(Asm const &a, std::string const &tmpl) {
+  Operand op;
+  Pseudo const *only = nullptr;
+  for (std::size_t i = 0; i < tmpl.size(); i++) {
+    if (tmpl[i] != '`') {
+      op.text += tmpl[i];
+      continue;
+    }
+    char kind = tmpl[++i];
+    std::size_t idx = tmpl[++i] - '0';
+    if (kind == 'j') {
+      op.text += a.jump_dests[idx];
+      continue;
+    }
+    auto const &p = kind == 's' ? a.use[idx] : a.def[idx];
+    if (tmpl.size() == 3)
+      only = &p;
+    op.text += to_text(p);
+  }
+  op.regs = regs_of(op.text);
+  if (only) {
+    op.kind = std::holds_alternative<Reg>(*only->binding) ? Operand::REG
+                                                          : Operand::SLOT;
+    op.pseudo.emplace(*only);
+  } else if (!op.text.empty() && op.text[0] == '$') {
+    op.kind = Operand::IMM;
+    op.imm = std::stoll(op.text.substr(1));
+  } else if (op.text.size() > 6 &&
+             op.text.compare(op.text.size() - 6, 6, "(%rip)") == 0) {
+    op.kind = Operand::GLOBAL;
+  }
+  return op;
+}
+
+Line decode(Asm::ptr const &a) {
+  auto const &t = a->repr_template;
+  if (t.empty() || t[0] != '\t')
+    return Line{Line::LABEL, t.substr(0, t.size() - 1), {}, a};
+  if (t[1] == '.')
+    return Line{Line::DIRECTIVE, t.substr(1), {}, a};
+  auto space = t.find(' ');
+  Line l{Line::INSTR, t.substr(1, space - 1), {}, a};
+  for (auto start = space; start != std::string::npos;) {
+    auto comma = t.find(", ", start + 1);
+    auto end = comma == std::string::npos ? t.size() : comma;
+    l.ops.push_back(decode_operand(*a, t.substr(start + 1, end - start - 1)));
+    start = comma == std::string::npos ? comma : comma + 1;
+  }
+  return l;
+}
+
+bool is_jcc(std::string const &mn) {
+  return mn == "je" || mn == "jne" || mn == "jl" || mn == "jle" ||
+         mn == "jg" || mn == "jge";
+}
+
+bool is_jump(std::string const &mn) { return mn == "jmp" || is_jcc(mn); }
+
+bool sets_flags(std::string const &mn) {
+  static const std::unordered_set<std::string> setters{
+      "addq", "subq",  "andq", "orq",  "xorq", "imulq", "idivq",
+      "cmpq", "testq", "negq", "incq", "decq", "salq",  "sarq",
+      "shrq", "call",  "ret"};
+  return setters.count(mn) > 0;
+}
+
+struct Effect {
+  Regs use = 0, def = 0;
+};
+
+Effect effect(Line const &l) {
+  auto const &mn = l.name;
+  auto const &ops = l.ops;
+  // a register destination is written, a memory one reads its address
+  auto dest = [&](Operand const &op, Effect &e) {
+    if (op.kind == Operand::REG)
+      e.def |= op.regs;
+    else
+      e.use |= op.regs;
+  };
+  Effect e;
+  if (mn == "movq" || mn == "movabsq" || mn == "leaq" || mn == "popq") {
+    for (std::size_t i = 0; i + 1 < ops.size(); i++)
+      e.use |= ops[i].regs;
+    dest(ops.back(), e);
+    if (mn == "popq")
+      e.use |= bit(reg::rsp), e.def |= bit(reg::rsp);
+  } else if (mn == "addq" || mn == "subq" || mn == "andq" || mn == "orq" ||
+             mn == "xorq" || mn == "salq" || mn == "sarq" || mn == "shrq" ||
+             (mn == "imulq" && ops.size() == 2) || mn == "negq" ||
+             mn == "notq" || mn == "incq" || mn == "decq") {
+    for (auto const &op : ops)
+      e.use |= op.regs;
+    dest(ops.back(), e);
+  } else if (mn == "cmpq" || mn == "testq" || mn == "pushq") {
+    for (auto const &op : ops)
+      e.use |= op.regs;
+    if (mn == "pushq")
+      e.use |= bit(reg::rsp), e.def |= bit(reg::rsp);
+  } else if (mn == "cqo") {
+    e.use = bit(reg::rax), e.def = bit(reg::rdx);
+  } else if (mn == "imulq" || mn == "idivq") {
+    e.use = ops[0].regs | bit(reg::rax) | bit(reg::rdx);
+    e.def = bit(reg::rax) | bit(reg::rdx);
+  } else if (mn == "call") {
+    e.use = arg_regs | frame_regs, e.def = caller_saved;
+  } else if (mn == "ret") {
+    e.use = bit(reg::rax) | callee_saved | frame_regs;
+  } else if (!is_jump(mn)) {
+    e.use = all_regs;
+  }
+  return e;
+}
+
+class Peephole {
+  std::vector<Line> lines;
+  std::unordered_map<std::string, std::size_t> label_line;
+  std::unordered_map<std::string, int> label_refs;
+  /** registers live after each line, as of the start of the sweep */
+  std::vector<Regs> live_out;
+  PeepholeStats &stats;
+
+  using Rule = bool (Peephole::*)(std::size_t);
+  static const std::vector<std::pair<char const *, Rule>> rules;
+
+public:
+  Peephole(std::vector<Asm::ptr> const &prog, PeepholeStats &stats)
+      : stats{stats} {
+    for (auto const &a : prog)
+      lines.push_back(decode(a));
+  }
+
+  bool sweep() {
+    index();
+    compute_liveness();
+    bool changed = false;
+    for (std::size_t i = 0; i < lines.size(); i++)
+      for (auto const &rule : rules)
+        if (!lines[i].deleted && (this->*rule.second)(i)) {
+          stats[rule.first]++;
+          changed = true;
+          break;
+        }
+    return changed;
+  }
+
+  std::vector<Asm::ptr> result() const {
+    std::vector<Asm::ptr> prog;
+    for (auto const &l : lines)
+      if (!l.deleted)
+        prog.push_back(l.line);
+    return prog;
+  }
+
+private:
+  void index() {
+    std::vector<Line> kept;
+    for (auto &l : lines)
+      if (!l.deleted)
+        kept.push_back(std::move(l));
+    lines = std::move(kept);
+    label_line.clear();
+    label_refs.clear();
+    for (std::size_t i = 0; i < lines.size(); i++)
+      if (lines[i].kind == Line::LABEL)
+        label_line[lines[i].name] = i;
+      else
+        for (auto const &dest : lines[i].line->jump_dests)
+          label_refs[dest]++;
+  }
+
+  void compute_liveness() {
+    std::size_t n = lines.size();
+    live_out.assign(n, 0);
+    std::vector<Regs> live_in(n, 0);
+    auto in_at = [&](std::string const &label) {
+      auto it = label_line.find(label);
+      return it == label_line.end() ? all_regs : live_in[it->second];
+    };
+    std::vector<Effect> effects(n);
+    for (std::size_t i = 0; i < n; i++)
+      if (lines[i].kind == Line::INSTR)
+        effects[i] = effect(lines[i]);
+    for (bool changed = true; changed;) {
+      changed = false;
+      for (std::size_t i = n; i-- > 0;) {
+        auto const &l = lines[i];
+        Regs out = 0;
+        bool falls = l.kind != Line::INSTR ||
+                     (l.name != "jmp" && l.name != "ret");
+        if (falls && i + 1 < n)
+          out |= live_in[i + 1];
+        if (l.kind == Line::INSTR && is_jump(l.name))
+          out |= in_at(l.ops[0].text);
+        Regs in = (out & ~effects[i].def) | effects[i].use;
+        if (in != live_in[i] || out != live_out[i])
+          changed = true;
+        live_in[i] = in, live_out[i] = out;
+      }
+    }
+  }
+
+  void replace(std::size_t i, Asm::ptr const &a) { lines[i] = decode(a); }
+
+  /** the next line that has not been deleted, if any */
+  std::optional<std::size_t> next(std::size_t i) const {
+    for (i++; i < lines.size(); i++)
+      if (!lines[i].deleted)
+        return i;
+    return std::nullopt;
+  }
+
+  /** the next line, if it is an instruction that only i falls into */
+  std::optional<std::size_t> next_instr(std::size_t i) const {
+    auto j = next(i);
+    if (j && lines[*j].kind == Line::INSTR)
+      return j;
+    return std::nullopt;
+  }
+
+  /** the first instruction executed from the given label on */
+  std::optional<std::size_t> at_label(std::string const &label) const {
+    auto it = label_line.find(label);
+    if (it == label_line.end())
+      return std::nullopt;
+    for (auto j = next(it->second); j; j = next(*j))
+      if (lines[*j].kind != Line::LABEL)
+        return lines[*j].kind == Line::INSTR ? j : std::nullopt;
+    return std::nullopt;
+  }
+
+  /** whether the flags set by line i are overwritten before being read */
+  bool flags_dead_after(std::size_t i) const {
+    for (auto j = next_instr(i); j; j = next_instr(*j)) {
+      auto const &mn = lines[*j].name;
+      if (is_jump(mn))
+        return false;
+      if (sets_flags(mn))
+        return true;
+    }
+    return false;
+  }
+
+  bool is_move(Line const &l) const {
+    return l.kind == Line::INSTR && l.name == "movq" && l.ops.size() == 2;
+  }
+
+  static Regs reg_bit(Operand const &op) {
+    return op.kind == Operand::REG ? op.regs : 0;
+  }
+
+  // The rules. Each is tried at line i, whose window is i and the lines
+  // after it, and rewrites that window if it fires.
+
+  bool unreachable(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::INSTR || (l.name != "jmp" && l.name != "ret"))
+      return false;
+    auto j = next_instr(i);
+    if (!j)
+      return false;
+    lines[*j].deleted = true;
+    return true;
+  }
+
+  bool unused_label(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::LABEL || l.name.rfind(".L", 0) != 0 ||
+        label_refs.count(l.name) > 0)
+      return false;
+    lines[i].deleted = true;
+    return true;
+  }
+
+  bool jump_to_next(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::INSTR || !is_jump(l.name))
+      return false;
+    for (auto j = next(i); j && lines[*j].kind == Line::LABEL; j = next(*j))
+      if (lines[*j].name == l.ops[0].text) {
+        lines[i].deleted = true;
+        label_refs[l.ops[0].text]--;
+        return true;
+      }
+    return false;
+  }
+
+  bool jump_to_jump(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::INSTR || !is_jump(l.name))
+      return false;
+    auto target = at_label(l.ops[0].text);
+    if (!target || lines[*target].name != "jmp" ||
+        lines[*target].ops[0].text == l.ops[0].text)
+      return false;
+    auto const &dest = lines[*target].ops[0].text;
+    label_refs[l.ops[0].text]--;
+    label_refs[dest]++;
+    static const std::unordered_map<std::string, Asm::ptr (*)(Label const &)>
+        branch{{"jmp", Asm::jmp}, {"je", Asm::je},   {"jne", Asm::jne},
+               {"jl", Asm::jl},   {"jle", Asm::jle}, {"jg", Asm::jg},
+               {"jge", Asm::jge}};
+    replace(i, branch.at(l.name)(dest));
+    return true;
+  }
+
+  bool jump_to_ret(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::INSTR || l.name != "jmp")
+      return false;
+    auto target = at_label(l.ops[0].text);
+    if (!target || lines[*target].name != "ret")
+      return false;
+    label_refs[l.ops[0].text]--;
+    replace(i, Asm::ret());
+    return true;
+  }
+
+  bool self_move(std::size_t i) {
+    auto const &l = lines[i];
+    if (!is_move(l) || l.ops[0].text != l.ops[1].text)
+      return false;
+    lines[i].deleted = true;
+    return true;
+  }
+
+  bool move_back(std::size_t i) {
+    auto j = next_instr(i);
+    if (!is_move(lines[i]) || !j || !is_move(lines[*j]))
+      return false;
+    auto const &a = lines[i].ops, &b = lines[*j].ops;
+    auto plain = [](Operand const &op) {
+      return op.kind == Operand::REG || op.kind == Operand::SLOT ||
+             op.kind == Operand::GLOBAL;
+    };
+    if (!plain(a[0]) || !plain(a[1]) ||
+        (a[0].kind != Operand::REG && a[1].kind != Operand::REG) ||
+        a[0].text != b[1].text || a[1].text != b[0].text)
+      return false;
+    lines[*j].deleted = true;
+    return true;
+  }
+
+  bool store_load(std::size_t i) {
+    auto j = next_instr(i);
+    if (!is_move(lines[i]) || !j || !is_move(lines[*j]))
+      return false;
+    auto const &store = lines[i].ops, &load = lines[*j].ops;
+    if (store[0].kind != Operand::REG ||
+        (store[1].kind != Operand::SLOT && store[1].kind != Operand::GLOBAL) ||
+        store[1].text != load[0].text || load[1].kind != Operand::REG)
+      return false;
+    if (store[0].text == load[1].text)
+      lines[*j].deleted = true;
+    else
+      replace(*j, Asm::movq(*store[0].pseudo, *load[1].pseudo));
+    return true;
+  }
+
+  bool fold_immediate(std::size_t i) {
+    auto j = next_instr(i);
+    if (!is_move(lines[i]) || !j)
+      return false;
+    auto const &load = lines[i].ops;
+    auto const &user = lines[*j];
+    if (load[0].kind != Operand::IMM || load[1].kind != Operand::REG ||
+        user.ops.size() != 2 || user.ops[0].text != load[1].text ||
+        user.ops[1].text == load[1].text || (live_out[*j] & load[1].regs))
+      return false;
+    auto const &dest = user.ops[1];
+    bool to_reg = dest.kind == Operand::REG;
+    if (!to_reg && (dest.kind != Operand::SLOT || user.name == "imulq"))
+      return false;
+    using Op = Asm::ptr (*)(int64_t, Pseudo const &);
+    static const std::unordered_map<std::string, Op> with_imm{
+        {"movq", Asm::movq}, {"addq", Asm::addq}, {"subq", Asm::subq},
+        {"andq", Asm::andq}, {"orq", Asm::orq},   {"xorq", Asm::xorq},
+        {"imulq", Asm::imulq}};
+    auto k = load[0].imm;
+    if (user.name == "cmpq")
+      replace(*j, Asm::cmpq(static_cast<int32_t>(k), *dest.pseudo));
+    else if (with_imm.count(user.name))
+      replace(*j, with_imm.at(user.name)(k, *dest.pseudo));
+    else
+      return false;
+    lines[i].deleted = true;
+    return true;
+  }
+
+  bool dead_move(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::INSTR || (l.name != "movq" && l.name != "movabsq") ||
+        l.ops[1].kind != Operand::REG || (l.ops[1].regs & frame_regs) ||
+        (live_out[i] & l.ops[1].regs))
+      return false;
+    lines[i].deleted = true;
+    return true;
+  }
+
+  bool identity(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::INSTR || l.ops.size() != 2 ||
+        l.ops[0].kind != Operand::IMM)
+      return false;
+    auto k = l.ops[0].imm;
+    bool neutral = (k == 0 && (l.name == "addq" || l.name == "subq" ||
+                               l.name == "orq" || l.name == "xorq" ||
+                               l.name == "salq" || l.name == "sarq")) ||
+                   (k == 1 && l.name == "imulq");
+    if (!neutral || !flags_dead_after(i))
+      return false;
+    lines[i].deleted = true;
+    return true;
+  }
+
+  bool strength(std::size_t i) {
+    auto const &l = lines[i];
+    if (l.kind != Line::INSTR || l.name != "imulq" || l.ops.size() != 2 ||
+        l.ops[0].kind != Operand::IMM || l.ops[1].kind != Operand::REG)
+      return false;
+    auto k = l.ops[0].imm;
+    if (k < 2 || (k & (k - 1)) != 0 || !flags_dead_after(i))
+      return false;
+    int shift = 0;
+    while ((int64_t{1} << shift) != k)
+      shift++;
+    replace(i, Asm::salq(shift, *l.ops[1].pseudo));
+    return true;
+  }
+
+  bool zero_register(std::size_t i) {
+    auto const &l = lines[i];
+    if (!is_move(l) || l.ops[0].kind != Operand::IMM || l.ops[0].imm != 0 ||
+        l.ops[1].kind != Operand::REG || !flags_dead_after(i))
+      return false;
+    replace(i, Asm::xorq(*l.ops[1].pseudo, *l.ops[1].pseudo));
+    return true;
+  }
+};
+
+// In order of priority at any one line
+const std::vector<std::pair<char const *, Peephole::Rule>> Peephole::rules{
+    {"unreachable code", &Peephole::unreachable},
+    {"unused label", &Peephole::unused_label},
+    {"jump to next", &Peephole::jump_to_next},
+    {"jump to jump", &Peephole::jump_to_jump},
+    {"jump to ret", &Peephole::jump_to_ret},
+    {"self move", &Peephole::self_move},
+    {"move back", &Peephole::move_back},
+    {"store-load forwarding", &Peephole::store_load},
+    {"immediate folding", &Peephole::fold_immediate},
+    {"dead move", &Peephole::dead_move},
+    {"identity", &Peephole::identity},
+    {"strength reduction", &Peephole::strength},
+    {"zero register", &Peephole::zero_register},
+};
+
+} // namespace
+
+PeepholeStats peephole(std::vector<Asm::ptr> &prog) {
+  PeepholeStats stats;
+  Peephole ph{prog, stats};
+  while (ph.sweep())
+    ;
+  prog = ph.result();
+  return stats;
+}
+
+} // namespace amd64
+} // namespace bx
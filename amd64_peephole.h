@@ -0,0 +1,29 @@
+#pragma once
+
+/**
+ * Peephole optimisation of amd64 assembly
+ *
+ * The allocated assembly is swept with a small window, and every rule of a
+ * fixed table is tried at each position: moves that do nothing or undo the
+ * previous one, jumps to jumps or to the next line, code that cannot be
+ * reached, reloads of a value that was just stored, immediates that can be
+ * folded into the instruction that uses them, and multiplications that are
+ * cheaper as shifts. Sweeps repeat until no rule fires.
+ */
+
+#include <map>
+#include <string>
+#include <vector>
+
+#include "amd64.h"
+
+namespace bx {
+namespace amd64 {
+
+/** How many times each rule fired, by name */
+using PeepholeStats = std::map<std::string, int>;
+
+PeepholeStats peephole(std::vector<Asm::ptr> &prog);
+
+} // namespace amd64
+} // namespace bx
@@ -3,6 +3,7 @@
 #include <memory>
 #include <ostream>
 #include <string>
+#include <string_view>
 
 #include "antlr4-runtime.h"
 
@@ -309,8 +310,22 @@ std::ostream &operator<<(std::ostream &out, Program const &prog);
 ////////////////////////////////////////////////////////////////////////////////
 // Parsing
 
+/** Parse a file with the ANTLR parser generated from BX.g4 */
 source::Program read_program(std::string file);
 
+/**
+ * Parse source text with the hand-written parser of parser.cpp, which builds
+ * the same Program as read_program() with no parse tree in between. Syntax
+ * errors are thrown as std::runtime_error.
+ */
+source::Program parse_program(std::string_view text);
+
+/** The same, for the contents of a file */
+source::Program parse_file(std::string const &file);
+
+/** Whether two programs are the same tree, to check one parser with another */
+bool same_program(source::Program const &, source::Program const &);
+
 } // namespace source
 } // namespace bx
 
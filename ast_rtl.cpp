@@ -8,9 +8,6 @@ namespace rtl {
 
 using source::Type;
 
-int last_pseudo = 0;
-int last_label = 0;
-
 /**
  * A common generator for both expressions and statements
  *
@@ -87,6 +84,7 @@ public:
   RtlGen(source::Program const &source_prog, std::string const &name,
         std::string type)
       : source_prog{source_prog}, rtl_cbl{name} {
+    Numbering::Scope scope{rtl_cbl.numbering};
     auto &cbl = source_prog.callables.at(rtl_cbl.name);
     rtl_cbl.type = type;
     // input pseudos
@@ -380,19 +378,24 @@ public:
   }
 };
 
+rtl::Callable transform(source::Program const &src_prog,
+                        std::string const &name) {
+  auto const &cbl = src_prog.callables.at(name);
+  std::string type;
+  if (cbl->return_ty == source::Type::INT64 || cbl->return_ty == source::Type::BOOL){
+    type = "i64";
+  }
+  else{
+    type = "void";
+  }
+  RtlGen gen{src_prog, name, type};
+  return gen.deliver();
+}
+
 rtl::Program transform(source::Program const &src_prog) {
   rtl::Program rtl_prog;
-  for (auto const &cbl : src_prog.callables) {
-    std::string type;
-    if (cbl.second->return_ty == source::Type::INT64 || cbl.second->return_ty == source::Type::BOOL){
-      type = "i64";
-    }
-    else{
-      type = "void";
-    }
-    RtlGen gen{src_prog, cbl.first, type};
-    rtl_prog.push_back(gen.deliver());
-  }
+  for (auto const &cbl : src_prog.callables)
+    rtl_prog.push_back(transform(src_prog, cbl.first));
   return rtl_prog;
 }
 
@@ -6,6 +6,9 @@
 namespace bx {
 namespace rtl {
 
+/** The RTL of the callable of the given name */
+rtl::Callable transform(source::Program const &prog, std::string const &name);
+
 rtl::Program transform(source::Program const &prog);
 
 } // namespace rtl
@@ -0,0 +1,146 @@
+#include <algorithm>
+#include <utility>
+
+#include "dominators.h"
+
+namespace bx {
+namespace ssa {
+
+DomTree::DomTree(Callable const &cbl) {
+  // Number the reachable blocks in reverse postorder with an explicit stack
+  {
+    std::vector<Label> postorder;
+    rtl::LabelMap<bool> visited;
+    std::vector<std::pair<Label, std::size_t>> stack{{cbl.enter, 0}};
+    visited[cbl.enter] = true;
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      auto const &outs = cbl.body.at(top.first)->outlabels;
+      if (top.second < outs.size()) {
+        auto next = outs[top.second++];
+        if (!visited[next]) {
+          visited[next] = true;
+          stack.push_back({next, 0});
+        }
+        continue;
+      }
+      postorder.push_back(top.first);
+      stack.pop_back();
+    }
+    order.assign(postorder.rbegin(), postorder.rend());
+  }
+  for (int i = 0; i < size(); i++)
+    index[order[i]] = i;
+
+  preds.resize(size());
+  succs.resize(size());
+  for (int i = 0; i < size(); i++)
+    for (auto const &out : cbl.body.at(order[i])->outlabels) {
+      int j = index.at(out);
+      succs[i].push_back(j);
+      preds[j].push_back(i);
+    }
+
+  // Cooper-Harvey-Kennedy: iterate to a fixpoint in reverse postorder
+  idom.assign(size(), -1);
+  idom[0] = 0;
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (int b = 1; b < size(); b++) {
+      int new_idom = -1;
+      for (int p : preds[b]) {
+        if (idom[p] == -1)
+          continue;
+        new_idom = new_idom == -1 ? p : intersect(p, new_idom);
+      }
+      if (new_idom != idom[b]) {
+        idom[b] = new_idom;
+        changed = true;
+      }
+    }
+  }
+
+  children.resize(size());
+  for (int b = 1; b < size(); b++)
+    children[idom[b]].push_back(b);
+
+  // Pre/post numbering of the dominator tree for O(1) dominance queries
+  pre.assign(size(), 0);
+  post.assign(size(), 0);
+  {
+    int clock = 0;
+    std::vector<std::pair<int, std::size_t>> stack{{0, 0}};
+    pre[0] = clock++;
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      if (top.second < children[top.first].size()) {
+        int child = children[top.first][top.second++];
+        pre[child] = clock++;
+        stack.push_back({child, 0});
+        continue;
+      }
+      post[top.first] = clock++;
+      stack.pop_back();
+    }
+  }
+
+  // Dominance frontiers: a join block b is in the frontier of every block on
+  // the tree path from each of its predecessors up to (excluding) idom(b)
+  frontier.resize(size());
+  for (int b = 0; b < size(); b++) {
+    if (preds[b].size() < 2)
+      continue;
+    for (int p : preds[b]) {
+      for (int runner = p; runner != idom[b]; runner = idom[runner]) {
+        auto &df = frontier[runner];
+        if (df.empty() || df.back() != b)
+          df.push_back(b);
+        if (runner == 0)
+          break;
+      }
+    }
+  }
+}
+
+std::vector<Loop> find_loops(DomTree const &dom) {
+  std::vector<Loop> loops;
+  std::vector<int> stamp(dom.size(), -1);
+  for (int h = 0; h < dom.size(); h++) {
+    std::vector<int> work;
+    for (int p : dom.preds[h])
+      if (dom.dominates(h, p))
+        work.push_back(p);
+    if (work.empty())
+      continue;
+    Loop loop{dom.order[h], {h}};
+    stamp[h] = h;
+    // Walk backwards from the latches, stopping at the header
+    while (!work.empty()) {
+      int b = work.back();
+      work.pop_back();
+      if (stamp[b] == h)
+        continue;
+      stamp[b] = h;
+      loop.blocks.push_back(b);
+      for (int p : dom.preds[b])
+        work.push_back(p);
+    }
+    std::sort(loop.blocks.begin(), loop.blocks.end());
+    loops.push_back(std::move(loop));
+  }
+  return loops;
+}
+
+int DomTree::intersect(int a, int b) const {
+  while (a != b) {
+    while (a > b)
+      a = idom[a];
+    while (b > a)
+      b = idom[b];
+  }
+  return a;
+}
+
+} // namespace ssa
+} // namespace bx
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <vector>
+
+#include "ssa.h"
+
+/** Dominator tree and dominance frontiers over the blocks of an SSA callable */
+
+namespace bx {
+
+namespace ssa {
+
+/**
+ * The blocks reachable from the enter label are numbered in reverse
+ * postorder, so the enter block is always 0 and every block comes after its
+ * immediate dominator. Unreachable blocks get no number at all.
+ *
+ * Immediate dominators are computed with the iterative algorithm of Cooper,
+ * Harvey and Kennedy, and dominance frontiers by walking up the tree from the
+ * predecessors of each join block.
+ */
+struct DomTree {
+  std::vector<Label> order;   // reverse postorder of the reachable blocks
+  rtl::LabelMap<int> index;   // inverse of order
+  std::vector<std::vector<int>> preds, succs;
+  std::vector<int> idom;      // idom[0] == 0
+  std::vector<std::vector<int>> children;
+  std::vector<std::vector<int>> frontier;
+
+  explicit DomTree(Callable const &cbl);
+
+  int size() const { return static_cast<int>(order.size()); }
+
+  bool reachable(Label const &lab) const {
+    return index.find(lab) != index.end();
+  }
+
+  /** Does block a dominate block b? Both are indices into order */
+  bool dominates(int a, int b) const {
+    return pre[a] <= pre[b] && post[b] <= post[a];
+  }
+
+private:
+  std::vector<int> pre, post; // dominator tree DFS numbering
+  int intersect(int a, int b) const;
+};
+
+/** A natural loop: its header and all its blocks, as indices into order */
+struct Loop {
+  Label header;
+  std::vector<int> blocks; // sorted, so in reverse postorder
+};
+
+/**
+ * The natural loops of the back edges (edges to a dominator), with the loops
+ * that share a header merged into one.
+ */
+std::vector<Loop> find_loops(DomTree const &dom);
+
+} // namespace ssa
+
+} // namespace bx
@@ -46,6 +46,8 @@ struct GetMach;
 struct SetMach;
 struct Load;
 struct LoadParam;
+struct LoadSlot;
+struct StoreSlot;
 struct Store;
 struct Binop;
 struct Unop;
@@ -69,6 +71,8 @@ struct InstrVisitor {
   VISIT_FUNCTION(SetMach);
   VISIT_FUNCTION(Load);
   VISIT_FUNCTION(LoadParam);
+  VISIT_FUNCTION(LoadSlot);
+  VISIT_FUNCTION(StoreSlot);
   VISIT_FUNCTION(Store);
   VISIT_FUNCTION(Binop);
   VISIT_FUNCTION(Unop);
@@ -177,6 +181,32 @@ struct LoadParam : public Instr {
       : slot{slot}, dest{dest}, succ{succ} {}
 };
 
+/** Reload a spilled pseudo from its stack slot (inserted by the allocator) */
+struct LoadSlot : public Instr {
+  int slot;
+  Pseudo dest;
+  Label succ;
+  std::ostream &print(std::ostream &out) const override {
+    return out << "load_slot " << slot << ", " << dest << "  --> " << succ;
+  }
+  MAKE_VISITABLE
+  CONSTRUCTOR(LoadSlot, int slot, Pseudo dest, Label succ)
+      : slot{slot}, dest{dest}, succ{succ} {}
+};
+
+/** Spill a pseudo to its stack slot (inserted by the allocator) */
+struct StoreSlot : public Instr {
+  Pseudo src;
+  int slot;
+  Label succ;
+  std::ostream &print(std::ostream &out) const override {
+    return out << "store_slot " << src << ", " << slot << "  --> " << succ;
+  }
+  MAKE_VISITABLE
+  CONSTRUCTOR(StoreSlot, Pseudo src, int slot, Label succ)
+      : src{src}, slot{slot}, succ{succ} {}
+};
+
 struct Store : public Instr {
   Pseudo src;
   std::string dest;
@@ -345,9 +375,10 @@ struct Delframe : public Instr {
 struct Callable {
   std::string name;
   Label enter, leave;
-  std::vector<std::pair<Mach, Pseudo>> callee_saves;
+  int num_slots = 0; // stack slots used for spilled pseudos
   rtl::LabelMap<InstrPtr> body;
   std::vector<Label> schedule; // the order in which the labels are scheduled
+  rtl::Numbering numbering;
   explicit Callable(std::string name) : name{name} {}
   void add_instr(Label lab, InstrPtr instr) {
     if (body.find(lab) != body.end()) {
@@ -0,0 +1,92 @@
+#pragma once
+
+/**
+ * Register allocation for ERTL
+ *
+ * The allocators map every pseudo of a callable onto one of the machine
+ * registers. The ones that do not fit are spilled: the callable is rewritten
+ * so that they live in stack slots, with a load before every read and a
+ * store after every write through short-lived pseudos, and the allocation is
+ * tried again.
+ */
+
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ertl.h"
+
+namespace bx {
+namespace ertl {
+
+/** The registers the allocators hand out: all but %rsp and %rbp */
+constexpr int num_allocatable = 14;
+extern const Mach allocatable[num_allocatable];
+
+/** The register chosen for every pseudo, by pseudo id */
+using Assignment = std::unordered_map<int, Mach>;
+
+/**
+ * The locations an instruction reads and writes. Machine register m is
+ * location static_cast<int>(m); pseudos are numbered after the registers.
+ */
+struct Access {
+  std::vector<int> uses, defs;
+  /** A copy from uses[0] to defs[0], which the allocator tries to remove */
+  bool move = false;
+  /** Pairs of locations that must not share a register */
+  std::vector<std::pair<int, int>> conflicts;
+};
+
+/** Liveness analysis over the basic blocks of a callable */
+struct Liveness {
+  static constexpr int num_mach = 16;
+
+  std::vector<Pseudo> pseudos; // location num_mach + i is pseudos[i]
+  std::unordered_map<int, int> location_of; // by pseudo id
+  rtl::LabelMap<Access> access;
+  std::vector<std::vector<Label>> blocks; // the labels of every block in order
+  std::vector<std::vector<int>> succs;
+  std::vector<std::vector<int>> live_out; // sorted locations
+
+  explicit Liveness(Callable const &cbl);
+  int size() const { return num_mach + static_cast<int>(pseudos.size()); }
+  int location(Pseudo const &ps) const { return location_of.at(ps.id); }
+
+private:
+  int locate(Pseudo const &ps);
+};
+
+/**
+ * Rewrite the callable so that every pseudo in spilled lives in a fresh stack
+ * slot. The short-lived pseudos that carry the values to and from the slots
+ * are added to temps.
+ */
+void spill(Callable &cbl, std::vector<Pseudo> const &spilled,
+           std::unordered_set<int> &temps);
+
+/**
+ * Graph coloring with iterated coalescing (George and Appel). Copies whose
+ * ends do not interfere are removed by giving both ends the same register
+ * when that cannot make the graph harder to color. May add spill code to the
+ * callable.
+ */
+Assignment color_registers(Callable &cbl);
+
+/**
+ * Linear scan over live intervals (Poletto and Sarkar): much faster than
+ * coloring on large callables, at the price of somewhat worse code since the
+ * intervals ignore lifetime holes and copies are only removed when a register
+ * happens to be free. May add spill code to the callable.
+ */
+Assignment scan_registers(Callable &cbl);
+
+enum class Allocator { COLOR, LINEAR_SCAN };
+
+inline Assignment allocate_registers(Callable &cbl, Allocator allocator) {
+  return allocator == Allocator::LINEAR_SCAN ? scan_registers(cbl)
+                                             : color_registers(cbl);
+}
+
+} // namespace ertl
+} // namespace bx
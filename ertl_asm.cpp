@@ -1,6 +1,12 @@
 /**
  * This file transforms RTL to AMD64 assembly
  *
+ * The pseudos are first given registers by the allocator (ertl_alloc.h), which
+ * may add spill code to the callable; the stack slots it uses for that and
+ * the saved callee-save registers are the only memory in the frame, which is
+ * laid out by ertl_frame.h. The instruction selector (ertl_select.h) then
+ * tiles what it can, and the remaining instructions are compiled one by one.
+ *
  * Classes:
  *
  *     bx::InstrCompiler:
@@ -8,10 +14,11 @@
  *
  *  Functions
  *
- *     AsmProgram bx::asm_generate(global_vars, prog)
+ *     AsmProgram bx::asm_generate(global_vars, prog, allocator)
  *         The main compilation function
  */
 
+#include <algorithm>
 #include <cassert>
 #include <cstdint>
 #include <stdexcept>
@@ -19,7 +26,10 @@
 
 #include "amd64.h"
 #include "ertl.h"
+#include "ertl_alloc.h"
 #include "ertl_asm.h"
+#include "ertl_frame.h"
+#include "ertl_select.h"
 #include "rtl.h"
 
 namespace bx {
@@ -31,23 +41,73 @@ private:
   source::Program::GlobalVarTable const &global_vars;
 
   std::string funcname, exit_label;
-  std::unordered_map<int, amd64::Pseudo> rmap{};
+  ertl::Assignment const &assignment;
+  ertl::Frame const &frame;
   AsmProgram body{};
+  ertl::Label current;              // the instruction being compiled
+  std::vector<ertl::Label> unwinds; // targets of exits from the frame region
 
   amd64::Pseudo lookup(ertl::Pseudo r) {
-    if (rmap.find(r.id) == rmap.end()) {
-      amd64::Pseudo p{static_cast<int>(rmap.size() + 1)};
-      rmap.insert({r.id, p});
-    }
-    return rmap.at(r.id);
+    return amd64::Pseudo{ertl::to_string(assignment.at(r.id))};
+  }
+
+  std::shared_ptr<Asm> load_slot(int slot, Pseudo const &dest) {
+    if (frame.red_zone)
+      return Asm::movq_addr2reg(-8 * (slot + 1), Pseudo{reg::rsp}, dest);
+    return Asm::movq(Pseudo{StackSlot{slot + 1}}, dest);
+  }
+
+  std::shared_ptr<Asm> store_slot(Pseudo const &src, int slot) {
+    if (frame.red_zone)
+      return Asm::movq_reg2addr(src, -8 * (slot + 1), Pseudo{reg::rsp});
+    return Asm::movq(src, Pseudo{StackSlot{slot + 1}});
   }
 
   amd64::Label label_translate(ertl::Label const &rtl_lab) {
     return std::string{".L"} + funcname + '.' + std::to_string(rtl_lab.id);
   }
 
+  /**
+   * The label to jump to for succ, which goes through the frame teardown if
+   * the jump leaves the region of the frame
+   */
+  amd64::Label target(ertl::Label const &succ) {
+    auto exits = frame.exits.find(current);
+    if (exits == frame.exits.end() ||
+        std::find(exits->second.begin(), exits->second.end(), succ) ==
+            exits->second.end())
+      return label_translate(succ);
+    if (std::find(unwinds.begin(), unwinds.end(), succ) == unwinds.end())
+      unwinds.push_back(succ);
+    return label_translate(succ) + ".unwind";
+  }
+
   void append(std::shared_ptr<Asm> line) { body.push_back(std::move(line)); }
 
+  void build_frame(AsmProgram &out) {
+    if (!frame.red_zone) {
+      // %rbp is pushed, which realigns %rsp to 16 bytes for the calls
+      out.push_back(Asm::pushq(Pseudo{reg::rbp}));
+      out.push_back(Asm::movq(Pseudo{reg::rsp}, Pseudo{reg::rbp}));
+      if (frame.num_slots() > 0)
+        out.push_back(Asm::subq((frame.num_slots() + 1) / 2 * 16,
+                                Pseudo{reg::rsp}));
+    }
+    for (std::size_t i = 0; i < frame.saved.size(); i++)
+      out.push_back(store_slot(Pseudo{ertl::to_string(frame.saved[i])},
+                               frame.num_spills + static_cast<int>(i)));
+  }
+
+  void tear_frame_down(AsmProgram &out) {
+    for (auto i = frame.saved.size(); i-- > 0;)
+      out.push_back(load_slot(frame.num_spills + static_cast<int>(i),
+                              Pseudo{ertl::to_string(frame.saved[i])}));
+    if (!frame.red_zone) {
+      out.push_back(Asm::movq(Pseudo{reg::rbp}, Pseudo{reg::rsp}));
+      out.push_back(Asm::popq(Pseudo{reg::rbp}));
+    }
+  }
+
 public:
   void append_label(ertl::Label const &rtl_lab) {
     std::string label = label_translate(rtl_lab);
@@ -56,26 +116,43 @@ public:
         body.back()->jump_dests[0] == label)
       body.pop_back(); // get rid of a redundant jmp;
     append(Asm::set_label(label));
+    current = rtl_lab;
+    if (frame.wrapped && rtl_lab == frame.build)
+      build_frame(body);
   }
 
   InstrCompiler(source::Program::GlobalVarTable const &global_vars,
-                std::string funcname)
-      : global_vars{global_vars}, funcname{funcname} {
+                std::string funcname, ertl::Assignment const &assignment,
+                ertl::Frame const &frame)
+      : global_vars{global_vars}, funcname{funcname}, assignment{assignment},
+        frame{frame} {
     exit_label = ".L" + funcname + ".exit";
   }
 
+  /** The code of a tile, or nothing if a later tile computes it */
+  void append_tile(ertl::Tile const &tile) {
+    if (tile.absorbed)
+      return;
+    for (auto const &line : tile.code)
+      append(line);
+    if (tile.fail_jump)
+      append(tile.fail_jump(target(tile.fail)));
+    append(Asm::jmp(target(tile.succ)));
+  }
+
   AsmProgram finalize() {
     AsmProgram prog;
     prog.push_back(Asm::directive(".globl " + funcname));
     prog.push_back(Asm::directive(".section .text"));
     prog.push_back(Asm::set_label(funcname));
-    if (rmap.size() > 0) {
-      prog.push_back(Asm::pushq(Pseudo{reg::rbp}));
-      prog.push_back(Asm::movq(Pseudo{reg::rsp}, Pseudo{reg::rbp}));
-      prog.push_back(Asm::subq(rmap.size() * 8, Pseudo{reg::rsp}));
-    }
     for (auto i = body.begin(), e = body.end(); i != e; i++)
       prog.push_back(std::move(*i));
+    // the exits from the region of the frame
+    for (auto const &succ : unwinds) {
+      prog.push_back(Asm::set_label(label_translate(succ) + ".unwind"));
+      tear_frame_down(prog);
+      prog.push_back(Asm::jmp(label_translate(succ)));
+    }
     prog.push_back(Asm::set_label(exit_label));
     prog.push_back(Asm::ret());
     return prog;
@@ -83,15 +160,14 @@ public:
 
   void visit(rtl::Label const &, ertl::Newframe const &nf) override {
     // do nothing
-    append(Asm::jmp(label_translate(nf.succ)));
+    append(Asm::jmp(target(nf.succ)));
   }
 
-  void visit(rtl::Label const &, ertl::Delframe const &df) override {
-    if (rmap.size() > 0) {
-      append(Asm::movq(Pseudo{reg::rbp}, Pseudo{reg::rsp}));
-      append(Asm::popq(Pseudo{reg::rbp}));
-    }
-    append(Asm::jmp(label_translate(df.succ)));
+  void visit(rtl::Label const &lab, ertl::Delframe const &df) override {
+    if (std::find(frame.teardowns.begin(), frame.teardowns.end(), lab) !=
+        frame.teardowns.end())
+      tear_frame_down(body);
+    append(Asm::jmp(target(df.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Move const &mv) override {
@@ -100,13 +176,19 @@ public:
       append(Asm::movabsq(src, lookup(mv.dest)));
     else
       append(Asm::movq(src, lookup(mv.dest)));
-    append(Asm::jmp(label_translate(mv.succ)));
+    append(Asm::jmp(target(mv.succ)));
+  }
+
+  /** A register to register copy, which coalescing often makes useless */
+  void copy(Pseudo const &src, Pseudo const &dest) {
+    if (std::string{std::get<Reg>(*src.binding)} !=
+        std::get<Reg>(*dest.binding))
+      append(Asm::movq(src, dest));
   }
 
   void visit(rtl::Label const &, ertl::Copy const &cp) override {
-    append(Asm::movq(lookup(cp.src), Pseudo{reg::rax}));
-    append(Asm::movq(Pseudo{reg::rax}, lookup(cp.dest)));
-    append(Asm::jmp(label_translate(cp.succ)));
+    copy(lookup(cp.src), lookup(cp.dest));
+    append(Asm::jmp(target(cp.succ)));
   }
 
   void visit(rtl::Label const &, ertl::SetMach const &sm) override {
@@ -114,96 +196,105 @@ public:
     if (sm.src == rtl::discard_pr)
       append(Asm::xorq(dest, dest));
     else
-      append(Asm::movq(lookup(sm.src), dest));
-    append(Asm::jmp(label_translate(sm.succ)));
+      copy(lookup(sm.src), dest);
+    append(Asm::jmp(target(sm.succ)));
   }
 
   void visit(rtl::Label const &, ertl::GetMach const &gm) override {
-    append(Asm::movq(Pseudo{ertl::to_string(gm.src)}, lookup(gm.dest)));
-    append(Asm::jmp(label_translate(gm.succ)));
+    copy(Pseudo{ertl::to_string(gm.src)}, lookup(gm.dest));
+    append(Asm::jmp(target(gm.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Load const &ld) override {
-    append(Asm::movq_mem2reg(ld.src, Pseudo{reg::r11}));
-    append(Asm::movq(Pseudo{reg::r11}, lookup(ld.dest)));
-    append(Asm::jmp(label_translate(ld.succ)));
+    append(Asm::movq_mem2reg(ld.src, lookup(ld.dest)));
+    append(Asm::jmp(target(ld.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Store const &st) override {
-    append(Asm::movq(lookup(st.src), Pseudo{reg::r11}));
-    append(Asm::movq_reg2mem(Pseudo{reg::r11}, st.dest));
-    append(Asm::jmp(label_translate(st.succ)));
+    append(Asm::movq_reg2mem(lookup(st.src), st.dest));
+    append(Asm::jmp(target(st.succ)));
   }
 
   void visit(rtl::Label const &, ertl::LoadParam const &lp) override {
-    append(Asm::movq_addr2reg(16 + lp.slot * 8, Pseudo{reg::rbp},
-                              Pseudo{reg::r11}));
-    append(Asm::movq(Pseudo{reg::r11}, lookup(lp.dest)));
-    append(Asm::jmp(label_translate(lp.succ)));
+    // above the return address, and the saved %rbp if there is a frame
+    if (frame.red_zone)
+      append(Asm::movq_addr2reg(8 + lp.slot * 8, Pseudo{reg::rsp},
+                                lookup(lp.dest)));
+    else
+      append(Asm::movq_addr2reg(16 + lp.slot * 8, Pseudo{reg::rbp},
+                                lookup(lp.dest)));
+    append(Asm::jmp(target(lp.succ)));
+  }
+
+  void visit(rtl::Label const &, ertl::LoadSlot const &ls) override {
+    append(load_slot(ls.slot, lookup(ls.dest)));
+    append(Asm::jmp(target(ls.succ)));
+  }
+
+  void visit(rtl::Label const &, ertl::StoreSlot const &ss) override {
+    append(store_slot(lookup(ss.src), ss.slot));
+    append(Asm::jmp(target(ss.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Push const &p) override {
     append(Asm::pushq(lookup(p.arg)));
-    append(Asm::jmp(label_translate(p.succ)));
+    append(Asm::jmp(target(p.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Pop const &p) override {
     if (p.arg == rtl::discard_pr)
       append(Asm::addq(8UL, Pseudo{reg::rsp}));
     else
-      append(Asm::pushq(lookup(p.arg)));
-    append(Asm::jmp(label_translate(p.succ)));
+      append(Asm::popq(lookup(p.arg)));
+    append(Asm::jmp(target(p.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Binop const &bo) override {
+    // The allocator keeps src out of %rax and %rdx for divisions, and dest out
+    // of %rcx for shifts
     auto src = lookup(bo.src);
     auto dest = lookup(bo.dest);
-    append(Asm::movq(dest, Pseudo{reg::rax}));
     switch (bo.opcode) {
     case rtl::Binop::ADD:
-      append(Asm::addq(src, Pseudo{reg::rax}));
-      append(Asm::movq(Pseudo{reg::rax}, dest));
+      append(Asm::addq(src, dest));
       break;
     case rtl::Binop::SUB:
-      append(Asm::subq(src, Pseudo{reg::rax}));
-      append(Asm::movq(Pseudo{reg::rax}, dest));
+      append(Asm::subq(src, dest));
       break;
     case rtl::Binop::AND:
-      append(Asm::andq(src, Pseudo{reg::rax}));
-      append(Asm::movq(Pseudo{reg::rax}, dest));
+      append(Asm::andq(src, dest));
       break;
     case rtl::Binop::OR:
-      append(Asm::orq(src, Pseudo{reg::rax}));
-      append(Asm::movq(Pseudo{reg::rax}, dest));
+      append(Asm::orq(src, dest));
       break;
     case rtl::Binop::XOR:
-      append(Asm::xorq(src, Pseudo{reg::rax}));
-      append(Asm::movq(Pseudo{reg::rax}, dest));
+      append(Asm::xorq(src, dest));
       break;
     case rtl::Binop::MUL:
-      append(Asm::imulq(src));
-      append(Asm::movq(Pseudo{reg::rax}, dest));
+      append(Asm::imulq(src, dest));
       break;
     case rtl::Binop::DIV:
+      copy(dest, Pseudo{reg::rax});
       append(Asm::cqo());
       append(Asm::idivq(src));
-      append(Asm::movq(Pseudo{reg::rax}, dest));
+      copy(Pseudo{reg::rax}, dest);
       break;
     case rtl::Binop::REM:
+      copy(dest, Pseudo{reg::rax});
       append(Asm::cqo());
       append(Asm::idivq(src));
-      append(Asm::movq(Pseudo{reg::rdx}, dest));
+      copy(Pseudo{reg::rdx}, dest);
       break;
     case rtl::Binop::SAL:
-      append(Asm::movq(src, Pseudo{reg::rcx}));
+      copy(src, Pseudo{reg::rcx});
       append(Asm::salq(dest));
       break;
     case rtl::Binop::SAR:
-      append(Asm::movq(src, Pseudo{reg::rcx}));
+      copy(src, Pseudo{reg::rcx});
       append(Asm::sarq(dest));
       break;
     }
-    append(Asm::jmp(label_translate(bo.succ)));
+    append(Asm::jmp(target(bo.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Unop const &uo) override {
@@ -216,7 +307,7 @@ public:
       append(Asm::notq(arg));
       break;
     }
-    append(Asm::jmp(label_translate(uo.succ)));
+    append(Asm::jmp(target(uo.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Ubranch const &ub) override {
@@ -224,51 +315,47 @@ public:
     append(Asm::cmpq(0u, arg));
     switch (ub.opcode) {
     case rtl::Ubranch::JZ:
-      append(Asm::je(label_translate(ub.succ)));
+      append(Asm::je(target(ub.succ)));
       break;
     case rtl::Ubranch::JNZ:
-      append(Asm::jne(label_translate(ub.succ)));
+      append(Asm::jne(target(ub.succ)));
       break;
     }
-    append(Asm::jmp(label_translate(ub.fail)));
+    append(Asm::jmp(target(ub.fail)));
   }
 
   void visit(rtl::Label const &, ertl::Bbranch const &bb) override {
-    Pseudo arg1 = lookup(bb.arg1);
-    Pseudo arg2 = lookup(bb.arg2);
-    append(Asm::movq(arg1, Pseudo{reg::rcx}));
-    append(Asm::movq(arg2, Pseudo{reg::rax}));
-    append(Asm::cmpq(Pseudo{reg::rax}, Pseudo{reg::rcx}));
+    append(Asm::cmpq(lookup(bb.arg2), lookup(bb.arg1)));
     switch (bb.opcode) {
     case rtl::Bbranch::JE:
-      append(Asm::jne(label_translate(bb.fail)));
+      append(Asm::jne(target(bb.fail)));
       break;
     case rtl::Bbranch::JNE:
-      append(Asm::je(label_translate(bb.fail)));
+      append(Asm::je(target(bb.fail)));
       break;
     case rtl::Bbranch::JL:
     case rtl::Bbranch::JNGE:
-      append(Asm::jge(label_translate(bb.fail)));
+      append(Asm::jge(target(bb.fail)));
       break;
     case rtl::Bbranch::JLE:
     case rtl::Bbranch::JNG:
-      append(Asm::jg(label_translate(bb.fail)));
+      append(Asm::jg(target(bb.fail)));
       break;
     case rtl::Bbranch::JG:
     case rtl::Bbranch::JNLE:
-      append(Asm::jle(label_translate(bb.fail)));
+      append(Asm::jle(target(bb.fail)));
       break;
     case rtl::Bbranch::JGE:
     case rtl::Bbranch::JNL:
-      append(Asm::jl(label_translate(bb.fail)));
+      append(Asm::jl(target(bb.fail)));
       break;
     }
-    append(Asm::jmp(label_translate(bb.succ)));
+    append(Asm::jmp(target(bb.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Call const &c) override {
     append(Asm::call(std::string{c.func}));
-    append(Asm::jmp(label_translate(c.succ)));
+    append(Asm::jmp(target(c.succ)));
   }
 
   void visit(rtl::Label const &, ertl::Return const &) override {
@@ -276,12 +363,11 @@ public:
   }
 
   void visit(rtl::Label const &, ertl::Goto const &go) override {
-    append(Asm::jmp(label_translate(go.succ)));
+    append(Asm::jmp(target(go.succ)));
   }
 };
 
-AsmProgram asm_generate(source::Program::GlobalVarTable const &global_vars,
-                        ertl::Program const &prog) {
+AsmProgram asm_globals(source::Program::GlobalVarTable const &global_vars) {
   AsmProgram asm_prog;
   for (auto const &v : global_vars) {
     asm_prog.push_back(Asm::directive(".globl " + v.first));
@@ -292,7 +378,7 @@ AsmProgram asm_generate(source::Program::GlobalVarTable const &global_vars,
     case source::Type::BOOL: {
       auto *bc =
           dynamic_cast<source::BoolConstant const *>(v.second->init.get());
-      asm_prog.push_back(Asm::directive(bc->value ? ".quad 0" : ".quad 1"));
+      asm_prog.push_back(Asm::directive(bc->value ? ".quad 1" : ".quad 0"));
     } break;
     case source::Type::INT64: {
       auto *ic =
@@ -303,15 +389,40 @@ AsmProgram asm_generate(source::Program::GlobalVarTable const &global_vars,
       throw std::runtime_error("Invalid global variable");
     }
   }
-  for (auto const &cbl : prog) {
-    InstrCompiler icomp{global_vars, cbl.name};
-    for (auto const &l : cbl.schedule) {
-      icomp.append_label(l);
+  return asm_prog;
+}
+
+AsmProgram asm_generate(source::Program::GlobalVarTable const &global_vars,
+                        ertl::Callable cbl, ertl::Allocator allocator) {
+  auto assignment = ertl::allocate_registers(cbl, allocator);
+  ertl::Liveness live{cbl};
+  auto frame = ertl::plan_frame(cbl, live, assignment);
+  auto tiles = ertl::select_tiles(cbl, live, assignment);
+  InstrCompiler icomp{global_vars, cbl.name, assignment, frame};
+  for (auto const &l : cbl.schedule) {
+    icomp.append_label(l);
+    auto tile = tiles.find(l);
+    if (tile != tiles.end())
+      icomp.append_tile(tile->second);
+    else
       cbl.body.at(l)->accept(l, icomp);
-    }
-    for (auto &i : icomp.finalize())
-      asm_prog.push_back(std::move(i));
   }
+  return icomp.finalize();
+}
+
+AsmProgram asm_end() {
+  // no executable stack
+  return {Asm::directive(".section .note.GNU-stack,\"\",@progbits")};
+}
+
+AsmProgram asm_generate(source::Program::GlobalVarTable const &global_vars,
+                        ertl::Program const &prog, ertl::Allocator allocator) {
+  auto asm_prog = asm_globals(global_vars);
+  for (auto const &cbl : prog)
+    for (auto &i : asm_generate(global_vars, cbl, allocator))
+      asm_prog.push_back(std::move(i));
+  for (auto &i : asm_end())
+    asm_prog.push_back(std::move(i));
   return asm_prog;
 }
 
@@ -2,12 +2,25 @@
 
 #include "amd64.h"
 #include "ertl.h"
+#include "ertl_alloc.h"
 
 namespace bx {
 
 using AsmProgram = std::vector<std::shared_ptr<amd64::Asm>>;
 
+/** The data section with the global variables */
+AsmProgram asm_globals(source::Program::GlobalVarTable const &);
+
+/** The code of one callable, from register allocation on */
+AsmProgram asm_generate(source::Program::GlobalVarTable const &,
+                        ertl::Callable cbl,
+                        ertl::Allocator allocator = ertl::Allocator::COLOR);
+
+/** What goes after the last callable */
+AsmProgram asm_end();
+
 AsmProgram asm_generate(source::Program::GlobalVarTable const &,
-                        ertl::Program const &);
+                        ertl::Program const &,
+                        ertl::Allocator allocator = ertl::Allocator::COLOR);
 
 } // namespace bx
\ No newline at end of file
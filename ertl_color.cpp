@@ -0,0 +1,467 @@
+/**
+ * Graph coloring register allocation with iterated coalescing
+ *
+ * This follows George and Appel: the interference graph is built from the
+ * liveness information, with the copies recorded on the side. The nodes of
+ * low degree that no copy involves are removed one by one (simplify); the
+ * copies are coalesced when the Briggs test (or the George test, against a
+ * machine register) shows that the merged node is as easy to color; copies
+ * that block simplification are given up (freeze); and when nothing else
+ * applies a node of high degree is picked as a potential spill. The removed
+ * nodes are then given colors in the opposite order. Nodes that find no color
+ * are spilled, and everything starts over on the rewritten callable.
+ *
+ * The machine registers are precolored nodes. They make the calling
+ * convention and the special registers of division and shifts show up as
+ * interferences, so nothing else needs to know about them.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <limits>
+#include <unordered_set>
+
+#include "ertl_alloc.h"
+
+namespace bx {
+namespace ertl {
+
+namespace {
+
+constexpr int K = num_allocatable;
+
+/** A set of locations with constant time insertion, removal and clearing */
+class LiveSet {
+private:
+  std::vector<int> dense, pos;
+
+public:
+  explicit LiveSet(int n) : pos(n, -1) {}
+  void insert(int l) {
+    if (pos[l] != -1)
+      return;
+    pos[l] = static_cast<int>(dense.size());
+    dense.push_back(l);
+  }
+  void erase(int l) {
+    if (pos[l] == -1)
+      return;
+    dense[pos[l]] = dense.back();
+    pos[dense.back()] = pos[l];
+    dense.pop_back();
+    pos[l] = -1;
+  }
+  void clear() {
+    for (int l : dense)
+      pos[l] = -1;
+    dense.clear();
+  }
+  std::vector<int> const &members() const { return dense; }
+};
+
+class Colorer {
+private:
+  enum class State : uint8_t {
+    PRECOLORED, SIMPLIFY, FREEZE, SPILL, SPILLED, COALESCED, COLORED, SELECT
+  };
+  enum class MoveState : uint8_t { WORKLIST, ACTIVE, COALESCED, CONSTRAINED, FROZEN };
+
+  Liveness const &live;
+  std::unordered_set<int> const &temps;
+  int n;
+
+  std::vector<std::vector<int>> adj_list;
+  std::vector<int> degree, alias, color, uses;
+  std::vector<int> mark; // visited nodes are marked with the current stamp
+  int stamp = 0;
+  std::vector<State> state;
+  std::vector<std::vector<int>> move_list;
+  std::vector<std::pair<int, int>> moves; // (dest, src)
+  std::vector<MoveState> move_state;
+
+  // Worklists with lazy deletion: an entry is only valid if the node (or
+  // move) is still in the matching state
+  std::vector<int> simplify_wl, freeze_wl, spill_wl, move_wl, select_stack;
+
+  static constexpr int infinite_degree = std::numeric_limits<int>::max() / 2;
+
+  // The interference relation: a bit matrix while it stays small, a hash set
+  // of pairs beyond that
+  static constexpr uint64_t max_matrix_bits = uint64_t{1} << 28;
+  std::vector<uint64_t> adj_matrix;
+  std::unordered_set<uint64_t> adj_set;
+
+  uint64_t key(int u, int v) const {
+    return static_cast<uint64_t>(u) * static_cast<uint64_t>(n) + v;
+  }
+  bool adjacent(int u, int v) const {
+    auto k = key(u, v);
+    if (!adj_matrix.empty())
+      return (adj_matrix[k / 64] >> (k % 64)) & 1;
+    return adj_set.count(k) > 0;
+  }
+  void set_adjacent(int u, int v) {
+    auto k = key(u, v);
+    if (!adj_matrix.empty())
+      adj_matrix[k / 64] |= uint64_t{1} << (k % 64);
+    else
+      adj_set.insert(k);
+  }
+  bool precolored(int u) const { return u < Liveness::num_mach; }
+
+  void add_edge(int u, int v) {
+    if (u == v || adjacent(u, v))
+      return;
+    set_adjacent(u, v);
+    set_adjacent(v, u);
+    if (!precolored(u)) {
+      adj_list[u].push_back(v);
+      degree[u]++;
+    }
+    if (!precolored(v)) {
+      adj_list[v].push_back(u);
+      degree[v]++;
+    }
+  }
+
+  void build() {
+    LiveSet in{n};
+    for (std::size_t b = 0; b < live.blocks.size(); b++) {
+      in.clear();
+      for (int l : live.live_out[b])
+        in.insert(l);
+      auto const &labels = live.blocks[b];
+      for (auto it = labels.rbegin(); it != labels.rend(); it++) {
+        auto const &acc = live.access.at(*it);
+        if (acc.move) {
+          for (int u : acc.uses)
+            in.erase(u);
+          int m = static_cast<int>(moves.size());
+          moves.push_back({acc.defs[0], acc.uses[0]});
+          move_state.push_back(MoveState::WORKLIST);
+          move_list[acc.defs[0]].push_back(m);
+          move_list[acc.uses[0]].push_back(m);
+          move_wl.push_back(m);
+        }
+        for (int d : acc.defs)
+          in.insert(d);
+        for (int d : acc.defs)
+          for (int l : in.members())
+            add_edge(l, d);
+        for (auto const &c : acc.conflicts)
+          add_edge(c.first, c.second);
+        for (int d : acc.defs) {
+          in.erase(d);
+          uses[d]++;
+        }
+        for (int u : acc.uses) {
+          in.insert(u);
+          uses[u]++;
+        }
+      }
+    }
+  }
+
+  std::vector<int> adjacent_nodes(int u) const {
+    std::vector<int> result;
+    for (int v : adj_list[u])
+      if (state[v] != State::SELECT && state[v] != State::COALESCED)
+        result.push_back(v);
+    return result;
+  }
+
+  bool move_related(int u) const {
+    for (int m : move_list[u])
+      if (move_state[m] == MoveState::ACTIVE ||
+          move_state[m] == MoveState::WORKLIST)
+        return true;
+    return false;
+  }
+
+  void push(State s, int u) {
+    state[u] = s;
+    switch (s) {
+    case State::SIMPLIFY:
+      simplify_wl.push_back(u);
+      break;
+    case State::FREEZE:
+      freeze_wl.push_back(u);
+      break;
+    case State::SPILL:
+      spill_wl.push_back(u);
+      break;
+    default:
+      break;
+    }
+  }
+
+  /** Pops the next valid entry of a worklist, or -1 */
+  int pop(std::vector<int> &wl, State s) {
+    while (!wl.empty()) {
+      int u = wl.back();
+      wl.pop_back();
+      if (state[u] == s)
+        return u;
+    }
+    return -1;
+  }
+
+  void make_worklists() {
+    for (int u = Liveness::num_mach; u < n; u++) {
+      if (degree[u] >= K)
+        push(State::SPILL, u);
+      else if (move_related(u))
+        push(State::FREEZE, u);
+      else
+        push(State::SIMPLIFY, u);
+    }
+  }
+
+  void enable_moves(int u) {
+    for (int m : move_list[u])
+      if (move_state[m] == MoveState::ACTIVE) {
+        move_state[m] = MoveState::WORKLIST;
+        move_wl.push_back(m);
+      }
+  }
+
+  void decrement_degree(int u) {
+    if (precolored(u))
+      return;
+    int d = degree[u]--;
+    if (d != K)
+      return;
+    enable_moves(u);
+    for (int v : adjacent_nodes(u))
+      enable_moves(v);
+    if (state[u] == State::SPILL)
+      push(move_related(u) ? State::FREEZE : State::SIMPLIFY, u);
+  }
+
+  void simplify(int u) {
+    state[u] = State::SELECT;
+    select_stack.push_back(u);
+    for (int v : adjacent_nodes(u))
+      decrement_degree(v);
+  }
+
+  int alias_of(int u) const {
+    while (state[u] == State::COALESCED)
+      u = alias[u];
+    return u;
+  }
+
+  void add_worklist(int u) {
+    if (!precolored(u) && state[u] == State::FREEZE && !move_related(u) &&
+        degree[u] < K)
+      push(State::SIMPLIFY, u);
+  }
+
+  /** George: every neighbour of v is harmless to r */
+  bool george(int v, int r) const {
+    for (int t : adjacent_nodes(v))
+      if (!(degree[t] < K || precolored(t) || adjacent(t, r)))
+        return false;
+    return true;
+  }
+
+  /** Briggs: the merged node has fewer than K neighbours of high degree */
+  bool briggs(int u, int v) {
+    stamp++;
+    int k = 0;
+    for (int w : {u, v})
+      for (int t : adj_list[w]) {
+        if (state[t] == State::SELECT || state[t] == State::COALESCED ||
+            mark[t] == stamp)
+          continue;
+        mark[t] = stamp;
+        if (precolored(t) || degree[t] >= K)
+          k++;
+        if (k >= K)
+          return false;
+      }
+    return true;
+  }
+
+  void combine(int u, int v) {
+    state[v] = State::COALESCED;
+    alias[v] = u;
+    move_list[u].insert(move_list[u].end(), move_list[v].begin(),
+                        move_list[v].end());
+    enable_moves(v);
+    for (int t : adjacent_nodes(v)) {
+      add_edge(t, u);
+      decrement_degree(t);
+    }
+    if (degree[u] >= K && state[u] == State::FREEZE)
+      push(State::SPILL, u);
+  }
+
+  void coalesce(int m) {
+    int x = alias_of(moves[m].first), y = alias_of(moves[m].second);
+    // The node that stays is a machine register if there is one, else the one
+    // with more moves, so that merging the move lists stays cheap
+    int u = x, v = y;
+    if (precolored(y) ||
+        (!precolored(x) && move_list[y].size() > move_list[x].size())) {
+      u = y;
+      v = x;
+    }
+    if (u == v) {
+      move_state[m] = MoveState::COALESCED;
+      add_worklist(u);
+    } else if (precolored(v) || adjacent(u, v)) {
+      move_state[m] = MoveState::CONSTRAINED;
+      add_worklist(u);
+      add_worklist(v);
+    } else if (precolored(u) ? george(v, u) : briggs(u, v)) {
+      move_state[m] = MoveState::COALESCED;
+      combine(u, v);
+      add_worklist(u);
+    } else {
+      move_state[m] = MoveState::ACTIVE;
+    }
+  }
+
+  void freeze_moves(int u) {
+    for (int m : move_list[u]) {
+      if (move_state[m] != MoveState::ACTIVE &&
+          move_state[m] != MoveState::WORKLIST)
+        continue;
+      int x = moves[m].first, y = moves[m].second;
+      int v = alias_of(y) == alias_of(u) ? alias_of(x) : alias_of(y);
+      move_state[m] = MoveState::FROZEN;
+      if (state[v] == State::FREEZE && !move_related(v))
+        push(State::SIMPLIFY, v);
+    }
+  }
+
+  /** The cheapest node to spill: few uses, many neighbours, not a spill temp */
+  void select_spill() {
+    int best = -1;
+    double best_cost = 0;
+    for (int u : spill_wl) {
+      if (state[u] != State::SPILL)
+        continue;
+      double cost = static_cast<double>(uses[u]) / (degree[u] + 1);
+      if (temps.count(live.pseudos[u - Liveness::num_mach].id) > 0)
+        cost += 1e9;
+      if (best == -1 || cost < best_cost) {
+        best = u;
+        best_cost = cost;
+      }
+    }
+    push(State::SIMPLIFY, best);
+    freeze_moves(best);
+  }
+
+  bool select_pending() const {
+    for (int u : spill_wl)
+      if (state[u] == State::SPILL)
+        return true;
+    return false;
+  }
+
+  void assign_colors(std::vector<Pseudo> &spilled) {
+    while (!select_stack.empty()) {
+      int u = select_stack.back();
+      select_stack.pop_back();
+      bool taken[Liveness::num_mach] = {};
+      for (int w : adj_list[u]) {
+        int a = alias_of(w);
+        if (state[a] == State::COLORED || precolored(a))
+          taken[color[a]] = true;
+      }
+      state[u] = State::SPILLED;
+      for (auto m : allocatable)
+        if (!taken[static_cast<int>(m)]) {
+          state[u] = State::COLORED;
+          color[u] = static_cast<int>(m);
+          break;
+        }
+      if (state[u] == State::SPILLED)
+        spilled.push_back(live.pseudos[u - Liveness::num_mach]);
+    }
+    for (int u = Liveness::num_mach; u < n; u++)
+      if (state[u] == State::COALESCED)
+        color[u] = color[alias_of(u)];
+  }
+
+public:
+  Colorer(Liveness const &live, std::unordered_set<int> const &temps)
+      : live{live}, temps{temps}, n{live.size()}, adj_list(n), degree(n, 0),
+        alias(n, -1), color(n, -1), uses(n, 0), mark(n, 0), state(n, State::SIMPLIFY),
+        move_list(n) {
+    auto bits = static_cast<uint64_t>(n) * static_cast<uint64_t>(n);
+    if (bits <= max_matrix_bits)
+      adj_matrix.resize((bits + 63) / 64);
+    for (int m = 0; m < Liveness::num_mach; m++) {
+      state[m] = State::PRECOLORED;
+      color[m] = m;
+      degree[m] = infinite_degree;
+    }
+  }
+
+  /** Colors the graph; returns the pseudos that have to be spilled */
+  std::vector<Pseudo> run() {
+    build();
+    make_worklists();
+    while (true) {
+      int u;
+      if ((u = pop(simplify_wl, State::SIMPLIFY)) != -1) {
+        simplify(u);
+        continue;
+      }
+      bool coalesced = false;
+      while (!move_wl.empty()) {
+        int m = move_wl.back();
+        move_wl.pop_back();
+        if (move_state[m] == MoveState::WORKLIST) {
+          coalesce(m);
+          coalesced = true;
+          break;
+        }
+      }
+      if (coalesced)
+        continue;
+      if ((u = pop(freeze_wl, State::FREEZE)) != -1) {
+        push(State::SIMPLIFY, u);
+        freeze_moves(u);
+        continue;
+      }
+      if (select_pending()) {
+        select_spill();
+        continue;
+      }
+      break;
+    }
+    std::vector<Pseudo> spilled;
+    assign_colors(spilled);
+    return spilled;
+  }
+
+  Assignment assignment() const {
+    Assignment result;
+    for (int u = Liveness::num_mach; u < n; u++)
+      result.insert({live.pseudos[u - Liveness::num_mach].id,
+                     static_cast<Mach>(color[u])});
+    return result;
+  }
+};
+
+} // namespace
+
+Assignment color_registers(Callable &cbl) {
+  std::unordered_set<int> temps;
+  while (true) {
+    Liveness live{cbl};
+    Colorer colorer{live, temps};
+    auto spilled = colorer.run();
+    if (spilled.empty())
+      return colorer.assignment();
+    spill(cbl, spilled, temps);
+  }
+}
+
+} // namespace ertl
+} // namespace bx
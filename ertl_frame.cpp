@@ -0,0 +1,267 @@
+/**
+ * This file lays out the frame of an allocated callable
+ *
+ * The blocks are the ones of the liveness analysis. Immediate dominators are
+ * computed with the iterative algorithm of Cooper, Harvey and Kennedy over
+ * the blocks reachable from the entry, and the blocks that lie on a cycle
+ * are the strongly connected components of more than one block or with a
+ * self loop (Tarjan).
+ *
+ * Functions
+ *
+ *     bx::ertl::plan_frame(cbl, live, assignment)
+ *         Which registers to save, and where the frame is built and torn down
+ */
+
+#include <algorithm>
+#include <stdexcept>
+
+#include "ertl_frame.h"
+
+namespace bx {
+namespace ertl {
+
+namespace {
+
+/** The red zone holds 16 slots */
+constexpr int red_zone_slots = 16;
+
+bool is_callee_save(Mach m) {
+  return std::find(std::begin(callee_saves), std::end(callee_saves), m) !=
+         std::end(callee_saves);
+}
+
+/** Block graph of the liveness analysis, seen from the entry */
+class BlockGraph {
+  Liveness const &live;
+  int n;
+
+public:
+  std::vector<std::vector<int>> preds;
+  std::vector<int> order; // reverse postorder of the reachable blocks
+  std::vector<int> rpo;   // inverse of order, -1 if unreachable
+  std::vector<int> idom;
+  std::vector<int> pre, post; // dominator tree DFS numbering
+  std::vector<bool> cyclic;
+
+  BlockGraph(Liveness const &live, int entry)
+      : live{live}, n{static_cast<int>(live.blocks.size())}, preds(n),
+        rpo(n, -1), idom(n, -1), pre(n, -1), post(n, -1), cyclic(n, false) {
+    for (int b = 0; b < n; b++)
+      for (int s : live.succs[b])
+        preds[s].push_back(b);
+    number(entry);
+    dominators();
+    find_cycles();
+  }
+
+  bool reachable(int b) const { return rpo[b] != -1; }
+
+  bool dominates(int a, int b) const {
+    return pre[a] <= pre[b] && post[b] <= post[a];
+  }
+
+  /** The nearest common dominator of two reachable blocks */
+  int intersect(int a, int b) const {
+    while (a != b) {
+      while (rpo[a] > rpo[b])
+        a = idom[a];
+      while (rpo[b] > rpo[a])
+        b = idom[b];
+    }
+    return a;
+  }
+
+private:
+  void number(int entry) {
+    std::vector<int> postorder;
+    std::vector<std::size_t> next(n, 0);
+    std::vector<int> stack{entry};
+    rpo[entry] = 0;
+    while (!stack.empty()) {
+      int b = stack.back();
+      if (next[b] < live.succs[b].size()) {
+        int s = live.succs[b][next[b]++];
+        if (rpo[s] == -1) {
+          rpo[s] = 0;
+          stack.push_back(s);
+        }
+        continue;
+      }
+      postorder.push_back(b);
+      stack.pop_back();
+    }
+    order.assign(postorder.rbegin(), postorder.rend());
+    for (std::size_t i = 0; i < order.size(); i++)
+      rpo[order[i]] = static_cast<int>(i);
+  }
+
+  void dominators() {
+    int entry = order[0];
+    idom[entry] = entry;
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (std::size_t i = 1; i < order.size(); i++) {
+        int b = order[i], d = -1;
+        for (int p : preds[b])
+          if (reachable(p) && idom[p] != -1)
+            d = d == -1 ? p : intersect(p, d);
+        if (d != idom[b]) {
+          idom[b] = d;
+          changed = true;
+        }
+      }
+    }
+    // number the dominator tree
+    std::vector<std::vector<int>> children(n);
+    for (std::size_t i = 1; i < order.size(); i++)
+      children[idom[order[i]]].push_back(order[i]);
+    int clock = 0;
+    std::vector<std::pair<int, std::size_t>> stack{{entry, 0}};
+    pre[entry] = clock++;
+    while (!stack.empty()) {
+      auto &[b, k] = stack.back();
+      if (k < children[b].size()) {
+        int c = children[b][k++];
+        pre[c] = clock++;
+        stack.push_back({c, 0});
+        continue;
+      }
+      post[b] = clock++;
+      stack.pop_back();
+    }
+  }
+
+  void find_cycles() {
+    std::vector<int> index(n, -1), low(n, 0), scc;
+    std::vector<bool> on_scc(n, false);
+    std::vector<std::pair<int, std::size_t>> stack;
+    int clock = 0;
+    for (int root : order) {
+      if (index[root] != -1)
+        continue;
+      stack.push_back({root, 0});
+      index[root] = low[root] = clock++;
+      scc.push_back(root);
+      on_scc[root] = true;
+      while (!stack.empty()) {
+        auto &[b, k] = stack.back();
+        if (k < live.succs[b].size()) {
+          int s = live.succs[b][k++];
+          if (s == b)
+            cyclic[b] = true;
+          if (index[s] == -1) {
+            index[s] = low[s] = clock++;
+            scc.push_back(s);
+            on_scc[s] = true;
+            stack.push_back({s, 0});
+          } else if (on_scc[s]) {
+            low[b] = std::min(low[b], index[s]);
+          }
+          continue;
+        }
+        int done = b;
+        stack.pop_back();
+        if (!stack.empty())
+          low[stack.back().first] =
+              std::min(low[stack.back().first], low[done]);
+        if (low[done] == index[done]) {
+          bool single = scc.back() == done;
+          while (true) {
+            int c = scc.back();
+            scc.pop_back();
+            on_scc[c] = false;
+            if (!single)
+              cyclic[c] = true;
+            if (c == done)
+              break;
+          }
+        }
+      }
+    }
+  }
+};
+
+} // namespace
+
+Frame plan_frame(Callable const &cbl, Liveness const &live,
+                 Assignment const &assignment) {
+  Frame frame;
+  frame.num_spills = cbl.num_slots;
+
+  std::vector<bool> saved(Liveness::num_mach, false);
+  for (auto const &pa : assignment)
+    saved[static_cast<int>(pa.second)] = is_callee_save(pa.second);
+  for (auto m : callee_saves)
+    if (saved[static_cast<int>(m)])
+      frame.saved.push_back(m);
+
+  bool leaf = true;
+  for (auto const &lab : cbl.schedule) {
+    auto const *instr = cbl.body.at(lab).get();
+    if (dynamic_cast<Call const *>(instr) || dynamic_cast<Push const *>(instr) ||
+        dynamic_cast<Pop const *>(instr))
+      leaf = false;
+  }
+  frame.red_zone = leaf && frame.num_slots() <= red_zone_slots;
+
+  // The blocks that need the frame
+  auto touches = [&](Label const &lab) {
+    auto const *instr = cbl.body.at(lab).get();
+    if (!frame.red_zone &&
+        (dynamic_cast<Call const *>(instr) ||
+         dynamic_cast<Push const *>(instr) || dynamic_cast<Pop const *>(instr) ||
+         dynamic_cast<LoadSlot const *>(instr) ||
+         dynamic_cast<StoreSlot const *>(instr) ||
+         dynamic_cast<LoadParam const *>(instr)))
+      return true;
+    auto const &acc = live.access.at(lab);
+    for (auto const *locs : {&acc.uses, &acc.defs})
+      for (int l : *locs) {
+        auto m = l < Liveness::num_mach
+                     ? static_cast<Mach>(l)
+                     : assignment.at(live.pseudos[l - Liveness::num_mach].id);
+        if (saved[static_cast<int>(m)])
+          return true;
+      }
+    return false;
+  };
+
+  int num_blocks = static_cast<int>(live.blocks.size()), entry = -1;
+  for (int b = 0; b < num_blocks; b++)
+    if (live.blocks[b].front() == cbl.enter)
+      entry = b;
+  if (entry == -1)
+    throw std::runtime_error("No entry block in " + cbl.name);
+  BlockGraph graph{live, entry};
+
+  int build = -1;
+  for (int b = 0; b < num_blocks; b++)
+    if (graph.reachable(b) &&
+        std::any_of(live.blocks[b].begin(), live.blocks[b].end(), touches))
+      build = build == -1 ? b : graph.intersect(build, b);
+  if (build == -1)
+    return frame;
+  // building the frame on every iteration of a loop would cost more than
+  // building it once before
+  while (graph.cyclic[build])
+    build = graph.idom[build];
+
+  frame.wrapped = true;
+  frame.build = live.blocks[build].front();
+  for (int b : graph.order) {
+    if (!graph.dominates(build, b))
+      continue;
+    for (auto const &lab : live.blocks[b])
+      if (dynamic_cast<Delframe const *>(cbl.body.at(lab).get()))
+        frame.teardowns.push_back(lab);
+    for (int s : live.succs[b])
+      if (!graph.dominates(build, s))
+        frame.exits[live.blocks[b].back()].push_back(live.blocks[s].front());
+  }
+  return frame;
+}
+
+} // namespace ertl
+} // namespace bx
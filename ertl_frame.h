@@ -0,0 +1,57 @@
+#pragma once
+
+/**
+ * Stack frames and callee-save registers
+ *
+ * Once the pseudos have their registers, the frame of a callable is laid out
+ * around what the allocation actually needs. Only the callee-save registers
+ * that some pseudo was given are saved, each in a stack slot after the spill
+ * slots.
+ *
+ * The frame is shrink-wrapped: it is built on entry to the nearest common
+ * dominator of the blocks that need it (for a call, a stack slot, a stack
+ * parameter or a callee-save register), moved out of any loop, and torn down
+ * on every edge that leaves the region it dominates. Paths that need none of
+ * it, like the base case of a recursion, run without a frame at all.
+ *
+ * A leaf callable never moves %rsp, so it needs no %rbp frame: its slots, if
+ * they fit, go in the 128 byte red zone below %rsp, and the frame code is
+ * only the saves and restores.
+ */
+
+#include <vector>
+
+#include "ertl.h"
+#include "ertl_alloc.h"
+
+namespace bx {
+namespace ertl {
+
+struct Frame {
+  /** callee-save registers to save, in saved[i] on slot num_spills + i */
+  std::vector<Mach> saved;
+  int num_spills = 0;
+  /** the slots are addressed from %rsp and there is no %rbp frame */
+  bool red_zone = false;
+  /** the frame is built on entry to the block of this label */
+  bool wrapped = false;
+  Label build;
+  /** the delframe instructions that find the frame built */
+  std::vector<Label> teardowns;
+  /**
+   * The jumps out of the region, by label of the jumping instruction: the
+   * targets whose edges tear the frame down
+   */
+  rtl::LabelMap<std::vector<Label>> exits;
+
+  int num_slots() const {
+    return num_spills + static_cast<int>(saved.size());
+  }
+};
+
+/** Lay out the frame of an allocated callable */
+Frame plan_frame(Callable const &cbl, Liveness const &live,
+                 Assignment const &assignment);
+
+} // namespace ertl
+} // namespace bx
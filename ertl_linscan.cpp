@@ -0,0 +1,223 @@
+/**
+ * Linear scan register allocation
+ *
+ * The labels are numbered block after block, in the order the blocks follow
+ * the schedule, with two points per instruction: the even one where it reads
+ * and the odd one where it writes.
+ * Every pseudo gets a single live interval from the first to the last point
+ * where it is live, which overestimates the holes in its lifetime but takes
+ * a single pass over the liveness information. The machine registers instead
+ * keep the exact set of points where they are busy, so that a pseudo can
+ * live in a register between two calls without clashing with the calling
+ * convention.
+ *
+ * The intervals are then visited by increasing start point (Poletto and
+ * Sarkar). Intervals that have ended give their register back; a new one
+ * takes a free register that is not busy anywhere in its interval, trying
+ * first the register of the other end of a copy. When none is free, the
+ * active interval that ends last is spilled (or the new one, if it ends
+ * later), and the callable is allocated again once the spill code is in.
+ */
+
+#include <algorithm>
+#include <cstdint>
+
+#include "ertl_alloc.h"
+
+namespace bx {
+namespace ertl {
+
+namespace {
+
+struct Interval {
+  int start = -1, end = -1;
+  int hint = -1; // location at the other end of a copy
+};
+
+class LinearScan {
+private:
+  Liveness const &live;
+  std::unordered_set<int> const &temps;
+  int n;
+  std::vector<Interval> intervals; // by location
+  std::vector<int> busy[Liveness::num_mach]; // sorted points
+  std::vector<int> reg; // by location, -1 if none yet
+
+  void extend(int l, int point) {
+    auto &i = intervals[l];
+    if (i.start == -1 || point < i.start)
+      i.start = point;
+    if (point > i.end)
+      i.end = point;
+  }
+
+  void mark(int l, int point) {
+    if (l < Liveness::num_mach)
+      busy[l].push_back(point);
+    else
+      extend(l, point);
+  }
+
+  void build() {
+    std::vector<int> block_start;
+    int pos = 0;
+    for (std::size_t b = 0; b < live.blocks.size(); b++) {
+      auto const &labels = live.blocks[b];
+      block_start.push_back(pos);
+      int first = pos;
+      pos += static_cast<int>(labels.size());
+      int last = pos - 1;
+      // Walk the block backwards to find where the registers are live; the
+      // pseudos only need the ends of the block
+      uint32_t mach_live = 0;
+      for (int l : live.live_out[b]) {
+        if (l < Liveness::num_mach)
+          mach_live |= 1u << l;
+        else
+          extend(l, 2 * last + 1);
+      }
+      for (int x = last; x >= first; x--) {
+        auto const &acc = live.access.at(labels[x - first]);
+        uint32_t after = mach_live;
+        for (int d : acc.defs) {
+          mark(d, 2 * x + 1);
+          if (d < Liveness::num_mach)
+            mach_live &= ~(1u << d);
+        }
+        for (int u : acc.uses) {
+          mark(u, 2 * x);
+          if (u < Liveness::num_mach)
+            mach_live |= 1u << u;
+        }
+        for (auto const &c : acc.conflicts)
+          for (int l : {c.first, c.second})
+            if (l < Liveness::num_mach)
+              busy[l].push_back(2 * x);
+        if (acc.move)
+          for (int l : {acc.defs[0], acc.uses[0]}) {
+            int other = l == acc.defs[0] ? acc.uses[0] : acc.defs[0];
+            if (l >= Liveness::num_mach)
+              intervals[l].hint = other;
+          }
+        for (int m = 0; m < Liveness::num_mach; m++) {
+          if (after & (1u << m))
+            busy[m].push_back(2 * x + 1);
+          if (mach_live & (1u << m))
+            busy[m].push_back(2 * x);
+        }
+      }
+    }
+    // What is live at the start of a block is live at the end of each of its
+    // predecessors; extending by all of that only lengthens the intervals
+    for (std::size_t b = 0; b < live.blocks.size(); b++)
+      for (int s : live.succs[b])
+        for (int l : live.live_out[b])
+          if (l >= Liveness::num_mach)
+            extend(l, 2 * block_start[s]);
+    for (auto &points : busy) {
+      std::sort(points.begin(), points.end());
+      points.erase(std::unique(points.begin(), points.end()), points.end());
+    }
+  }
+
+  bool free_over(int m, Interval const &i) const {
+    auto const &points = busy[m];
+    auto it = std::lower_bound(points.begin(), points.end(), i.start);
+    return it == points.end() || *it > i.end;
+  }
+
+public:
+  LinearScan(Liveness const &live, std::unordered_set<int> const &temps)
+      : live{live}, temps{temps}, n{live.size()}, intervals(n), reg(n, -1) {}
+
+  std::vector<Pseudo> run() {
+    build();
+    std::vector<int> order;
+    for (int l = Liveness::num_mach; l < n; l++)
+      if (intervals[l].start != -1)
+        order.push_back(l);
+    std::sort(order.begin(), order.end(), [&](int a, int b) {
+      return intervals[a].start < intervals[b].start;
+    });
+
+    std::vector<int> active; // locations holding a register
+    bool taken[Liveness::num_mach] = {};
+    std::vector<Pseudo> spilled;
+    auto spill_location = [&](int l) {
+      spilled.push_back(live.pseudos[l - Liveness::num_mach]);
+    };
+    for (int l : order) {
+      auto const &i = intervals[l];
+      active.erase(std::remove_if(active.begin(), active.end(),
+                                  [&](int a) {
+                                    if (intervals[a].end >= i.start)
+                                      return false;
+                                    taken[reg[a]] = false;
+                                    return true;
+                                  }),
+                   active.end());
+      int choice = -1;
+      if (i.hint != -1) {
+        int h = i.hint < Liveness::num_mach ? i.hint : reg[i.hint];
+        if (h != -1 && !taken[h] && free_over(h, i) &&
+            std::find(std::begin(allocatable), std::end(allocatable),
+                      static_cast<Mach>(h)) != std::end(allocatable))
+          choice = h;
+      }
+      for (int k = 0; choice == -1 && k < num_allocatable; k++) {
+        int m = static_cast<int>(allocatable[k]);
+        if (!taken[m] && free_over(m, i))
+          choice = m;
+      }
+      if (choice != -1) {
+        reg[l] = choice;
+        taken[choice] = true;
+        active.push_back(l);
+        continue;
+      }
+      // Spill whatever ends last among the intervals that could make room
+      int victim = -1;
+      for (int a : active)
+        if (free_over(reg[a], i) &&
+            temps.count(live.pseudos[a - Liveness::num_mach].id) == 0 &&
+            (victim == -1 || intervals[a].end > intervals[victim].end))
+          victim = a;
+      bool new_is_temp = temps.count(live.pseudos[l - Liveness::num_mach].id) > 0;
+      if (victim != -1 && (new_is_temp || intervals[victim].end > i.end)) {
+        reg[l] = reg[victim];
+        reg[victim] = -1;
+        active.erase(std::find(active.begin(), active.end(), victim));
+        active.push_back(l);
+        spill_location(victim);
+      } else {
+        spill_location(l);
+      }
+    }
+    return spilled;
+  }
+
+  Assignment assignment() const {
+    Assignment result;
+    for (int l = Liveness::num_mach; l < n; l++)
+      result.insert({live.pseudos[l - Liveness::num_mach].id,
+                     static_cast<Mach>(reg[l])});
+    return result;
+  }
+};
+
+} // namespace
+
+Assignment scan_registers(Callable &cbl) {
+  std::unordered_set<int> temps;
+  while (true) {
+    Liveness live{cbl};
+    LinearScan scan{live, temps};
+    auto spilled = scan.run();
+    if (spilled.empty())
+      return scan.assignment();
+    spill(cbl, spilled, temps);
+  }
+}
+
+} // namespace ertl
+} // namespace bx
@@ -0,0 +1,261 @@
+/**
+ * Liveness analysis over ERTL
+ *
+ * Every label holds a single instruction, so the labels are first grouped
+ * into basic blocks: a block starts at the enter label, at every label that
+ * is not the only successor of its only predecessor, and at every label that
+ * nothing else reaches. The usual backwards data flow equations are then
+ * solved over the blocks with bit sets, and only the live-out sets of the
+ * blocks are kept; the allocators recompute the sets within a block as they
+ * walk it.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+
+#include "ertl_alloc.h"
+
+namespace bx {
+namespace ertl {
+
+// Caller-save registers first, so that short-lived pseudos keep out of the
+// registers that have to be saved in the prologue
+const Mach allocatable[num_allocatable] = {
+    Mach::RAX, Mach::RCX, Mach::RDX, Mach::RSI, Mach::RDI,
+    Mach::R8,  Mach::R9,  Mach::R10, Mach::R11, Mach::RBX,
+    Mach::R12, Mach::R13, Mach::R14, Mach::R15};
+
+namespace {
+
+constexpr Mach caller_saves[9] = {Mach::RAX, Mach::RCX, Mach::RDX,
+                                  Mach::RSI, Mach::RDI, Mach::R8,
+                                  Mach::R9,  Mach::R10, Mach::R11};
+
+int loc(Mach m) { return static_cast<int>(m); }
+
+/** Computes the Access of an instruction and its successors */
+class AccessCollector : public InstrVisitor {
+private:
+  std::function<int(Pseudo const &)> locate;
+
+  void use(Pseudo const &ps) {
+    if (ps != rtl::discard_pr)
+      acc.uses.push_back(locate(ps));
+  }
+  void def(Pseudo const &ps) {
+    if (ps != rtl::discard_pr)
+      acc.defs.push_back(locate(ps));
+  }
+
+public:
+  Access acc;
+  std::vector<Label> succs;
+
+  explicit AccessCollector(std::function<int(Pseudo const &)> locate)
+      : locate{std::move(locate)} {}
+
+  void visit(Label const &, Move const &mv) override {
+    def(mv.dest);
+    succs = {mv.succ};
+  }
+  void visit(Label const &, Copy const &cp) override {
+    use(cp.src);
+    def(cp.dest);
+    acc.move = acc.uses.size() == 1 && acc.defs.size() == 1;
+    succs = {cp.succ};
+  }
+  void visit(Label const &, GetMach const &gm) override {
+    acc.uses.push_back(loc(gm.src));
+    def(gm.dest);
+    acc.move = acc.defs.size() == 1;
+    succs = {gm.succ};
+  }
+  void visit(Label const &, SetMach const &sm) override {
+    use(sm.src);
+    acc.defs.push_back(loc(sm.dest));
+    acc.move = acc.uses.size() == 1;
+    succs = {sm.succ};
+  }
+  void visit(Label const &, Load const &ld) override {
+    def(ld.dest);
+    succs = {ld.succ};
+  }
+  void visit(Label const &, LoadParam const &lp) override {
+    def(lp.dest);
+    succs = {lp.succ};
+  }
+  void visit(Label const &, LoadSlot const &ls) override {
+    def(ls.dest);
+    succs = {ls.succ};
+  }
+  void visit(Label const &, StoreSlot const &ss) override {
+    use(ss.src);
+    succs = {ss.succ};
+  }
+  void visit(Label const &, Store const &st) override {
+    use(st.src);
+    succs = {st.succ};
+  }
+  void visit(Label const &, Binop const &bo) override {
+    use(bo.src);
+    use(bo.dest);
+    def(bo.dest);
+    switch (bo.opcode) {
+    case rtl::Binop::DIV:
+    case rtl::Binop::REM:
+      // the dividend goes through %rax and %rdx, which the divisor must
+      // survive
+      acc.defs.push_back(loc(Mach::RAX));
+      acc.defs.push_back(loc(Mach::RDX));
+      acc.conflicts.push_back({locate(bo.src), loc(Mach::RAX)});
+      acc.conflicts.push_back({locate(bo.src), loc(Mach::RDX)});
+      break;
+    case rtl::Binop::SAL:
+    case rtl::Binop::SAR:
+      // the shift count goes through %cl
+      acc.defs.push_back(loc(Mach::RCX));
+      break;
+    default:
+      break;
+    }
+    succs = {bo.succ};
+  }
+  void visit(Label const &, Unop const &uo) override {
+    use(uo.arg);
+    def(uo.arg);
+    succs = {uo.succ};
+  }
+  void visit(Label const &, Bbranch const &bb) override {
+    use(bb.arg1);
+    use(bb.arg2);
+    succs = {bb.succ, bb.fail};
+  }
+  void visit(Label const &, Ubranch const &ub) override {
+    use(ub.arg);
+    succs = {ub.succ, ub.fail};
+  }
+  void visit(Label const &, Goto const &go) override { succs = {go.succ}; }
+  void visit(Label const &, Push const &pu) override {
+    use(pu.arg);
+    succs = {pu.succ};
+  }
+  void visit(Label const &, Pop const &po) override {
+    def(po.arg);
+    succs = {po.succ};
+  }
+  void visit(Label const &, Call const &ca) override {
+    for (int i = 0; i < ca.num_reg; i++)
+      acc.uses.push_back(loc(input_regs[i]));
+    for (auto m : caller_saves)
+      acc.defs.push_back(loc(m));
+    succs = {ca.succ};
+  }
+  void visit(Label const &, Return const &) override {
+    acc.uses.push_back(loc(Mach::RAX));
+  }
+  void visit(Label const &, Newframe const &nf) override { succs = {nf.succ}; }
+  void visit(Label const &, Delframe const &df) override { succs = {df.succ}; }
+};
+
+using Bits = std::vector<uint64_t>;
+
+void set_bit(Bits &bits, int i) { bits[i / 64] |= uint64_t{1} << (i % 64); }
+void clear_bit(Bits &bits, int i) { bits[i / 64] &= ~(uint64_t{1} << (i % 64)); }
+
+} // namespace
+
+int Liveness::locate(Pseudo const &ps) {
+  auto it = location_of.find(ps.id);
+  if (it != location_of.end())
+    return it->second;
+  pseudos.push_back(ps);
+  int l = num_mach + static_cast<int>(pseudos.size()) - 1;
+  location_of.insert({ps.id, l});
+  return l;
+}
+
+Liveness::Liveness(Callable const &cbl) {
+  rtl::LabelMap<std::vector<Label>> label_succs;
+  rtl::LabelMap<std::vector<Label>> label_preds;
+  for (auto const &lab : cbl.schedule) {
+    AccessCollector ac{[this](Pseudo const &ps) { return locate(ps); }};
+    cbl.body.at(lab)->accept(lab, ac);
+    access.insert({lab, std::move(ac.acc)});
+    for (auto const &s : ac.succs)
+      label_preds[s].push_back(lab);
+    label_succs.insert({lab, std::move(ac.succs)});
+  }
+
+  // Basic blocks
+  auto leader = [&](Label const &lab) {
+    auto const &preds = label_preds[lab];
+    return lab == cbl.enter || preds.size() != 1 ||
+           label_succs.at(preds[0]).size() != 1;
+  };
+  rtl::LabelMap<int> block_of;
+  auto grow = [&](Label lab) {
+    int b = static_cast<int>(blocks.size());
+    blocks.emplace_back();
+    while (true) {
+      blocks[b].push_back(lab);
+      block_of[lab] = b;
+      auto const &out = label_succs.at(lab);
+      if (out.size() != 1 || leader(out[0]) || block_of.count(out[0]) > 0)
+        break;
+      lab = out[0];
+    }
+  };
+  for (auto const &lab : cbl.schedule)
+    if (leader(lab))
+      grow(lab);
+  // whatever is left is a cycle that nothing else reaches
+  for (auto const &lab : cbl.schedule)
+    if (block_of.count(lab) == 0)
+      grow(lab);
+  succs.resize(blocks.size());
+  for (std::size_t b = 0; b < blocks.size(); b++)
+    for (auto const &s : label_succs.at(blocks[b].back()))
+      succs[b].push_back(block_of.at(s));
+
+  // Use and def sets of the blocks, then the fixpoint
+  std::size_t words = (size() + 63) / 64;
+  std::vector<Bits> gen(blocks.size(), Bits(words)),
+      kill(blocks.size(), Bits(words)), in(blocks.size(), Bits(words)),
+      out(blocks.size(), Bits(words));
+  for (std::size_t b = 0; b < blocks.size(); b++)
+    for (auto it = blocks[b].rbegin(); it != blocks[b].rend(); it++) {
+      auto const &acc = access.at(*it);
+      for (int d : acc.defs) {
+        set_bit(kill[b], d);
+        clear_bit(gen[b], d);
+      }
+      for (int u : acc.uses)
+        set_bit(gen[b], u);
+    }
+  bool changed = true;
+  while (changed) {
+    changed = false;
+    for (std::size_t b = blocks.size(); b-- > 0;) {
+      auto &o = out[b];
+      for (int s : succs[b])
+        for (std::size_t w = 0; w < words; w++)
+          o[w] |= in[s][w];
+      for (std::size_t w = 0; w < words; w++) {
+        auto i = gen[b][w] | (o[w] & ~kill[b][w]);
+        if (i != in[b][w]) {
+          in[b][w] = i;
+          changed = true;
+        }
+      }
+    }
+  }
+  live_out.resize(blocks.size());
+  for (std::size_t b = 0; b < blocks.size(); b++)
+    for (std::size_t w = 0; w < words; w++)
+      for (auto bits = out[b][w]; bits != 0; bits &= bits - 1)
+        live_out[b].push_back(static_cast<int>(w * 64) + __builtin_ctzll(bits));
+}
+
+} // namespace ertl
+} // namespace bx
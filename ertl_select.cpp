@@ -0,0 +1,760 @@
+/**
+ * This file chooses amd64 tiles for runs of ERTL instructions
+ *
+ * Classes:
+ *
+ *     Expr:
+ *         The value a run of instructions computes, as a tree whose leaves
+ *         are registers and constants
+ *
+ *     Selector:
+ *         Covers trees with the cheapest tiles
+ *
+ *     Tiler:
+ *         Builds the tree of a run, if the run is one, and tiles it
+ *
+ * Functions
+ *
+ *     bx::ertl::select_tiles(cbl, live, assignment, costs)
+ *         The dynamic program over the runs of every basic block
+ */
+
+#include "ertl_select.h"
+
+#include <cstdint>
+#include <optional>
+#include <stdexcept>
+#include <utility>
+
+namespace bx {
+namespace ertl {
+
+namespace {
+
+/** The longest run of instructions a tree is built from */
+constexpr int max_run = 4;
+
+/** The nodes live in the pool of the run they are built for */
+struct Expr {
+  enum Op { REG, CONST, ADD, SUB, MUL, AND, OR, XOR, SAL, SAR } op;
+  Mach reg;
+  int64_t value;
+  Expr const *left, *right;
+};
+using ExprPtr = Expr const *;
+
+const Expr zero_expr{Expr::CONST, Mach::RAX, 0, nullptr, nullptr};
+
+/** Node storage, reused from one run to the next */
+class ExprPool {
+  std::vector<Expr> nodes;
+
+public:
+  // three nodes per instruction at most, and nodes must not move
+  ExprPool() { nodes.reserve(64); }
+  void clear() { nodes.clear(); }
+
+  ExprPtr node(Expr e) {
+    if (nodes.size() == nodes.capacity())
+      throw std::runtime_error("Expression pool exhausted");
+    nodes.push_back(e);
+    return &nodes.back();
+  }
+
+  ExprPtr reg(Mach m) { return node({Expr::REG, m, 0, nullptr, nullptr}); }
+
+  ExprPtr constant(int64_t value) {
+    return node({Expr::CONST, Mach::RAX, value, nullptr, nullptr});
+  }
+
+  ExprPtr binop(Expr::Op op, ExprPtr left, ExprPtr right);
+};
+
+/** The tree of a binop, folded when both sides are constants */
+ExprPtr ExprPool::binop(Expr::Op op, ExprPtr left, ExprPtr right) {
+  if (left->op == Expr::CONST && right->op == Expr::CONST) {
+    // wrapping, like the machine
+    auto a = static_cast<uint64_t>(left->value);
+    auto b = static_cast<uint64_t>(right->value);
+    uint64_t v = 0;
+    switch (op) {
+    case Expr::ADD: v = a + b; break;
+    case Expr::SUB: v = a - b; break;
+    case Expr::MUL: v = a * b; break;
+    case Expr::AND: v = a & b; break;
+    case Expr::OR: v = a | b; break;
+    case Expr::XOR: v = a ^ b; break;
+    case Expr::SAL: v = a << (b & 63); break;
+    case Expr::SAR: v = static_cast<uint64_t>(left->value >> (b & 63)); break;
+    default: break;
+    }
+    return constant(static_cast<int64_t>(v));
+  }
+  return node({op, Mach::RAX, 0, left, right});
+}
+
+bool fits32(int64_t v) { return v >= INT32_MIN && v <= INT32_MAX; }
+
+bool commutes(Expr::Op op) {
+  return op == Expr::ADD || op == Expr::MUL || op == Expr::AND ||
+         op == Expr::OR || op == Expr::XOR;
+}
+
+amd64::Pseudo reg(Mach m) { return amd64::Pseudo{to_string(m)}; }
+
+/**
+ * Tiles and their total cost. The lines are only built when emitting, not
+ * while the costs of the candidates are compared.
+ */
+struct Code {
+  /** the lines are built, not only counted */
+  bool emit = false;
+  int cost = 0;
+  std::vector<amd64::Asm::ptr> lines;
+  /** the last line sets ZF according to the value it computes */
+  bool sets_zero = false;
+
+  template <typename Make>
+  Code then(int c, Make const &make, bool zero) && {
+    cost += c;
+    if (emit)
+      lines.push_back(make());
+    sets_zero = zero;
+    return std::move(*this);
+  }
+};
+
+/** Conditions, normalised from rtl::Bbranch::Code */
+enum class Cond { E, NE, L, LE, G, GE };
+
+Cond normalise(rtl::Bbranch::Code code) {
+  switch (code) {
+  case rtl::Bbranch::JE: return Cond::E;
+  case rtl::Bbranch::JNE: return Cond::NE;
+  case rtl::Bbranch::JL:
+  case rtl::Bbranch::JNGE: return Cond::L;
+  case rtl::Bbranch::JLE:
+  case rtl::Bbranch::JNG: return Cond::LE;
+  case rtl::Bbranch::JG:
+  case rtl::Bbranch::JNLE: return Cond::G;
+  case rtl::Bbranch::JGE:
+  case rtl::Bbranch::JNL: return Cond::GE;
+  }
+  throw std::runtime_error("Unknown branch condition");
+}
+
+/** The condition with its operands swapped */
+Cond mirror(Cond c) {
+  switch (c) {
+  case Cond::L: return Cond::G;
+  case Cond::LE: return Cond::GE;
+  case Cond::G: return Cond::L;
+  case Cond::GE: return Cond::LE;
+  default: return c;
+  }
+}
+
+/** The jump taken when the condition does not hold */
+amd64::Asm::ptr (*fail_jump(Cond c))(amd64::Label const &) {
+  switch (c) {
+  case Cond::E: return amd64::Asm::jne;
+  case Cond::NE: return amd64::Asm::je;
+  case Cond::L: return amd64::Asm::jge;
+  case Cond::LE: return amd64::Asm::jg;
+  case Cond::G: return amd64::Asm::jle;
+  default: return amd64::Asm::jl;
+  }
+}
+
+bool holds(Cond c, int64_t a, int64_t b) {
+  switch (c) {
+  case Cond::E: return a == b;
+  case Cond::NE: return a != b;
+  case Cond::L: return a < b;
+  case Cond::LE: return a <= b;
+  case Cond::G: return a > b;
+  default: return a >= b;
+  }
+}
+
+/** A sum base + index * scale + disp, for leaq */
+struct Address {
+  std::pair<Mach, int> terms[2]; // register and scale
+  int num_terms = 0;
+  int64_t disp = 0;
+
+  bool add(Mach r, int scale) {
+    if (num_terms == 2)
+      return false;
+    terms[num_terms++] = {r, scale};
+    return true;
+  }
+};
+
+class Selector {
+  TileCosts const &costs;
+  bool emit = false;
+
+  Code start() const {
+    Code c;
+    c.emit = emit;
+    return c;
+  }
+
+  using Rule = std::optional<Code> (Selector::*)(ExprPtr, Mach);
+  static const std::vector<Rule> op_tiles;
+
+public:
+  explicit Selector(TileCosts const &costs) : costs{costs} {}
+
+  /** Whether the code is built, or only its cost */
+  void emitting(bool on) { emit = on; }
+
+  /** The cheapest code that leaves the value of e in d */
+  std::optional<Code> into(ExprPtr e, Mach d) {
+    switch (e->op) {
+    case Expr::REG:
+      if (e->reg == d)
+        return start();
+      return start().then(
+          costs.move, [&] { return amd64::Asm::movq(reg(e->reg), reg(d)); },
+          false);
+    case Expr::CONST:
+      if (e->value == 0)
+        return start().then(
+            costs.zero, [&] { return amd64::Asm::xorq(reg(d), reg(d)); },
+            true);
+      if (fits32(e->value))
+        return start().then(
+            costs.move, [&] { return amd64::Asm::movq(e->value, reg(d)); },
+            false);
+      return start().then(
+          costs.move, [&] { return amd64::Asm::movabsq(e->value, reg(d)); },
+          false);
+    default:
+      break;
+    }
+    std::optional<Code> best;
+    for (auto tile : op_tiles) {
+      auto c = (this->*tile)(e, d);
+      if (c && (!best || c->cost < best->cost))
+        best = std::move(c);
+    }
+    return best;
+  }
+
+  /**
+   * The cheapest comparison of a with b, and the condition to test after it
+   * (c, or its mirror if the operands were swapped). An operand that is not
+   * a leaf is computed in its home register.
+   */
+  std::optional<std::pair<Code, Cond>> compare(Cond c, ExprPtr a, ExprPtr b,
+                                               Mach home_a, Mach home_b) {
+    auto leaf = [](ExprPtr e) {
+      return e->op == Expr::REG || e->op == Expr::CONST;
+    };
+    if ((a->op == Expr::CONST && b->op != Expr::CONST) ||
+        (leaf(a) && !leaf(b))) {
+      std::swap(a, b);
+      std::swap(home_a, home_b);
+      c = mirror(c);
+    }
+    if (!leaf(b))
+      return std::nullopt;
+    Mach ra = a->op == Expr::REG ? a->reg : home_a;
+    // b is read after a is computed
+    if (b->op == Expr::REG && b->reg == ra && !leaf(a))
+      return std::nullopt;
+    auto code = a->op == Expr::REG ? start() : into(a, ra);
+    if (!code)
+      return std::nullopt;
+    if (b->op == Expr::REG)
+      return std::make_pair(
+          std::move(*code).then(
+              costs.compare,
+              [&] { return amd64::Asm::cmpq(reg(b->reg), reg(ra)); }, false),
+          c);
+    if (b->value == 0) {
+      // the flags of the computation itself do for equality
+      if (code->sets_zero && (c == Cond::E || c == Cond::NE))
+        return std::make_pair(std::move(*code), c);
+      return std::make_pair(
+          std::move(*code).then(
+              costs.compare, [&] { return amd64::Asm::testq(reg(ra), reg(ra)); },
+              false),
+          c);
+    }
+    if (!fits32(b->value))
+      return std::nullopt;
+    return std::make_pair(std::move(*code).then(
+                              costs.compare,
+                              [&] {
+                                return amd64::Asm::cmpq(
+                                    static_cast<int32_t>(b->value), reg(ra));
+                              },
+                              false),
+                          c);
+  }
+
+private:
+  // The tiles for the operators. Each one covers the root of the tree, with
+  // its left subtree computed in place first.
+
+  /** op $k, d */
+  std::optional<Code> alu_imm(ExprPtr e, Mach d) {
+    using Op = amd64::Asm::ptr (*)(int64_t, amd64::Pseudo const &);
+    Op op = nullptr;
+    switch (e->op) {
+    case Expr::ADD: op = amd64::Asm::addq; break;
+    case Expr::SUB: op = amd64::Asm::subq; break;
+    case Expr::AND: op = amd64::Asm::andq; break;
+    case Expr::OR: op = amd64::Asm::orq; break;
+    case Expr::XOR: op = amd64::Asm::xorq; break;
+    default: break;
+    }
+    if (!op)
+      return std::nullopt;
+    auto left = e->left, right = e->right;
+    if (left->op == Expr::CONST && commutes(e->op))
+      std::swap(left, right);
+    if (right->op != Expr::CONST || !fits32(right->value))
+      return std::nullopt;
+    auto code = into(left, d);
+    if (!code)
+      return std::nullopt;
+    return std::move(*code).then(
+        costs.alu, [&] { return op(right->value, reg(d)); }, true);
+  }
+
+  /** incq d and decq d */
+  std::optional<Code> inc_dec(ExprPtr e, Mach d) {
+    if (e->op != Expr::ADD && e->op != Expr::SUB)
+      return std::nullopt;
+    auto left = e->left, right = e->right;
+    if (left->op == Expr::CONST && e->op == Expr::ADD)
+      std::swap(left, right);
+    if (right->op != Expr::CONST || (right->value != 1 && right->value != -1))
+      return std::nullopt;
+    auto code = into(left, d);
+    if (!code)
+      return std::nullopt;
+    bool up = (right->value == 1) == (e->op == Expr::ADD);
+    return std::move(*code).then(
+        costs.inc,
+        [&] { return up ? amd64::Asm::incq(reg(d)) : amd64::Asm::decq(reg(d)); },
+        true);
+  }
+
+  /** imulq $k, d, or salq when k is a power of two */
+  std::optional<Code> mul_imm(ExprPtr e, Mach d) {
+    if (e->op != Expr::MUL)
+      return std::nullopt;
+    auto left = e->left, right = e->right;
+    if (left->op == Expr::CONST)
+      std::swap(left, right);
+    if (right->op != Expr::CONST || !fits32(right->value))
+      return std::nullopt;
+    auto k = right->value;
+    if (k == 0)
+      return into(right, d);
+    auto code = into(left, d);
+    if (!code || k == 1)
+      return code;
+    if (k > 0 && (k & (k - 1)) == 0) {
+      int shift = __builtin_ctzll(static_cast<uint64_t>(k));
+      return std::move(*code).then(
+          costs.shift, [&] { return amd64::Asm::salq(shift, reg(d)); }, true);
+    }
+    return std::move(*code).then(
+        costs.imul, [&] { return amd64::Asm::imulq(k, reg(d)); }, false);
+  }
+
+  /** salq $k, d and sarq $k, d */
+  std::optional<Code> shift_imm(ExprPtr e, Mach d) {
+    if ((e->op != Expr::SAL && e->op != Expr::SAR) ||
+        e->right->op != Expr::CONST)
+      return std::nullopt;
+    auto code = into(e->left, d);
+    int k = static_cast<int>(e->right->value & 63);
+    if (!code || k == 0)
+      return code;
+    return std::move(*code).then(
+        costs.shift,
+        [&] {
+          return e->op == Expr::SAL ? amd64::Asm::salq(k, reg(d))
+                                    : amd64::Asm::sarq(k, reg(d));
+        },
+        true);
+  }
+
+  /** op b, d */
+  std::optional<Code> alu_reg(ExprPtr e, Mach d) {
+    using Op = amd64::Asm::ptr (*)(amd64::Pseudo const &,
+                                   amd64::Pseudo const &);
+    Op op = nullptr;
+    switch (e->op) {
+    case Expr::ADD: op = amd64::Asm::addq; break;
+    case Expr::SUB: op = amd64::Asm::subq; break;
+    case Expr::AND: op = amd64::Asm::andq; break;
+    case Expr::OR: op = amd64::Asm::orq; break;
+    case Expr::XOR: op = amd64::Asm::xorq; break;
+    case Expr::MUL: op = amd64::Asm::imulq; break;
+    default: break;
+    }
+    if (!op)
+      return std::nullopt;
+    std::optional<Code> best;
+    for (int swapped = 0; swapped < (commutes(e->op) ? 2 : 1); swapped++) {
+      auto left = swapped ? e->right : e->left;
+      auto right = swapped ? e->left : e->right;
+      // d is written by the left side before b is read
+      if (right->op != Expr::REG ||
+          (right->reg == d && !(left->op == Expr::REG && left->reg == d)))
+        continue;
+      auto code = into(left, d);
+      if (!code)
+        continue;
+      bool mul = e->op == Expr::MUL;
+      auto full = std::move(*code).then(
+          mul ? costs.imul : costs.alu,
+          [&] { return op(reg(right->reg), reg(d)); }, !mul);
+      if (!best || full.cost < best->cost)
+        best = std::move(full);
+    }
+    return best;
+  }
+
+  static bool address(ExprPtr e, Address &a, int64_t sign = 1) {
+    switch (e->op) {
+    case Expr::REG:
+      return sign > 0 && a.add(e->reg, 1);
+    case Expr::CONST:
+      a.disp += sign * e->value;
+      return true;
+    case Expr::ADD:
+      return address(e->left, a, sign) && address(e->right, a, sign);
+    case Expr::SUB:
+      return e->right->op == Expr::CONST && address(e->left, a, sign) &&
+             address(e->right, a, -sign);
+    case Expr::MUL:
+    case Expr::SAL: {
+      auto left = e->left, right = e->right;
+      if (e->op == Expr::MUL && left->op == Expr::CONST)
+        std::swap(left, right);
+      if (sign < 0 || left->op != Expr::REG || right->op != Expr::CONST)
+        return false;
+      auto k = right->value;
+      int64_t scale = e->op == Expr::SAL ? (k >= 0 && k <= 3 ? 1 << k : 0) : k;
+      if (scale == 3 || scale == 5 || scale == 9) {
+        // x * (s + 1) = x + x * s
+        if (!a.add(left->reg, 1))
+          return false;
+        scale--;
+      }
+      if (scale != 1 && scale != 2 && scale != 4 && scale != 8)
+        return false;
+      return a.add(left->reg, static_cast<int>(scale));
+    }
+    default:
+      return false;
+    }
+  }
+
+  /** leaq disp(base,index,scale), d */
+  std::optional<Code> lea(ExprPtr e, Mach d) {
+    Address a;
+    if (!address(e, a) || a.num_terms == 0 || !fits32(a.disp))
+      return std::nullopt;
+    auto disp = static_cast<int32_t>(a.disp);
+    auto base = a.terms[0], index = a.terms[1];
+    if (a.num_terms == 1) {
+      if (base.second == 1)
+        return start().then(
+            costs.lea,
+            [&] { return amd64::Asm::leaq(disp, reg(base.first), reg(d)); },
+            false);
+      if (base.second != 2)
+        return start().then(
+            costs.lea,
+            [&] {
+              return amd64::Asm::leaq(disp, reg(base.first), base.second,
+                                      reg(d));
+            },
+            false);
+      // x * 2 = x + x
+      index = {base.first, 1};
+      base.second = 1;
+    }
+    if (base.second != 1)
+      std::swap(base, index);
+    if (base.second != 1)
+      return std::nullopt;
+    return start().then(
+        costs.lea,
+        [&] {
+          return amd64::Asm::leaq(disp, reg(base.first), reg(index.first),
+                                  index.second, reg(d));
+        },
+        false);
+  }
+};
+
+// In order of preference between tiles of the same cost
+const std::vector<Selector::Rule> Selector::op_tiles{
+    &Selector::inc_dec,   &Selector::alu_imm, &Selector::mul_imm,
+    &Selector::shift_imm, &Selector::alu_reg, &Selector::lea};
+
+Expr::Op binop(rtl::Binop::Code code) {
+  switch (code) {
+  case rtl::Binop::ADD: return Expr::ADD;
+  case rtl::Binop::SUB: return Expr::SUB;
+  case rtl::Binop::MUL: return Expr::MUL;
+  case rtl::Binop::SAL: return Expr::SAL;
+  case rtl::Binop::SAR: return Expr::SAR;
+  case rtl::Binop::AND: return Expr::AND;
+  case rtl::Binop::OR: return Expr::OR;
+  case rtl::Binop::XOR: return Expr::XOR;
+  default: return Expr::REG; // divisions are not tiled
+  }
+}
+
+/** Builds the tree of a run of instructions and tiles it */
+class Tiler {
+  Assignment const &assignment;
+  Selector sel;
+  ExprPool pool;
+
+  /** A value defined in the run */
+  struct Pending {
+    int pseudo;
+    ExprPtr tree;
+    int at; // in the run
+    bool used;
+  };
+  std::vector<Pending> pending;
+  bool ok = true;
+
+  ExprPtr read(Pseudo const &ps) {
+    for (auto &p : pending)
+      if (p.pseudo == ps.id) {
+        // trees, not DAGs: a value used twice would need a register
+        ok = ok && !p.used;
+        p.used = true;
+        return p.tree;
+      }
+    return pool.reg(assignment.at(ps.id));
+  }
+
+  void define(Pseudo const &ps, ExprPtr tree, int at) {
+    for (auto it = pending.begin(); it != pending.end(); ++it)
+      if (it->pseudo == ps.id) {
+        ok = ok && it->used;
+        pending.erase(it);
+        break;
+      }
+    pending.push_back({ps.id, tree, at, false});
+  }
+
+  /**
+   * Whether the run is a tree: every value but the root's is used once, and
+   * dead after the root by dead_mask (bit m - 1 for the instruction m before
+   * it)
+   */
+  bool valid(int root, unsigned dead_mask) const {
+    if (!ok)
+      return false;
+    for (auto const &p : pending)
+      if (p.at != root &&
+          (!p.used || !(dead_mask & (1u << (root - p.at - 1)))))
+        return false;
+    return true;
+  }
+
+  std::optional<std::pair<Tile, int>> branch(Cond c, ExprPtr a, ExprPtr b,
+                                             Pseudo const &arg_a,
+                                             Mach home_b, Label const &succ,
+                                             Label const &fail) {
+    if (a->op == Expr::CONST && b->op == Expr::CONST) {
+      Tile t{};
+      t.succ = holds(c, a->value, b->value) ? succ : fail;
+      return std::make_pair(std::move(t), 0);
+    }
+    auto cmp = sel.compare(c, a, b, assignment.at(arg_a.id), home_b);
+    if (!cmp)
+      return std::nullopt;
+    return std::make_pair(Tile{false, std::move(cmp->first.lines),
+                               fail_jump(cmp->second), succ, fail},
+                          cmp->first.cost);
+  }
+
+public:
+  Tiler(Assignment const &assignment, TileCosts const &costs)
+      : assignment{assignment}, sel{costs} {}
+
+  /**
+   * The root tile of the run of instrs and its cost, if the run is a tree
+   * that can be tiled; the lines are only built if emit is set
+   */
+  std::optional<std::pair<Tile, int>> run(Instr const *const *instrs, int size,
+                                          unsigned dead_mask, bool emit) {
+    pool.clear();
+    pending.clear();
+    ok = true;
+    sel.emitting(emit);
+    int root = size - 1;
+    for (int j = 0; j < root; j++) {
+      auto const *instr = instrs[j];
+      if (auto mv = dynamic_cast<Move const *>(instr)) {
+        define(mv->dest, pool.constant(mv->source), j);
+      } else if (auto cp = dynamic_cast<Copy const *>(instr)) {
+        define(cp->dest, read(cp->src), j);
+      } else if (auto bo = dynamic_cast<Binop const *>(instr)) {
+        auto op = binop(bo->opcode);
+        auto left = read(bo->dest), right = read(bo->src);
+        // shifts by a register count are left to ertl_asm
+        if (op == Expr::REG ||
+            ((op == Expr::SAL || op == Expr::SAR) && right->op != Expr::CONST))
+          return std::nullopt;
+        define(bo->dest, pool.binop(op, left, right), j);
+      } else {
+        return std::nullopt;
+      }
+      if (!ok)
+        return std::nullopt;
+    }
+
+    auto const *instr = instrs[root];
+    if (auto bb = dynamic_cast<Bbranch const *>(instr)) {
+      auto a = read(bb->arg1), b = read(bb->arg2);
+      if (!valid(root, dead_mask))
+        return std::nullopt;
+      return branch(normalise(bb->opcode), a, b, bb->arg1,
+                    assignment.at(bb->arg2.id), bb->succ, bb->fail);
+    }
+    if (auto ub = dynamic_cast<Ubranch const *>(instr)) {
+      auto a = read(ub->arg);
+      if (!valid(root, dead_mask))
+        return std::nullopt;
+      auto c = ub->opcode == rtl::Ubranch::JZ ? Cond::E : Cond::NE;
+      return branch(c, a, &zero_expr, ub->arg, Mach::RAX, ub->succ, ub->fail);
+    }
+
+    // an assignment at the root
+    Pseudo dest;
+    Label succ;
+    if (auto mv = dynamic_cast<Move const *>(instr)) {
+      dest = mv->dest, succ = mv->succ;
+      define(dest, pool.constant(mv->source), root);
+    } else if (auto cp = dynamic_cast<Copy const *>(instr)) {
+      dest = cp->dest, succ = cp->succ;
+      define(dest, read(cp->src), root);
+    } else if (auto bo = dynamic_cast<Binop const *>(instr)) {
+      auto op = binop(bo->opcode);
+      auto left = read(bo->dest), right = read(bo->src);
+      if (op == Expr::REG ||
+          ((op == Expr::SAL || op == Expr::SAR) && right->op != Expr::CONST))
+        return std::nullopt;
+      dest = bo->dest, succ = bo->succ;
+      define(dest, pool.binop(op, left, right), root);
+    } else {
+      return std::nullopt;
+    }
+    if (!valid(root, dead_mask))
+      return std::nullopt;
+    auto code = sel.into(pending.back().tree, assignment.at(dest.id));
+    if (!code)
+      return std::nullopt;
+    return std::make_pair(
+        Tile{false, std::move(code->lines), nullptr, succ, Label{}},
+        code->cost);
+  }
+};
+
+} // namespace
+
+rtl::LabelMap<Tile> select_tiles(Callable const &cbl, Liveness const &lv,
+                                 Assignment const &assignment,
+                                 TileCosts const &costs) {
+  rtl::LabelMap<std::size_t> position;
+  position.reserve(cbl.schedule.size());
+  for (std::size_t i = 0; i < cbl.schedule.size(); i++)
+    position[cbl.schedule[i]] = i;
+  Tiler tiler{assignment, costs};
+  rtl::LabelMap<Tile> tiles;
+  tiles.reserve(cbl.body.size());
+  std::vector<char> live(lv.size(), 0);
+
+  for (std::size_t b = 0; b < lv.blocks.size(); b++) {
+    auto const &labs = lv.blocks[b];
+    int n = static_cast<int>(labs.size());
+    std::vector<Instr const *> instrs(n);
+    std::vector<Access const *> access(n);
+    // whether instruction i is scheduled right after instruction i - 1
+    std::vector<char> adjacent(n, 0);
+    for (int i = 0; i < n; i++) {
+      instrs[i] = cbl.body.at(labs[i]).get();
+      access[i] = &lv.access.at(labs[i]);
+      if (i > 0)
+        adjacent[i] = position.at(labs[i - 1]) + 1 == position.at(labs[i]);
+    }
+
+    // dead[i] has bit m - 1 set when what instruction i - m defines is dead
+    // after instruction i
+    std::vector<unsigned> dead(n, 0);
+    for (int loc : lv.live_out[b])
+      live[loc] = 1;
+    for (int i = n; i-- > 0;) {
+      for (int m = 1; m < max_run && m <= i; m++) {
+        bool all_dead = true;
+        for (int d : access[i - m]->defs)
+          all_dead = all_dead && !live[d];
+        if (all_dead)
+          dead[i] |= 1u << (m - 1);
+      }
+      for (int d : access[i]->defs)
+        live[d] = 0;
+      for (int u : access[i]->uses)
+        live[u] = 1;
+    }
+    for (int i = 0; i < n; i++)
+      for (int u : access[i]->uses)
+        live[u] = 0;
+    for (int loc : lv.live_out[b])
+      live[loc] = 0;
+
+    // best[i] is the cost of the cheapest cover of the first i instructions,
+    // whose last run starts at first[i], or is left to ertl_asm if first[i]
+    // is -1
+    std::vector<int> best(n + 1, 0), first(n + 1, -1);
+    for (int i = 0; i < n; i++) {
+      best[i + 1] = best[i] + costs.fallback;
+      for (int s = i; s >= 0 && s > i - max_run; s--) {
+        if (s < i && !adjacent[s + 1])
+          break;
+        auto tile = tiler.run(&instrs[s], i + 1 - s, dead[i], false);
+        if (tile && best[s] + tile->second < best[i + 1]) {
+          best[i + 1] = best[s] + tile->second;
+          first[i + 1] = s;
+        }
+      }
+    }
+
+    for (int i = n; i > 0;) {
+      int s = first[i];
+      if (s < 0) {
+        i--;
+        continue;
+      }
+      for (int j = s; j < i - 1; j++)
+        tiles[labs[j]].absorbed = true;
+      tiles.insert_or_assign(
+          labs[i - 1], std::move(tiler.run(&instrs[s], i - s, dead[i - 1], true)
+                                     ->first));
+      i = s;
+    }
+  }
+  return tiles;
+}
+
+} // namespace ertl
+} // namespace bx
@@ -0,0 +1,60 @@
+#pragma once
+
+/**
+ * Instruction selection by tiling
+ *
+ * Runs of consecutive ERTL instructions in a basic block are read as small
+ * expression trees: a move or copy whose destination is only read by a later
+ * instruction of the run, and is dead after it, becomes a subtree of that
+ * instruction. The trees are covered with amd64 tiles (immediate operands,
+ * leaq for sums of registers, scaled registers and constants, incq and decq,
+ * shifts for multiplications by powers of two, testq for comparisons with
+ * zero) and a dynamic program over every block picks the runs whose tiles
+ * cost least. The instructions that no tile covers are left to ertl_asm.
+ */
+
+#include <vector>
+
+#include "amd64.h"
+#include "ertl.h"
+#include "ertl_alloc.h"
+
+namespace bx {
+namespace ertl {
+
+/** The price of every kind of tile; the selector minimises their sum */
+struct TileCosts {
+  int move = 2;    // movq of a register or an immediate
+  int zero = 1;    // xorq of a register with itself
+  int alu = 2;     // addq, subq, andq, orq and xorq
+  int inc = 1;     // incq and decq
+  int shift = 2;   // salq and sarq by an immediate
+  int imul = 4;    // imulq
+  int lea = 2;     // leaq, whatever the addressing mode
+  int compare = 2; // cmpq and testq
+  /** an instruction left to ertl_asm, which no tile covers */
+  int fallback = 8;
+};
+
+/** The code chosen for one instruction */
+struct Tile {
+  /** the instruction is computed by a later tile of its run */
+  bool absorbed = false;
+  std::vector<amd64::Asm::ptr> code;
+  /** for a branch: the jump to fail, taken when the condition does not hold */
+  amd64::Asm::ptr (*fail_jump)(amd64::Label const &) = nullptr;
+  Label succ, fail;
+};
+
+/**
+ * Tile the callable, whose pseudos have been given the registers in
+ * assignment, with live its liveness after allocation. The result has an
+ * entry for every instruction that a tile covers, either absorbed or as the
+ * root of its run.
+ */
+rtl::LabelMap<Tile> select_tiles(Callable const &cbl, Liveness const &live,
+                                 Assignment const &assignment,
+                                 TileCosts const &costs = TileCosts{});
+
+} // namespace ertl
+} // namespace bx
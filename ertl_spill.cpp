@@ -0,0 +1,197 @@
+/**
+ * Spill code
+ *
+ * Every spilled pseudo gets its own stack slot. An instruction that reads
+ * spilled pseudos is preceded by loads of their slots into fresh pseudos, and
+ * one that writes them is followed by stores; an instruction that does both
+ * to the same pseudo, like a binop, uses a single fresh pseudo for it.
+ */
+
+#include <unordered_map>
+
+#include "ertl_alloc.h"
+
+namespace bx {
+namespace ertl {
+
+namespace {
+
+class SpillRewriter : public InstrVisitor {
+private:
+  Callable &cbl;
+  std::unordered_set<int> &temps;
+  std::unordered_map<int, int> slot_of; // by pseudo id
+  std::vector<Label> schedule;
+
+  // The instruction being rewritten
+  Label at;
+  std::unordered_map<int, Pseudo> temp_of;
+  std::vector<std::pair<int, Pseudo>> reloads, stores;
+  std::vector<Label> store_labels;
+
+  Pseudo temp(Pseudo const &ps) {
+    auto it = temp_of.find(ps.id);
+    if (it != temp_of.end())
+      return it->second;
+    auto t = rtl::fresh_pseudo();
+    temps.insert(t.id);
+    temp_of.insert({ps.id, t});
+    return t;
+  }
+
+  Pseudo use(Pseudo const &ps) {
+    auto slot = slot_of.find(ps.id);
+    if (slot == slot_of.end())
+      return ps;
+    auto t = temp(ps);
+    reloads.push_back({slot->second, t});
+    return t;
+  }
+
+  Pseudo def(Pseudo const &ps) {
+    auto slot = slot_of.find(ps.id);
+    if (slot == slot_of.end())
+      return ps;
+    auto t = temp(ps);
+    stores.push_back({slot->second, t});
+    return t;
+  }
+
+  /** Where the rewritten instruction continues: the stores, then succ */
+  Label then(Label const &succ) {
+    auto next = succ;
+    for (auto it = stores.rbegin(); it != stores.rend(); it++) {
+      auto lab = rtl::fresh_label();
+      cbl.body.insert_or_assign(lab, StoreSlot::make(it->second, it->first, next));
+      store_labels.insert(store_labels.begin(), lab);
+      next = lab;
+    }
+    return next;
+  }
+
+  void emit(InstrPtr instr) {
+    auto lab = at;
+    for (auto const &rl : reloads) {
+      auto next = rtl::fresh_label();
+      cbl.body.insert_or_assign(lab, LoadSlot::make(rl.first, rl.second, next));
+      schedule.push_back(lab);
+      lab = next;
+    }
+    if (!reloads.empty() || !stores.empty())
+      cbl.body.insert_or_assign(lab, std::move(instr));
+    schedule.push_back(lab);
+    schedule.insert(schedule.end(), store_labels.begin(), store_labels.end());
+  }
+
+public:
+  SpillRewriter(Callable &cbl, std::vector<Pseudo> const &spilled,
+                std::unordered_set<int> &temps)
+      : cbl{cbl}, temps{temps} {
+    for (auto const &ps : spilled)
+      slot_of.insert({ps.id, cbl.num_slots++});
+  }
+
+  void run() {
+    auto old = std::move(cbl.schedule);
+    for (auto const &lab : old) {
+      at = lab;
+      temp_of.clear();
+      reloads.clear();
+      stores.clear();
+      store_labels.clear();
+      auto instr = cbl.body.at(lab);
+      instr->accept(lab, *this);
+    }
+    cbl.schedule = std::move(schedule);
+  }
+
+  void visit(Label const &, Move const &mv) override {
+    auto dest = def(mv.dest);
+    emit(Move::make(mv.source, dest, then(mv.succ)));
+  }
+  void visit(Label const &, Copy const &cp) override {
+    auto src = use(cp.src);
+    auto dest = def(cp.dest);
+    emit(Copy::make(src, dest, then(cp.succ)));
+  }
+  void visit(Label const &, GetMach const &gm) override {
+    auto dest = def(gm.dest);
+    emit(GetMach::make(gm.src, dest, then(gm.succ)));
+  }
+  void visit(Label const &, SetMach const &sm) override {
+    auto src = use(sm.src);
+    emit(SetMach::make(src, sm.dest, then(sm.succ)));
+  }
+  void visit(Label const &, Load const &ld) override {
+    auto dest = def(ld.dest);
+    emit(Load::make(ld.src, ld.offset, dest, then(ld.succ)));
+  }
+  void visit(Label const &, LoadParam const &lp) override {
+    auto dest = def(lp.dest);
+    emit(LoadParam::make(lp.slot, dest, then(lp.succ)));
+  }
+  void visit(Label const &, LoadSlot const &ls) override {
+    auto dest = def(ls.dest);
+    emit(LoadSlot::make(ls.slot, dest, then(ls.succ)));
+  }
+  void visit(Label const &, StoreSlot const &ss) override {
+    auto src = use(ss.src);
+    emit(StoreSlot::make(src, ss.slot, then(ss.succ)));
+  }
+  void visit(Label const &, Store const &st) override {
+    auto src = use(st.src);
+    emit(Store::make(src, st.dest, st.offset, then(st.succ)));
+  }
+  void visit(Label const &, Binop const &bo) override {
+    auto src = use(bo.src);
+    auto dest = use(bo.dest);
+    def(bo.dest);
+    emit(Binop::make(bo.opcode, src, dest, then(bo.succ)));
+  }
+  void visit(Label const &, Unop const &uo) override {
+    auto arg = use(uo.arg);
+    def(uo.arg);
+    emit(Unop::make(uo.opcode, arg, then(uo.succ)));
+  }
+  void visit(Label const &, Bbranch const &bb) override {
+    auto arg1 = use(bb.arg1);
+    auto arg2 = use(bb.arg2);
+    emit(Bbranch::make(bb.opcode, arg1, arg2, bb.succ, bb.fail));
+  }
+  void visit(Label const &, Ubranch const &ub) override {
+    auto arg = use(ub.arg);
+    emit(Ubranch::make(ub.opcode, arg, ub.succ, ub.fail));
+  }
+  void visit(Label const &, Goto const &go) override {
+    emit(Goto::make(go.succ));
+  }
+  void visit(Label const &, Push const &pu) override {
+    auto arg = use(pu.arg);
+    emit(Push::make(arg, then(pu.succ)));
+  }
+  void visit(Label const &, Pop const &po) override {
+    auto arg = def(po.arg);
+    emit(Pop::make(arg, then(po.succ)));
+  }
+  void visit(Label const &, Call const &ca) override {
+    emit(Call::make(ca.func, ca.num_reg, ca.succ));
+  }
+  void visit(Label const &, Return const &) override { emit(Return::make()); }
+  void visit(Label const &, Newframe const &nf) override {
+    emit(Newframe::make(nf.succ));
+  }
+  void visit(Label const &, Delframe const &df) override {
+    emit(Delframe::make(df.succ));
+  }
+};
+
+} // namespace
+
+void spill(Callable &cbl, std::vector<Pseudo> const &spilled,
+           std::unordered_set<int> &temps) {
+  rtl::Numbering::Scope scope{cbl.numbering};
+  SpillRewriter{cbl, spilled, temps}.run();
+}
+
+} // namespace ertl
+} // namespace bx
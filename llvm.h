@@ -69,26 +69,26 @@ static ptr set_label(int64_t imm) {
 #define ARITH_BINOP1(mnemonic)                                                 \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          std::string const &arg1, std::string const &arg2) {   \
-    std::string repr = "\t %`d = " #mnemonic " nsw `t %`a0, %`a1";               \
+    std::string repr = "\t %`d = " #mnemonic " `t %`a0, %`a1";                 \
     return std::shared_ptr<Llvm>(                                              \
         new Llvm{{dest}, {type}, {{arg1, arg2}}, repr});                       \
   }                                                                            \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          int64_t imm, std::string const &arg2) {               \
     std::string repr =                                                         \
-        "\t %`d = " #mnemonic " nsw `t " + std::to_string(imm) + ", %`a1";      \
+        "\t %`d = " #mnemonic " `t " + std::to_string(imm) + ", %`a0";         \
     return std::shared_ptr<Llvm>(new Llvm{{dest}, {type}, {arg2}, repr});      \
   }                                                                            \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          std::string const &arg1, int64_t imm) {               \
     std::string repr =                                                         \
-        "\t %`d = " #mnemonic " nsw `t %`a0, " + std::to_string(imm);           \
+        "\t %`d = " #mnemonic " `t %`a0, " + std::to_string(imm);              \
     return std::shared_ptr<Llvm>(new Llvm{{dest}, {type}, {arg1}, repr});      \
   }                                                                            \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          int64_t imm1, int64_t imm2) {                         \
     std::string repr =                                                         \
-        "\t %`d = " #mnemonic " nsw `t "+ std::to_string(imm1) + ","+ std::to_string(imm2);           \
+        "\t %`d = " #mnemonic " `t "+ std::to_string(imm1) + ","+ std::to_string(imm2);           \
     return std::shared_ptr<Llvm>(new Llvm{{dest}, {type}, {}, repr});      \
   }
   ARITH_BINOP1(add)
@@ -99,23 +99,24 @@ static ptr set_label(int64_t imm) {
 #define ARITH_BINOP2(mnemonic)                                                 \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          std::string const &arg1, std::string const &arg2) {   \
-    std::string repr = "\t %`d = " #mnemonic " `t `a0, `a1";                   \
+    std::string repr = "\t %`d = " #mnemonic " `t %`a0, %`a1";                 \
     return std::shared_ptr<Llvm>(                                              \
         new Llvm{{dest}, {type}, {{arg1, arg2}}, repr});                       \
   }                                                                            \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          int64_t imm, std::string const &arg2) {               \
     std::string repr =                                                         \
-        "\t %`d = " #mnemonic " `t " + std::to_string(imm) + ", `a1";          \
+        "\t %`d = " #mnemonic " `t " + std::to_string(imm) + ", %`a0";         \
     return std::shared_ptr<Llvm>(new Llvm{{dest}, {type}, {arg2}, repr});      \
   }                                                                            \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          std::string const &arg1, int64_t imm) {               \
     std::string repr =                                                         \
-        "\t %`d = " #mnemonic " `t `a0, " + std::to_string(imm);               \
+        "\t %`d = " #mnemonic " `t %`a0, " + std::to_string(imm);              \
     return std::shared_ptr<Llvm>(new Llvm{{dest}, {type}, {arg1}, repr});      \
   }
-  ARITH_BINOP2(udiv)
+  ARITH_BINOP2(sdiv) // signed division
+  ARITH_BINOP2(srem) // signed remainder
   ARITH_BINOP2(shl)  // left shift
   ARITH_BINOP2(ashr) // arithmetic right shift
   ARITH_BINOP2(and)
@@ -133,7 +134,7 @@ static ptr set_label(int64_t imm) {
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
                          int64_t imm, std::string const &arg2) {               \
     std::string repr =                                                         \
-        "\t %`d = icmp " #mnemonic " `t " + std::to_string(imm) + ", %`a1";    \
+        "\t %`d = icmp " #mnemonic " `t " + std::to_string(imm) + ", %`a0";    \
     return std::shared_ptr<Llvm>(new Llvm{{dest}, {type}, {arg2}, repr});      \
   }                                                                            \
   static ptr mnemonic##q(std::string const &dest, std::string const &type,     \
@@ -182,14 +183,23 @@ static ptr set_label(int64_t imm) {
     return std::unique_ptr<Llvm>(new Llvm{{name}, {type}, {}, repr});
   }
 
+  static ptr declare(std::string const &name, std::string const &type,
+                     int nargs) {
+    std::string repr = "declare `t @`d(";
+    for (int i = 0; i < nargs; i++)
+      repr += i == 0 ? "i64" : ", i64";
+    repr += ")";
+    return std::unique_ptr<Llvm>(new Llvm{{name}, {type}, {}, repr});
+  }
+
   static ptr ret_void() {
     std::string repr = "\t ret void";
     return std::unique_ptr<Llvm>(new Llvm{{}, {}, {}, repr});
   }
 
   static ptr ret_type(std::string const &type, std::string const &arg) {
-    std::string repr = "\t ret `t " + arg;
-    return std::unique_ptr<Llvm>(new Llvm{{}, {type}, {}, repr});
+    std::string repr = "\t ret `t %`d";
+    return std::unique_ptr<Llvm>(new Llvm{{arg}, {type}, {}, repr});
   }
 
   static ptr allocation(std::string const &name, std::string const &glb_var) {
@@ -207,8 +217,9 @@ static ptr set_label(int64_t imm) {
     return std::unique_ptr<Llvm>(new Llvm{{}, {}, {}, repr});
   }
 
-  static ptr call(std::string const &name, std::string const &type, std::vector<std::vector<std::string>> const &args) {
-    std::string repr = "\t call `t  @`d(";
+  static ptr call(std::string const &name, std::string const &type, std::vector<std::vector<std::string>> const &args,
+                  std::string const &result = "") {
+    std::string repr = result.empty() ? "\t call `t  @`d(" : "\t %" + result + " = call `t  @`d(";
     if (!args.empty()){
       int s = args.size();
       for (int i=0; i<s; i++) {
@@ -1,27 +1,171 @@
+#include <chrono>
 #include <cstdlib>
 #include <filesystem>
 #include <iostream>
 #include <memory>
+#include <stdexcept>
+#include <string>
 
 #include "antlr4-runtime.h"
 
 #include "ast.h"
-#include "ast_rtl.h"
-#include "rtl.h"
+#include "amd64_elf.h"
+#include "amd64_jit.h"
+#include "amd64_peephole.h"
+#include "pipeline.h"
 #include "type_check.h"
-#include "ssa.h"
-#include "rtl_ssa.h"
-#include "ssa_llvm.h"
 
 using namespace bx;
 
+namespace {
+
+void link(std::string const &cmd, std::string const &exe_file,
+          char const *failure) {
+  std::cout << "Running: " << cmd << std::endl;
+  if (std::system(cmd.c_str()) != 0) {
+    std::cerr << failure;
+    std::exit(2);
+  }
+  std::cout << exe_file << " created.\n";
+}
+
+/** The value of a numeric flag, which must be a whole number of at least min */
+int flag_value(std::string const &arg, std::string const &value, int min) {
+  std::size_t end = 0;
+  int n = 0;
+  try {
+    n = std::stoi(value, &end);
+  } catch (std::logic_error const &) {
+    end = 0;
+  }
+  if (end == 0 || end != value.size() || n < min) {
+    std::cerr << "Bad value for " << arg.substr(0, arg.find('=')) << ": "
+              << value << " (a whole number of at least " << min
+              << " is expected)" << std::endl;
+    std::exit(1);
+  }
+  return n;
+}
+
+void report(StreamStats const &stats) {
+  std::cout << "rtl cfg: " << stats.rtl_simplified
+            << " instruction(s) removed or rewritten.\n";
+  for (auto const &stat : stats.stats)
+    std::cout << "ssa " << stat.first << ": " << stat.second
+              << " instruction(s) removed or rewritten.\n";
+}
+
+/**
+ * Compile a callable at a time and write its code out straight away, so only
+ * the output files are written and the peephole statistics are for the whole
+ * program
+ */
+void compile_streaming(source::Program const &prog, Options const &options,
+                       WorkPool &pool, bool system_assembler,
+                       std::string const &file_root) {
+  auto exe_file = file_root + ".exe";
+  StreamStats stats;
+  if (options.native) {
+    auto asm_file = file_root + (system_assembler ? ".s" : ".o");
+    std::ofstream asm_out;
+    asm_out.open(asm_file, std::ios::binary);
+    amd64::PeepholeStats peephole_stats;
+    amd64::MachineCode mc;
+    stats = stream_native(prog, options, pool, [&](AsmProgram &code) {
+      for (auto const &stat : amd64::peephole(code))
+        peephole_stats[stat.first] += stat.second;
+      if (system_assembler)
+        for (auto const &l : code)
+          asm_out << *l;
+      else
+        mc.append(amd64::encode(code));
+    });
+    if (!system_assembler)
+      amd64::write_object(asm_out, mc);
+    asm_out.close();
+    report(stats);
+    for (auto const &stat : peephole_stats)
+      std::cout << "peephole " << stat.first << ": " << stat.second
+                << " rewrite(s).\n";
+    std::cout << asm_file << " written.\n";
+    link("cc -o " + exe_file + " " + asm_file + " bxrt.c", exe_file,
+         "Could not assemble and link successfully!\n");
+    return;
+  }
+  auto llvm_file = file_root + ".ll";
+  std::ofstream llvm_out;
+  llvm_out.open(llvm_file);
+  stats = stream_llvm(prog, options, pool, [&](LlvmProgram &code) {
+    for (auto const &l : code)
+      llvm_out << *l;
+  });
+  llvm_out.close();
+  report(stats);
+  std::cout << llvm_file << " written.\n";
+  link("/usr/local/llvm-6.0.1/bin/clang -o " + exe_file + " " + llvm_file +
+           " bxrt.c",
+       exe_file, "Could not run llvm-as successfully!\n");
+}
+
+} // namespace
+
 int main(int argc, char *argv[]) {
   const std::string rt_flags = "-L build -lbxrt -Wl,-rpath," +
                                std::filesystem::current_path().string() +
                                "/build/";
 
-  if (argc >= 2) {
-    std::string bx_file{argv[1]};
+  std::string bx_file;
+  Options options;
+  bool system_assembler = false;
+  bool run = false;
+  bool stream = false;
+  std::string parser = "antlr";
+  bool parse_only = false;
+  unsigned jobs = 0; // one thread per hardware thread
+  for (int i = 1; i < argc; i++) {
+    std::string arg{argv[i]};
+    auto value = arg.substr(arg.find('=') + 1);
+    if (arg == "--run")
+      run = true;
+    else if (arg == "--stream")
+      stream = true;
+    else if (arg == "--parse-only")
+      parse_only = true;
+    else if (arg.rfind("--parser=", 0) == 0) {
+      if (value != "handwritten" && value != "antlr" && value != "check") {
+        std::cerr << "Unknown parser: " << value << std::endl;
+        std::exit(1);
+      }
+      parser = value;
+    }
+    else if (arg.rfind("--inline-threshold=", 0) == 0)
+      options.inline_threshold = flag_value(arg, value, 0);
+    else if (arg.rfind("--backend=", 0) == 0) {
+      if (value != "native" && value != "llvm") {
+        std::cerr << "Unknown backend: " << value << std::endl;
+        std::exit(1);
+      }
+      options.native = value == "native";
+    } else if (arg.rfind("--assembler=", 0) == 0) {
+      if (value != "builtin" && value != "system") {
+        std::cerr << "Unknown assembler: " << value << std::endl;
+        std::exit(1);
+      }
+      system_assembler = value == "system";
+    } else if (arg.rfind("--regalloc=", 0) == 0) {
+      if (value != "color" && value != "linear") {
+        std::cerr << "Unknown register allocator: " << value << std::endl;
+        std::exit(1);
+      }
+      options.allocator = value == "linear" ? ertl::Allocator::LINEAR_SCAN
+                                            : ertl::Allocator::COLOR;
+    } else if (arg.rfind("--jobs=", 0) == 0)
+      jobs = flag_value(arg, value, 1);
+    else
+      bx_file = arg;
+  }
+
+  if (!bx_file.empty()) {
 
     if (bx_file.size() < 3 || bx_file.substr(bx_file.size() - 3, 3) != ".bx") {
       std::cerr << "Bad file name: " << bx_file << std::endl;
@@ -30,9 +174,47 @@ int main(int argc, char *argv[]) {
 
     auto file_root = bx_file.substr(0, bx_file.size() - 3);
 
-    auto prog = source::read_program(bx_file);
+    // The ANTLR parser, or the hand-written one, or both to check that they
+    // build the same program. ANTLR stays the default until `make tests` has
+    // compared the two on every regression test
+    auto start = std::chrono::steady_clock::now();
+    auto prog = parser == "antlr" ? source::read_program(bx_file)
+                                  : source::parse_file(bx_file);
+    if (parser == "check" &&
+        !source::same_program(prog, source::read_program(bx_file))) {
+      std::cerr << "The parsers disagree on " << bx_file << std::endl;
+      std::exit(1);
+    }
+    if (parse_only) {
+      std::chrono::duration<double> time =
+          std::chrono::steady_clock::now() - start;
+      auto bytes = std::filesystem::file_size(bx_file);
+      std::cout << bx_file << " parsed: " << bytes << " bytes in "
+                << time.count() << "s, " << bytes / time.count() / 1e6
+                << " MB/s.\n";
+      return 0;
+    }
+    WorkPool pool{jobs};
+    if (run) {
+      // Straight through the native backend, with nothing written out
+      check::type_check(prog, pool);
+      options.native = true;
+      if (stream) {
+        amd64::MachineCode mc;
+        stream_native(prog, options, pool, [&](AsmProgram &code) {
+          amd64::peephole(code);
+          mc.append(amd64::encode(code));
+        });
+        amd64::run(mc);
+        return 0;
+      }
+      auto asm_prog = compile(prog, options, pool).asm_prog;
+      amd64::peephole(asm_prog);
+      amd64::run(asm_prog);
+      return 0;
+    }
     {
-      check::type_check(prog);
+      check::type_check(prog, pool);
       std::cout << bx_file << " parsed and type checked.\n";
       auto p_file = file_root + ".parsed";
       std::ofstream p_out;
@@ -42,7 +224,13 @@ int main(int argc, char *argv[]) {
       std::cout << p_file << " written.\n";
     }
 
-    auto rtl_prog = rtl::transform(prog);
+    if (stream) {
+      compile_streaming(prog, options, pool, system_assembler, file_root);
+      return 0;
+    }
+    auto compiled = compile(prog, options, pool);
+    std::cout << "rtl cfg: " << compiled.rtl_simplified
+              << " instruction(s) removed or rewritten.\n";
     {
       auto rtl_file = file_root + ".rtl";
       std::ofstream rtl_out;
@@ -50,12 +238,14 @@ int main(int argc, char *argv[]) {
       for (auto const &gv : prog.global_vars)
         rtl_out << "GLOBAL " << gv.first << " = " << *(gv.second->init) << " : "
                 << gv.second->ty << "\n\n";
-      for (auto const &rtl_cbl : rtl_prog)
+      for (auto const &rtl_cbl : compiled.rtl)
         rtl_out << rtl_cbl << '\n';
       rtl_out.close();
       std::cout << rtl_file << " written.\n";
     }
-    auto ssa_prog = blocks_generate(prog.global_vars, rtl_prog);
+    for (auto const &stat : compiled.stats)
+      std::cout << "ssa " << stat.first << ": " << stat.second
+                << " instruction(s) removed or rewritten.\n";
     {
       auto ssa_file = file_root + ".ssa";
       std::ofstream ssa_out;
@@ -63,12 +253,45 @@ int main(int argc, char *argv[]) {
       for (auto const &gv : prog.global_vars)
         ssa_out << "GLOBAL " << gv.first << " = " << *(gv.second->init) << " : "
                 << gv.second->ty << "\n\n";
-      for (auto const &ssa_cbl : ssa_prog)
+      for (auto const &ssa_cbl : compiled.ssa)
         ssa_out << ssa_cbl << '\n';
       ssa_out.close();
       std::cout << ssa_file << " written.\n";
     }
-    auto llvm_prog = llvm_generate(prog.global_vars, ssa_prog);
+    auto exe_file = file_root + ".exe";
+    if (options.native) {
+      {
+        auto ertl_file = file_root + ".ertl";
+        std::ofstream ertl_out;
+        ertl_out.open(ertl_file);
+        for (auto const &ertl_cbl : compiled.ertl)
+          ertl_out << ertl_cbl << '\n';
+        ertl_out.close();
+        std::cout << ertl_file << " written.\n";
+      }
+      auto &asm_prog = compiled.asm_prog;
+      for (auto const &stat : amd64::peephole(asm_prog))
+        std::cout << "peephole " << stat.first << ": " << stat.second
+                  << " rewrite(s).\n";
+      // The built-in assembler writes the object file directly; the system
+      // one is handed the assembly text
+      auto asm_file = file_root + (system_assembler ? ".s" : ".o");
+      {
+        std::ofstream asm_out;
+        asm_out.open(asm_file, std::ios::binary);
+        if (system_assembler)
+          for (auto const &l : asm_prog)
+            asm_out << *l;
+        else
+          amd64::write_object(asm_out, asm_prog);
+        asm_out.close();
+        std::cout << asm_file << " written.\n";
+      }
+      link("cc -o " + exe_file + " " + asm_file + " bxrt.c", exe_file,
+           "Could not assemble and link successfully!\n");
+      return 0;
+    }
+    auto const &llvm_prog = compiled.llvm_prog;
     auto llvm_file = file_root + ".ll";
     {
       std::ofstream llvm_out;
@@ -78,13 +301,8 @@ int main(int argc, char *argv[]) {
       llvm_out.close();
       std::cout << llvm_file << " written.\n";
     }
-    auto exe_file = file_root + ".exe";
-    std::string cmd = "/usr/local/llvm-6.0.1/bin/clang -o " + exe_file + " " + llvm_file + " bxrt.c";
-    std::cout << "Running: " << cmd << std::endl;
-    if (std::system(cmd.c_str()) != 0) {
-      std::cerr << "Could not run llvm-as successfully!\n";
-      std::exit(2);
-    }  
-    std::cout << exe_file << " created.\n";
+    link("/usr/local/llvm-6.0.1/bin/clang -o " + exe_file + " " + llvm_file +
+             " bxrt.c",
+         exe_file, "Could not run llvm-as successfully!\n");
   }
 }
@@ -0,0 +1,608 @@
+/**
+ * This file parses BX source text by hand, without ANTLR
+ *
+ * It accepts the language of BX.g4 and builds the same source::Program as
+ * read_program() does from the ANTLR parse tree, so that the two can be
+ * checked against each other (see --parser=check in main.cpp).
+ *
+ * The lexer hands out one token at a time as a string_view into the source
+ * text, so nothing is allocated before the AST itself. The parser is
+ * recursive descent for declarations and statements, and precedence
+ * climbing for the binary operators, which are all left associative.
+ *
+ * Classes:
+ *
+ *     bx::source::Lexer:
+ *         The tokens of BX.g4, one at a time
+ *
+ *     bx::source::Parser:
+ *         The rules of BX.g4, building the AST on the way
+ *
+ *  Functions
+ *
+ *     Program bx::source::parse_program(text)
+ *     Program bx::source::parse_file(file)
+ *         The main parsing functions
+ *
+ *     bool bx::source::same_program(prog1, prog2)
+ *         Whether two parsers agree
+ */
+
+#include <charconv>
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <stdexcept>
+#include <typeinfo>
+
+#include "ast.h"
+
+namespace bx {
+namespace source {
+
+namespace {
+
+enum class Tok : std::uint8_t {
+  // clang-format off
+  END, ID, NUM,
+  // keywords
+  VAR, PROC, FUN, INT64, BOOL, PRINT, IF, ELSE, WHILE, RETURN, TRUE, FALSE,
+  // punctuation
+  LPAREN, RPAREN, LBRACE, RBRACE, COMMA, COLON, SEMI, ASSIGN,
+  // operators
+  TILDE, BANG, STAR, SLASH, PERCENT, PLUS, MINUS, SHL, SHR,
+  LT, LEQ, GT, GEQ, EQ, NEQ, AMP, CARET, BAR, AND, OR,
+  // clang-format on
+};
+
+struct Token {
+  Tok kind;
+  std::string_view text;
+  int line, column;
+};
+
+class Lexer {
+public:
+  explicit Lexer(std::string_view src) : src{src} {}
+
+  Token next() {
+    skip_blanks();
+    Token tok{Tok::END, {}, line, static_cast<int>(pos - line_start) + 1};
+    if (pos == src.size())
+      return tok;
+    auto start = pos;
+    char c = src[pos++];
+    auto is_digit = [](char d) { return d >= '0' && d <= '9'; };
+    if (is_id_start(c)) {
+      while (pos < src.size() && is_id_char(src[pos]))
+        pos++;
+      tok.text = src.substr(start, pos - start);
+      tok.kind = keyword(tok.text);
+      return tok;
+    }
+    // NUM: '-'? [0-9]+, which wins over '-' when a digit follows
+    if (is_digit(c) || (c == '-' && pos < src.size() && is_digit(src[pos]))) {
+      while (pos < src.size() && is_digit(src[pos]))
+        pos++;
+      tok.kind = Tok::NUM;
+      tok.text = src.substr(start, pos - start);
+      return tok;
+    }
+    auto two = [&](char second, Tok yes, Tok no) {
+      if (pos < src.size() && src[pos] == second) {
+        pos++;
+        return yes;
+      }
+      return no;
+    };
+    switch (c) {
+      // clang-format off
+    case '(': tok.kind = Tok::LPAREN; break;
+    case ')': tok.kind = Tok::RPAREN; break;
+    case '{': tok.kind = Tok::LBRACE; break;
+    case '}': tok.kind = Tok::RBRACE; break;
+    case ',': tok.kind = Tok::COMMA; break;
+    case ':': tok.kind = Tok::COLON; break;
+    case ';': tok.kind = Tok::SEMI; break;
+    case '~': tok.kind = Tok::TILDE; break;
+    case '*': tok.kind = Tok::STAR; break;
+    case '/': tok.kind = Tok::SLASH; break;
+    case '%': tok.kind = Tok::PERCENT; break;
+    case '+': tok.kind = Tok::PLUS; break;
+    case '-': tok.kind = Tok::MINUS; break;
+    case '^': tok.kind = Tok::CARET; break;
+    case '=': tok.kind = two('=', Tok::EQ, Tok::ASSIGN); break;
+    case '!': tok.kind = two('=', Tok::NEQ, Tok::BANG); break;
+    case '&': tok.kind = two('&', Tok::AND, Tok::AMP); break;
+    case '|': tok.kind = two('|', Tok::OR, Tok::BAR); break;
+      // clang-format on
+    case '<':
+      tok.kind = two('<', Tok::SHL, Tok::LT);
+      if (tok.kind == Tok::LT)
+        tok.kind = two('=', Tok::LEQ, Tok::LT);
+      break;
+    case '>':
+      tok.kind = two('>', Tok::SHR, Tok::GT);
+      if (tok.kind == Tok::GT)
+        tok.kind = two('=', Tok::GEQ, Tok::GT);
+      break;
+    default:
+      throw std::runtime_error(position(tok) + "unexpected character '" +
+                               std::string(1, c) + "'");
+    }
+    tok.text = src.substr(start, pos - start);
+    return tok;
+  }
+
+  static std::string position(Token const &tok) {
+    return "line " + std::to_string(tok.line) + ", column " +
+           std::to_string(tok.column) + ": ";
+  }
+
+private:
+  std::string_view src;
+  std::size_t pos = 0, line_start = 0;
+  int line = 1;
+
+  static bool is_id_start(char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_';
+  }
+
+  static bool is_id_char(char c) {
+    return is_id_start(c) || (c >= '0' && c <= '9');
+  }
+
+  /** Whitespace and // comments */
+  void skip_blanks() {
+    while (pos < src.size()) {
+      char c = src[pos];
+      if (c == '\n') {
+        pos++;
+        line++;
+        line_start = pos;
+      } else if (c == ' ' || c == '\t' || c == '\r')
+        pos++;
+      else if (c == '/' && pos + 1 < src.size() && src[pos + 1] == '/')
+        while (pos < src.size() && src[pos] != '\n')
+          pos++;
+      else
+        return;
+    }
+  }
+
+  static Tok keyword(std::string_view id) {
+    static constexpr std::pair<std::string_view, Tok> keywords[] = {
+        {"var", Tok::VAR},         {"proc", Tok::PROC},   {"fun", Tok::FUN},
+        {"int64", Tok::INT64},     {"bool", Tok::BOOL},   {"print", Tok::PRINT},
+        {"if", Tok::IF},           {"else", Tok::ELSE},   {"while", Tok::WHILE},
+        {"return", Tok::RETURN},   {"true", Tok::TRUE},   {"false", Tok::FALSE},
+    };
+    for (auto const &kw : keywords)
+      if (kw.first == id)
+        return kw.second;
+    return Tok::ID;
+  }
+};
+
+class Parser {
+public:
+  explicit Parser(std::string_view src) : lexer{src} { advance(); }
+
+  Program program() {
+    Program::CallTable callables;
+    Program::GlobalVarTable global_vars;
+    auto check_unique_name = [&](auto const &name) {
+      if (global_vars.find(name) != global_vars.end())
+        throw std::runtime_error("Redeclaration of existing global var " +
+                                 name);
+      if (callables.find(name) != callables.end())
+        throw std::runtime_error("Redeclaration of existing callable " + name +
+                                 "()");
+    };
+    while (tok.kind != Tok::END) {
+      if (tok.kind == Tok::VAR) {
+        for (auto &v : global_var()) {
+          check_unique_name(v->name);
+          global_vars.insert_or_assign(v->name, std::move(v));
+        }
+      } else if (tok.kind == Tok::PROC || tok.kind == Tok::FUN) {
+        auto c = callable();
+        check_unique_name(c->name);
+        callables.insert_or_assign(c->name, std::move(c));
+      } else
+        error("var, proc or fun");
+    }
+    return Program{std::move(global_vars), std::move(callables)};
+  }
+
+private:
+  Lexer lexer;
+  Token tok, ahead;
+  bool has_ahead = false;
+
+  void advance() {
+    if (has_ahead) {
+      tok = ahead;
+      has_ahead = false;
+    } else
+      tok = lexer.next();
+  }
+
+  Token const &peek() {
+    if (!has_ahead) {
+      ahead = lexer.next();
+      has_ahead = true;
+    }
+    return ahead;
+  }
+
+  [[noreturn]] void error(char const *expected) {
+    throw std::runtime_error(
+        Lexer::position(tok) + "expected " + expected + ", found " +
+        (tok.kind == Tok::END ? std::string{"end of input"}
+                              : "'" + std::string{tok.text} + "'"));
+  }
+
+  std::string_view expect(Tok kind, char const *what) {
+    if (tok.kind != kind)
+      error(what);
+    auto text = tok.text;
+    advance();
+    return text;
+  }
+
+  bool accept(Tok kind) {
+    if (tok.kind != kind)
+      return false;
+    advance();
+    return true;
+  }
+
+  // Declarations
+
+  std::vector<GlobalVarPtr> global_var() {
+    expect(Tok::VAR, "'var'");
+    std::vector<std::pair<std::string, ExprPtr>> inits;
+    do {
+      std::string name{expect(Tok::ID, "a variable")};
+      expect(Tok::ASSIGN, "'='");
+      ExprPtr init;
+      if (tok.kind == Tok::NUM)
+        init = number();
+      else if (tok.kind == Tok::TRUE || tok.kind == Tok::FALSE)
+        init = boolean();
+      else
+        error("a number or a boolean");
+      inits.emplace_back(std::move(name), std::move(init));
+    } while (accept(Tok::COMMA));
+    expect(Tok::COLON, "':'");
+    Type ty = type();
+    expect(Tok::SEMI, "';'");
+    std::vector<GlobalVarPtr> vars;
+    for (auto &init : inits)
+      vars.push_back(GlobalVar::make(init.first, ty, std::move(init.second)));
+    return vars;
+  }
+
+  CallablePtr callable() {
+    bool is_func = tok.kind == Tok::FUN;
+    advance();
+    std::string name{expect(Tok::ID, "a name")};
+    expect(Tok::LPAREN, "'('");
+    Callable::Params params;
+    if (tok.kind != Tok::RPAREN)
+      do {
+        auto first = params.size();
+        do
+          params.emplace_back(expect(Tok::ID, "a parameter"), Type::UNKNOWN);
+        while (accept(Tok::COMMA));
+        expect(Tok::COLON, "':'");
+        Type ty = type();
+        for (auto i = first; i < params.size(); i++)
+          params[i].second = ty;
+      } while (accept(Tok::COMMA));
+    expect(Tok::RPAREN, "')'");
+    if (!is_func)
+      return Callable::make(name, std::move(params), block());
+    expect(Tok::COLON, "':'");
+    Type ty = type();
+    return Callable::make(name, std::move(params), block(), ty);
+  }
+
+  Type type() {
+    if (accept(Tok::INT64))
+      return Type::INT64;
+    if (accept(Tok::BOOL))
+      return Type::BOOL;
+    error("a type");
+  }
+
+  // Statements
+
+  BlockPtr block() {
+    expect(Tok::LBRACE, "'{'");
+    std::vector<StmtPtr> body;
+    while (!accept(Tok::RBRACE))
+      stmt(body);
+    return Block::make(body);
+  }
+
+  /** Adds the statement to body, or the declarations if there are several */
+  void stmt(std::vector<StmtPtr> &body) {
+    switch (tok.kind) {
+    case Tok::ID:
+      if (peek().kind == Tok::ASSIGN) {
+        std::string left{tok.text};
+        advance();
+        advance();
+        body.push_back(Assign::make(left, expr()));
+        break;
+      }
+      body.push_back(Eval::make(expr()));
+      break;
+    case Tok::VAR: {
+      advance();
+      std::vector<std::pair<std::string, ExprPtr>> inits;
+      do {
+        std::string name{expect(Tok::ID, "a variable")};
+        expect(Tok::ASSIGN, "'='");
+        inits.emplace_back(std::move(name), expr());
+      } while (accept(Tok::COMMA));
+      expect(Tok::COLON, "':'");
+      Type ty = type();
+      for (auto &init : inits)
+        body.push_back(Declare::make(init.first, ty, std::move(init.second)));
+    } break;
+    case Tok::PRINT:
+      advance();
+      body.push_back(Print::make(expr()));
+      break;
+    case Tok::LBRACE:
+      body.push_back(block());
+      return;
+    case Tok::IF:
+      body.push_back(if_else());
+      return;
+    case Tok::WHILE: {
+      advance();
+      expect(Tok::LPAREN, "'('");
+      auto condition = expr();
+      expect(Tok::RPAREN, "')'");
+      body.push_back(While::make(std::move(condition), block()));
+    }
+      return;
+    case Tok::RETURN:
+      advance();
+      body.push_back(
+          Return::make(tok.kind == Tok::SEMI ? ExprPtr{nullptr} : expr()));
+      break;
+    default:
+      body.push_back(Eval::make(expr()));
+      break;
+    }
+    expect(Tok::SEMI, "';'");
+  }
+
+  IfElsePtr if_else() {
+    expect(Tok::IF, "'if'");
+    expect(Tok::LPAREN, "'('");
+    auto condition = expr();
+    expect(Tok::RPAREN, "')'");
+    auto then_block = block();
+    StmtPtr else_block = Block::make();
+    if (accept(Tok::ELSE))
+      else_block = tok.kind == Tok::IF ? StmtPtr{if_else()} : block();
+    return IfElse::make(std::move(condition), std::move(then_block),
+                        std::move(else_block));
+  }
+
+  // Expressions
+
+  /** The binary operator of a token, and how tightly it binds, if any */
+  static int binop(Tok kind, Binop &op) {
+    switch (kind) {
+      // clang-format off
+    case Tok::STAR: op = Binop::Multiply; return 10;
+    case Tok::SLASH: op = Binop::Divide; return 10;
+    case Tok::PERCENT: op = Binop::Modulus; return 10;
+    case Tok::PLUS: op = Binop::Add; return 9;
+    case Tok::MINUS: op = Binop::Subtract; return 9;
+    case Tok::SHL: op = Binop::Lshift; return 8;
+    case Tok::SHR: op = Binop::Rshift; return 8;
+    case Tok::LT: op = Binop::Lt; return 7;
+    case Tok::LEQ: op = Binop::Leq; return 7;
+    case Tok::GT: op = Binop::Gt; return 7;
+    case Tok::GEQ: op = Binop::Geq; return 7;
+    case Tok::EQ: op = Binop::Eq; return 6;
+    case Tok::NEQ: op = Binop::Neq; return 6;
+    case Tok::AMP: op = Binop::BitAnd; return 5;
+    case Tok::CARET: op = Binop::BitXor; return 4;
+    case Tok::BAR: op = Binop::BitOr; return 3;
+    case Tok::AND: op = Binop::BoolAnd; return 2;
+    case Tok::OR: op = Binop::BoolOr; return 1;
+    default: return 0;
+      // clang-format on
+    }
+  }
+
+  /** An expression of operators that bind at least as tightly as min_prec */
+  ExprPtr expr(int min_prec = 1) {
+    auto left = unary();
+    Binop op{};
+    for (int prec; (prec = binop(tok.kind, op)) >= min_prec;) {
+      advance();
+      left = BinopApp::make(std::move(left), op, expr(prec + 1));
+    }
+    return left;
+  }
+
+  /** The unary operators bind more tightly than any binary one */
+  ExprPtr unary() {
+    Unop op;
+    switch (tok.kind) {
+      // clang-format off
+    case Tok::TILDE: op = Unop::BitNot; break;
+    case Tok::MINUS: op = Unop::Negate; break;
+    case Tok::BANG: op = Unop::LogNot; break;
+    default: return primary();
+      // clang-format on
+    }
+    advance();
+    return UnopApp::make(op, unary());
+  }
+
+  ExprPtr primary() {
+    switch (tok.kind) {
+    case Tok::ID: {
+      std::string name{tok.text};
+      advance();
+      if (!accept(Tok::LPAREN))
+        return Variable::make(name);
+      std::vector<ExprPtr> args;
+      if (tok.kind != Tok::RPAREN)
+        do
+          args.push_back(expr());
+        while (accept(Tok::COMMA));
+      expect(Tok::RPAREN, "')'");
+      return Call::make(name, args);
+    }
+    case Tok::NUM:
+      return number();
+    case Tok::TRUE:
+    case Tok::FALSE:
+      return boolean();
+    case Tok::LPAREN: {
+      advance();
+      auto e = expr();
+      expect(Tok::RPAREN, "')'");
+      return e;
+    }
+    default:
+      error("an expression");
+    }
+  }
+
+  ExprPtr number() {
+    std::int64_t value;
+    auto text = tok.text;
+    auto res = std::from_chars(text.data(), text.data() + text.size(), value);
+    if (res.ec != std::errc{})
+      throw std::runtime_error(Lexer::position(tok) + "number " +
+                               std::string{text} + " out of range");
+    advance();
+    return IntConstant::make(value);
+  }
+
+  ExprPtr boolean() {
+    bool value = tok.kind == Tok::TRUE;
+    advance();
+    return BoolConstant::make(value);
+  }
+};
+
+bool same(ExprPtr const &a, ExprPtr const &b);
+bool same(StmtPtr const &a, StmtPtr const &b);
+
+template <typename T, typename U>
+bool same_all(std::vector<T> const &a, std::vector<U> const &b) {
+  if (a.size() != b.size())
+    return false;
+  for (std::size_t i = 0; i < a.size(); i++)
+    if (!same(a[i], b[i]))
+      return false;
+  return true;
+}
+
+bool same(ExprPtr const &a, ExprPtr const &b) {
+  if (!a || !b)
+    return !a && !b;
+  if (typeid(*a) != typeid(*b))
+    return false;
+  if (auto x = dynamic_cast<Variable const *>(a.get()))
+    return x->label == static_cast<Variable const &>(*b).label;
+  if (auto x = dynamic_cast<IntConstant const *>(a.get()))
+    return x->value == static_cast<IntConstant const &>(*b).value;
+  if (auto x = dynamic_cast<BoolConstant const *>(a.get()))
+    return x->value == static_cast<BoolConstant const &>(*b).value;
+  if (auto x = dynamic_cast<UnopApp const *>(a.get())) {
+    auto const &y = static_cast<UnopApp const &>(*b);
+    return x->op == y.op && same(x->arg, y.arg);
+  }
+  if (auto x = dynamic_cast<BinopApp const *>(a.get())) {
+    auto const &y = static_cast<BinopApp const &>(*b);
+    return x->op == y.op && same(x->left_arg, y.left_arg) &&
+           same(x->right_arg, y.right_arg);
+  }
+  auto const &x = dynamic_cast<Call const &>(*a);
+  auto const &y = static_cast<Call const &>(*b);
+  return x.func == y.func && same_all(x.args, y.args);
+}
+
+bool same(StmtPtr const &a, StmtPtr const &b) {
+  if (typeid(*a) != typeid(*b))
+    return false;
+  if (auto x = dynamic_cast<Assign const *>(a.get())) {
+    auto const &y = static_cast<Assign const &>(*b);
+    return x->left == y.left && same(x->right, y.right);
+  }
+  if (auto x = dynamic_cast<Eval const *>(a.get()))
+    return same(x->expr, static_cast<Eval const &>(*b).expr);
+  if (auto x = dynamic_cast<Print const *>(a.get()))
+    return same(x->arg, static_cast<Print const &>(*b).arg);
+  if (auto x = dynamic_cast<Block const *>(a.get()))
+    return same_all(x->body, static_cast<Block const &>(*b).body);
+  if (auto x = dynamic_cast<IfElse const *>(a.get())) {
+    auto const &y = static_cast<IfElse const &>(*b);
+    return same(x->condition, y.condition) &&
+           same(x->true_branch, y.true_branch) &&
+           same(x->false_branch, y.false_branch);
+  }
+  if (auto x = dynamic_cast<While const *>(a.get())) {
+    auto const &y = static_cast<While const &>(*b);
+    return same(x->condition, y.condition) && same(x->loop_body, y.loop_body);
+  }
+  if (auto x = dynamic_cast<Declare const *>(a.get())) {
+    auto const &y = static_cast<Declare const &>(*b);
+    return x->var == y.var && x->ty == y.ty && same(x->init, y.init);
+  }
+  return same(dynamic_cast<Return const &>(*a).arg,
+              static_cast<Return const &>(*b).arg);
+}
+
+} // namespace
+
+bool same_program(Program const &a, Program const &b) {
+  if (a.global_vars.size() != b.global_vars.size() ||
+      a.callables.size() != b.callables.size())
+    return false;
+  for (auto const &gv : a.global_vars) {
+    auto other = b.global_vars.find(gv.first);
+    if (other == b.global_vars.end() || gv.second->ty != other->second->ty ||
+        !same(gv.second->init, other->second->init))
+      return false;
+  }
+  for (auto const &cbl : a.callables) {
+    auto other = b.callables.find(cbl.first);
+    if (other == b.callables.end())
+      return false;
+    auto const &x = *cbl.second, &y = *other->second;
+    if (x.args != y.args || x.return_ty != y.return_ty ||
+        !same_all(x.body->body, y.body->body))
+      return false;
+  }
+  return true;
+}
+
+Program parse_program(std::string_view text) { return Parser{text}.program(); }
+
+Program parse_file(std::string const &file) {
+  std::ifstream stream{file, std::ios::binary};
+  if (!stream)
+    throw std::runtime_error("Cannot open " + file);
+  std::ostringstream text;
+  text << stream.rdbuf();
+  return parse_program(text.str());
+}
+
+} // namespace source
+} // namespace bx
@@ -0,0 +1,288 @@
+/**
+ * This file runs the callables through the compiler on a WorkPool
+ *
+ *  Functions
+ *
+ *     Compilation bx::compile(prog, options, pool)
+ *         The whole compilation from the AST on
+ *
+ *     StreamStats bx::stream_native(prog, options, pool, sink)
+ *     StreamStats bx::stream_llvm(prog, options, pool, sink)
+ *         The same, handing the code to the sink a few callables at a time
+ */
+
+#include <algorithm>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "ast_rtl.h"
+#include "pipeline.h"
+#include "rtl_cfg.h"
+#include "rtl_ertl.h"
+#include "rtl_ssa.h"
+#include "ssa_rtl.h"
+
+namespace bx {
+
+namespace {
+
+/** A callable from the source up to inlining, which needs the other callables */
+ssa::Callable to_ssa(source::Program const &prog, std::string const &name,
+                     int &simplified, int &tailcalls) {
+  auto rtl_cbl = rtl::transform(prog, name);
+  simplified = rtl::simplify_cfg(rtl_cbl);
+  auto ssa_cbl = blocks_generate(prog.global_vars, rtl_cbl);
+  tailcalls = ssa::eliminate_tail_calls(ssa_cbl);
+  return ssa_cbl;
+}
+
+/** The callables that a callable calls, read off its AST */
+class CallSites : public source::StmtVisitor, public source::ExprVisitor {
+public:
+  std::vector<std::string> callees;
+
+  void visit(source::Assign const &mv) override { mv.right->accept(*this); }
+
+  void visit(source::Declare const &dec) override { dec.init->accept(*this); }
+
+  void visit(source::Eval const &e) override { e.expr->accept(*this); }
+
+  void visit(source::Print const &pr) override { pr.arg->accept(*this); }
+
+  void visit(source::Block const &bl) override {
+    for (auto const &stmt : bl.body)
+      stmt->accept(*this);
+  }
+
+  void visit(source::IfElse const &ie) override {
+    ie.condition->accept(*this);
+    ie.true_branch->accept(*this);
+    ie.false_branch->accept(*this);
+  }
+
+  void visit(source::While const &wl) override {
+    wl.condition->accept(*this);
+    wl.loop_body->accept(*this);
+  }
+
+  void visit(source::Return const &ret) override {
+    if (ret.arg)
+      ret.arg->accept(*this);
+  }
+
+  void visit(source::Variable const &) override {}
+
+  void visit(source::IntConstant const &) override {}
+
+  void visit(source::BoolConstant const &) override {}
+
+  void visit(source::UnopApp const &uo) override { uo.arg->accept(*this); }
+
+  void visit(source::BinopApp const &bo) override {
+    bo.left_arg->accept(*this);
+    bo.right_arg->accept(*this);
+  }
+
+  void visit(source::Call const &ca) override {
+    callees.push_back(ca.func);
+    for (auto const &arg : ca.args)
+      arg->accept(*this);
+  }
+};
+
+/** The call graph of the source program, for the streaming inliner */
+struct CallGraph {
+  std::unordered_map<std::string, int> index; // position in names
+  std::vector<std::vector<int>> calls;
+  // A callee in the same component as its caller is not inlined, as
+  // ssa::inline_calls would not inline it either
+  std::vector<int> component;
+};
+
+CallGraph call_graph(source::Program const &prog,
+                     std::vector<std::string> const &names) {
+  CallGraph graph;
+  for (std::size_t i = 0; i < names.size(); i++)
+    graph.index[names[i]] = static_cast<int>(i);
+  graph.calls.resize(names.size());
+  for (std::size_t i = 0; i < names.size(); i++) {
+    CallSites sites;
+    prog.callables.at(names[i])->body->accept(sites);
+    for (auto const &callee : sites.callees) {
+      auto it = graph.index.find(callee);
+      if (it != graph.index.end())
+        graph.calls[i].push_back(it->second);
+    }
+  }
+  graph.component.resize(names.size());
+  auto sccs = ssa::call_graph_sccs(graph.calls);
+  for (std::size_t c = 0; c < sccs.size(); c++)
+    for (auto i : sccs[c])
+      graph.component[i] = static_cast<int>(c);
+  return graph;
+}
+
+/**
+ * Compile the callables in batches of pool.size(), handing the code of each
+ * batch to emit in program order before the next batch is compiled
+ */
+template <typename Code, typename Backend, typename Emit>
+StreamStats stream(source::Program const &prog, Options const &options,
+                   WorkPool &pool, Backend const &backend, Emit const &emit) {
+  std::vector<std::string> names;
+  for (auto const &cbl : prog.callables)
+    names.push_back(cbl.first);
+  auto graph = call_graph(prog, names);
+
+  StreamStats out;
+  out.stats["tailcall"] = 0;
+  out.stats["inline"] = 0;
+  std::size_t width = pool.size();
+  for (std::size_t first = 0; first < names.size(); first += width) {
+    std::size_t n = std::min(width, names.size() - first);
+
+    // The callees the batch may inline, each compiled once for all of its
+    // callers in the batch
+    std::vector<int> wanted;
+    std::unordered_map<int, std::size_t> slot;
+    for (std::size_t i = first; i < first + n; i++)
+      for (int callee : graph.calls[i])
+        if (graph.component[callee] != graph.component[i] &&
+            slot.emplace(callee, wanted.size()).second)
+          wanted.push_back(callee);
+    std::vector<ssa::Callable> callees;
+    for (int callee : wanted)
+      callees.emplace_back(names[callee]);
+    pool.run(wanted.size(), [&](std::size_t i) {
+      int ignored;
+      callees[i] = to_ssa(prog, names[wanted[i]], ignored, ignored);
+    });
+
+    std::vector<int> simplified(n, 0);
+    std::vector<ssa::PassStats> stats(n);
+    std::vector<Code> code(n);
+    pool.run(n, [&](std::size_t i) {
+      auto const &name = names[first + i];
+      auto cbl = to_ssa(prog, name, simplified[i], stats[i]["tailcall"]);
+      auto lookup = [&](std::string const &callee) -> ssa::Callable const * {
+        auto it = graph.index.find(callee);
+        if (it == graph.index.end() ||
+            graph.component[it->second] == graph.component[first + i])
+          return nullptr;
+        return &callees[slot.at(it->second)];
+      };
+      stats[i]["inline"] =
+          ssa::inline_calls(cbl, lookup, options.inline_threshold);
+      ssa::optimize(cbl, stats[i]);
+      code[i] = backend(cbl);
+    });
+    for (std::size_t i = 0; i < n; i++) {
+      out.rtl_simplified += simplified[i];
+      for (auto const &stat : stats[i])
+        out.stats[stat.first] += stat.second;
+      emit(code[i]);
+    }
+  }
+  return out;
+}
+
+} // namespace
+
+Compilation compile(source::Program const &prog, Options const &options,
+                    WorkPool &pool) {
+  auto const &global_vars = prog.global_vars;
+  Compilation out;
+  std::vector<std::string> names;
+  for (auto const &cbl : prog.callables) {
+    names.push_back(cbl.first);
+    out.rtl.emplace_back(cbl.first);
+    out.ssa.emplace_back(cbl.first);
+    if (options.native)
+      out.ertl.emplace_back(cbl.first);
+  }
+  auto n = names.size();
+
+  // Up to inlining
+  std::vector<int> simplified(n, 0), tailcalls(n, 0);
+  pool.run(n, [&](std::size_t i) {
+    out.rtl[i] = rtl::transform(prog, names[i]);
+    simplified[i] = rtl::simplify_cfg(out.rtl[i]);
+    out.ssa[i] = blocks_generate(global_vars, out.rtl[i]);
+    tailcalls[i] = ssa::eliminate_tail_calls(out.ssa[i]);
+  });
+  out.stats["tailcall"] = 0;
+  for (std::size_t i = 0; i < n; i++) {
+    out.rtl_simplified += simplified[i];
+    out.stats["tailcall"] += tailcalls[i];
+  }
+  out.stats["inline"] = ssa::inline_calls(out.ssa, options.inline_threshold);
+
+  // The rest of the middle end and the backend
+  std::vector<ssa::PassStats> stats(n);
+  std::vector<AsmProgram> asm_code(n);
+  std::vector<LlvmProgram> llvm_code(n);
+  LlvmTypes types;
+  if (!options.native)
+    types = llvm_types(out.ssa);
+  pool.run(n, [&](std::size_t i) {
+    ssa::optimize(out.ssa[i], stats[i]);
+    if (options.native) {
+      auto lowered = rtl_generate(out.ssa[i]);
+      rtl::simplify_cfg(lowered);
+      out.ertl[i] = make_explicit(global_vars, lowered);
+      asm_code[i] = asm_generate(global_vars, out.ertl[i], options.allocator);
+    } else {
+      llvm_code[i] = llvm_generate(global_vars, out.ssa[i], types);
+    }
+  });
+  for (auto const &s : stats)
+    for (auto const &stat : s)
+      out.stats[stat.first] += stat.second;
+
+  if (options.native) {
+    out.asm_prog = asm_globals(global_vars);
+    for (auto &code : asm_code)
+      for (auto &line : code)
+        out.asm_prog.push_back(std::move(line));
+    for (auto &line : asm_end())
+      out.asm_prog.push_back(std::move(line));
+  } else {
+    out.llvm_prog = llvm_globals(global_vars);
+    for (auto &code : llvm_code)
+      for (auto &line : code)
+        out.llvm_prog.push_back(std::move(line));
+  }
+  return out;
+}
+
+StreamStats stream_native(source::Program const &prog, Options const &options,
+                          WorkPool &pool, AsmSink const &sink) {
+  auto const &global_vars = prog.global_vars;
+  auto globals = asm_globals(global_vars);
+  sink(globals);
+  auto backend = [&](ssa::Callable &cbl) {
+    auto lowered = rtl_generate(cbl);
+    rtl::simplify_cfg(lowered);
+    return asm_generate(global_vars, make_explicit(global_vars, lowered),
+                        options.allocator);
+  };
+  auto out = stream<AsmProgram>(prog, options, pool, backend, sink);
+  auto end = asm_end();
+  sink(end);
+  return out;
+}
+
+StreamStats stream_llvm(source::Program const &prog, Options const &options,
+                        WorkPool &pool, LlvmSink const &sink) {
+  auto const &global_vars = prog.global_vars;
+  auto globals = llvm_globals(global_vars);
+  sink(globals);
+  auto types = llvm_types(prog);
+  auto backend = [&](ssa::Callable &cbl) {
+    return llvm_generate(global_vars, cbl, types);
+  };
+  return stream<LlvmProgram>(prog, options, pool, backend, sink);
+}
+
+} // namespace bx
@@ -0,0 +1,78 @@
+#pragma once
+
+/**
+ * The compiler from the type checked AST on, one callable at a time
+ *
+ * Every callable goes through the stages as one task of a WorkPool: to RTL,
+ * to SSA and the optimisations that only look at the callable, and on to
+ * LLVM or, back through RTL and then ERTL, to amd64. Inlining needs all the
+ * callables in SSA form at once, so it runs on its own between the two
+ * batches. Labels and pseudos are numbered per callable (see rtl::Numbering),
+ * so the output is the same for any number of threads.
+ */
+
+#include <functional>
+
+#include "ast.h"
+#include "ertl_alloc.h"
+#include "ertl_asm.h"
+#include "rtl.h"
+#include "ssa.h"
+#include "ssa_llvm.h"
+#include "ssa_opt.h"
+#include "work_pool.h"
+
+namespace bx {
+
+struct Options {
+  bool native = false;
+  ertl::Allocator allocator = ertl::Allocator::COLOR;
+  int inline_threshold = ssa::default_inline_threshold;
+};
+
+/** The program at every level that gets written out */
+struct Compilation {
+  rtl::Program rtl;       // from the AST, after rtl::simplify_cfg
+  int rtl_simplified = 0; // instructions rtl::simplify_cfg removed or rewrote
+  ssa::Program ssa;       // optimised
+  ssa::PassStats stats;
+  ertl::Program ertl;     // native backend, before register allocation
+  AsmProgram asm_prog;    // native backend, before the peephole optimiser
+  LlvmProgram llvm_prog;  // LLVM backend
+};
+
+Compilation compile(source::Program const &prog, Options const &options,
+                    WorkPool &pool);
+
+/**
+ * Streaming compilation, for programs too large to hold at every level at
+ * once. The callables are compiled in program order, one batch of as many as
+ * the pool has threads at a time, and the code of each is handed to the sink
+ * and dropped before the next batch starts. Memory is then bounded by the
+ * source program and a few callables at a time, not by the whole program at
+ * every level.
+ *
+ * Inlining cannot wait for all the callees to be in SSA form: the call graph
+ * is read off the AST, and before each batch the callees that its callables
+ * may inline are compiled again from the source, up to tail call elimination,
+ * once for the whole batch. Their own calls are not inlined into them first,
+ * so inlining only goes one level deep.
+ */
+struct StreamStats {
+  int rtl_simplified = 0;
+  ssa::PassStats stats;
+};
+
+/** The global variables come first, then every callable, then asm_end() */
+using AsmSink = std::function<void(AsmProgram &)>;
+
+/** The global variables come first, then every callable */
+using LlvmSink = std::function<void(LlvmProgram &)>;
+
+StreamStats stream_native(source::Program const &prog, Options const &options,
+                          WorkPool &pool, AsmSink const &sink);
+
+StreamStats stream_llvm(source::Program const &prog, Options const &options,
+                        WorkPool &pool, LlvmSink const &sink);
+
+} // namespace bx
@@ -6,6 +6,18 @@
 namespace bx {
 namespace rtl {
 
+thread_local Numbering thread_numbering;
+
+Numbering::Scope::Scope(Numbering &target)
+    : target{target}, saved{thread_numbering} {
+  thread_numbering = target;
+}
+
+Numbering::Scope::~Scope() {
+  target = thread_numbering;
+  thread_numbering = saved;
+}
+
 std::ostream &operator<<(std::ostream &out, Label const &l) {
   return out << 'L' << l.id;
 }
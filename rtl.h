@@ -33,8 +33,36 @@ struct Label {
 };
 std::ostream &operator<<(std::ostream &out, Label const &l);
 
-extern int last_label;
-inline rtl::Label fresh_label() { return rtl::Label{last_label++}; }
+/**
+ * Labels and pseudos are numbered per callable, so that callables can be
+ * compiled independently, on any thread, and always come out the same.
+ * fresh_label() and fresh_pseudo() draw from the numbering of the current
+ * thread, which a Numbering::Scope ties to a callable: every stage that adds
+ * labels or pseudos to a callable opens one on the callable's numbering.
+ */
+struct Numbering {
+  int last_label = 0;
+  int last_pseudo = 0;
+
+  class Scope;
+};
+
+class Numbering::Scope {
+  Numbering &target;
+  Numbering saved;
+
+public:
+  explicit Scope(Numbering &target);
+  ~Scope();
+  Scope(Scope const &) = delete;
+  Scope &operator=(Scope const &) = delete;
+};
+
+extern thread_local Numbering thread_numbering;
+
+inline rtl::Label fresh_label() {
+  return rtl::Label{thread_numbering.last_label++};
+}
 
 struct LabelHash {
   std::size_t operator()(Label const &l) const noexcept {
@@ -57,8 +85,9 @@ struct Pseudo {
 std::ostream &operator<<(std::ostream &out, Pseudo const &r);
 constexpr Pseudo discard_pr{-1};
 
-extern int last_pseudo;
-inline rtl::Pseudo fresh_pseudo() { return rtl::Pseudo{last_pseudo++}; }
+inline rtl::Pseudo fresh_pseudo() {
+  return rtl::Pseudo{thread_numbering.last_pseudo++};
+}
 
 struct Instr;
 using InstrPtr = std::shared_ptr<Instr const>;
@@ -351,6 +380,7 @@ struct Callable {
   LabelMap<InstrPtr> body;
   std::string type;
   std::vector<Label> schedule; // the order in which the labels are scheduled
+  Numbering numbering;
   explicit Callable(std::string name) : name{name} {}
   void add_instr(Label lab, InstrPtr instr) {
     if (body.find(lab) != body.end()) {
@@ -0,0 +1,164 @@
+/**
+ * CFG simplification on RTL
+ *
+ * RTL has no blocks, every instruction names its successors, so the
+ * clean-ups are done on the labels directly:
+ *
+ *   - a jump to a goto is redirected to the end of the chain of gotos
+ *   - a branch whose two targets are the same becomes a goto
+ *   - the labels that cannot be reached from the enter label are deleted
+ *
+ * Together with the block construction in rtl_ssa.cpp, which merges straight
+ * lines of instructions, this gives the same result as the SSA simplifier.
+ */
+
+#include <memory>
+#include <vector>
+
+#include "rtl_cfg.h"
+
+namespace bx {
+namespace rtl {
+
+namespace {
+
+class CfgSimplifier : public InstrVisitor {
+private:
+  Callable &cbl;
+  LabelMap<Label> target; // where a jump to a label ends up
+  InstrPtr rewritten;
+  std::vector<Label> outs; // the targets of the instruction just rewritten
+  bool changed = false;
+  int count = 0;
+
+  /** Follow the gotos from lab, stopping if they go around in a circle */
+  Label resolve(Label const &lab) {
+    auto known = target.find(lab);
+    if (known != target.end())
+      return known->second;
+    std::vector<Label> chain;
+    LabelMap<bool> on_chain;
+    auto l = lab;
+    while (true) {
+      auto done = target.find(l);
+      if (done != target.end()) {
+        l = done->second;
+        break;
+      }
+      auto go = std::dynamic_pointer_cast<Goto const>(cbl.body.at(l));
+      if (!go || on_chain[l])
+        break;
+      on_chain[l] = true;
+      chain.push_back(l);
+      l = go->succ;
+    }
+    for (auto const &c : chain)
+      target[c] = l;
+    target[lab] = l;
+    return l;
+  }
+
+  /** The new target of a jump to lab, noting whether it moved */
+  Label retarget(Label const &lab) {
+    auto l = resolve(lab);
+    changed = changed || !(l == lab);
+    outs.push_back(l);
+    return l;
+  }
+
+  void branch(InstrPtr redone) {
+    if (outs[0] == outs[1]) {
+      rewritten = Goto::make(outs[0]);
+      outs.pop_back();
+      changed = true;
+    } else {
+      rewritten = std::move(redone);
+    }
+  }
+
+public:
+  explicit CfgSimplifier(Callable &cbl) : cbl{cbl} {}
+
+  void visit(Label const &, Move const &mv) override {
+    rewritten = Move::make(mv.source, mv.dest, retarget(mv.succ));
+  }
+  void visit(Label const &, Copy const &cp) override {
+    rewritten = Copy::make(cp.source, cp.dest, retarget(cp.succ));
+  }
+  void visit(Label const &, Load const &ld) override {
+    rewritten = Load::make(ld.source, ld.offset, ld.dest, retarget(ld.succ));
+  }
+  void visit(Label const &, Store const &st) override {
+    rewritten = Store::make(st.source, st.dest, st.offset, retarget(st.succ));
+  }
+  void visit(Label const &, Binop const &bo) override {
+    rewritten = Binop::make(bo.opcode, bo.source, bo.dest, retarget(bo.succ));
+  }
+  void visit(Label const &, Unop const &uo) override {
+    rewritten = Unop::make(uo.opcode, uo.arg, retarget(uo.succ));
+  }
+  void visit(Label const &, Bbranch const &bb) override {
+    auto succ = retarget(bb.succ);
+    auto fail = retarget(bb.fail);
+    branch(Bbranch::make(bb.opcode, bb.arg1, bb.arg2, succ, fail));
+  }
+  void visit(Label const &, Ubranch const &ub) override {
+    auto succ = retarget(ub.succ);
+    auto fail = retarget(ub.fail);
+    branch(Ubranch::make(ub.opcode, ub.arg, succ, fail));
+  }
+  void visit(Label const &, Goto const &go) override {
+    rewritten = Goto::make(retarget(go.succ));
+  }
+  void visit(Label const &, Call const &c) override {
+    rewritten = Call::make(c.func, c.args, c.ret, retarget(c.succ));
+  }
+  void visit(Label const &, Return const &) override {}
+
+  int run() {
+    LabelMap<std::vector<Label>> succs;
+    for (auto const &lab : cbl.schedule) {
+      auto &instr = cbl.body.at(lab);
+      rewritten = nullptr;
+      changed = false;
+      outs.clear();
+      instr->accept(lab, *this);
+      if (changed) {
+        instr = rewritten;
+        count++;
+      }
+      succs[lab] = outs;
+    }
+    cbl.enter = resolve(cbl.enter);
+
+    LabelMap<bool> seen{{cbl.enter, true}, {cbl.leave, true}};
+    std::vector<Label> work{cbl.enter};
+    while (!work.empty()) {
+      auto lab = work.back();
+      work.pop_back();
+      for (auto const &out : succs[lab])
+        if (!seen[out]) {
+          seen[out] = true;
+          work.push_back(out);
+        }
+    }
+    std::vector<Label> schedule;
+    for (auto const &lab : cbl.schedule) {
+      if (seen[lab]) {
+        schedule.push_back(lab);
+        continue;
+      }
+      cbl.body.erase(lab);
+      count++;
+    }
+    cbl.schedule = std::move(schedule);
+    return count;
+  }
+};
+
+} // namespace
+
+int simplify_cfg(Callable &cbl) { return CfgSimplifier{cbl}.run(); }
+
+} // namespace rtl
+} // namespace bx
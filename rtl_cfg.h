@@ -0,0 +1,17 @@
+#pragma once
+
+#include "rtl.h"
+
+namespace bx {
+namespace rtl {
+
+/**
+ * CFG simplification on RTL: jumps to a goto are redirected to its target,
+ * branches whose two targets coincide become gotos and the labels that can
+ * no longer be reached are dropped. Returns the number of instructions
+ * removed or rewritten.
+ */
+int simplify_cfg(Callable &cbl);
+
+} // namespace rtl
+} // namespace bx
@@ -16,22 +16,17 @@ public:
   Explicator(source::Program::GlobalVarTable const &global_vars,
              rtl::Callable const &rtl_cbl)
       : global_vars{global_vars}, rtl_cbl{rtl_cbl}, ertl_cbl{rtl_cbl.name} {
+    ertl_cbl.numbering = rtl_cbl.numbering;
+    rtl::Numbering::Scope scope{ertl_cbl.numbering};
     ertl_cbl.enter = rtl::fresh_label();
     auto cur = ertl_cbl.enter;
-    // add the newframe instruction
+    // add the newframe instruction; the callee-save registers that the
+    // allocation uses are saved with the frame (see ertl_frame.h)
     {
       auto next = rtl::fresh_label();
       ertl_cbl.add_instr(cur, ertl::Newframe::make(next));
       cur = next;
     }
-    // save the callee-save registers
-    for (auto mach_reg : ertl::callee_saves) {
-      auto next = rtl::fresh_label();
-      auto pseudo = rtl::fresh_pseudo();
-      ertl_cbl.add_instr(cur, ertl::GetMach::make(mach_reg, pseudo, next));
-      ertl_cbl.callee_saves.push_back({mach_reg, pseudo});
-      cur = next;
-    }
     // load the input argument registers
     for (auto i = 0u; i < 6u && i < rtl_cbl.input_regs.size(); i++) {
       auto next = rtl::fresh_label();
@@ -141,13 +136,6 @@ public:
                          ertl::SetMach::make(ret.arg, ertl::Mach::RAX, next));
       cur = next;
     }
-    // restore the callee saves
-    for (auto mr = ertl_cbl.callee_saves.crbegin();
-         mr != ertl_cbl.callee_saves.crend(); mr++) {
-      auto next = rtl::fresh_label();
-      ertl_cbl.add_instr(cur, ertl::SetMach::make(mr->second, mr->first, next));
-      cur = next;
-    }
     // delete the frame
     {
       auto next = rtl::fresh_label();
@@ -160,13 +148,17 @@ public:
   }
 };
 
+ertl::Callable make_explicit(source::Program::GlobalVarTable const &global_vars,
+                             rtl::Callable const &rtl_cbl) {
+  Explicator expl{global_vars, rtl_cbl};
+  return expl.deliver();
+}
+
 ertl::Program make_explicit(source::Program::GlobalVarTable const &global_vars,
                             rtl::Program const &prog) {
   ertl::Program ertl_prog;
-  for (auto const &rtl_cbl : prog) {
-    Explicator expl{global_vars, rtl_cbl};
-    ertl_prog.push_back(expl.deliver());
-  }
+  for (auto const &rtl_cbl : prog)
+    ertl_prog.push_back(make_explicit(global_vars, rtl_cbl));
   return ertl_prog;
 }
 
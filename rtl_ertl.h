@@ -2,6 +2,9 @@
 #include "rtl.h"
 
 namespace bx {
+ertl::Callable make_explicit(source::Program::GlobalVarTable const &global_vars,
+                             rtl::Callable const &rtl_cbl);
+
 ertl::Program make_explicit(source::Program::GlobalVarTable const &global_vars,
                             rtl::Program const &prog);
 }
\ No newline at end of file
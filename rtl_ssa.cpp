@@ -1,10 +1,15 @@
 /**
- * This file generates the SSA form of ERTL
+ * This file generates the SSA form of RTL
  *
  * Classes:
  *
- *     bx::Ssaer:
- *         A visitor that compiles bx::ertl::Instr one by one
+ *     bx::LeaderFinder:
+ *         Finds the labels that start basic blocks
+ *
+ *     bx::Blocker:
+ *         A visitor that groups bx::rtl::Instr into basic blocks, then builds
+ *         pruned SSA form: phis on the iterated dominance frontier where
+ *         the pseudo is live, renaming along the dominator tree
  *
  *  Functions
  *
@@ -12,289 +17,427 @@
  *         The main compilation function
  */
 
+#include <algorithm>
 #include <stdexcept>
 #include <unordered_map>
 #include <unordered_set>
 
+#include "dominators.h"
 #include "ssa.h"
+#include "ssa_opt.h"
 #include "rtl_ssa.h"
 #include "rtl.h"
 
 namespace bx {
 
+using LabelSet = std::unordered_set<rtl::Label, rtl::LabelHash, rtl::LabelEq>;
+
+/**
+ * Finds the leaders of an rtl callable in one pass over its schedule: the
+ * enter label, every jump target, and every label with several straight-line
+ * predecessors.
+ */
+class LeaderFinder : public rtl::InstrVisitor {
+private:
+  rtl::LabelMap<int> fallins;
+
+  void add_leader(rtl::Label const &l) {
+    if (leader_set.insert(l).second)
+      leaders.push_back(l);
+  }
+
+public:
+  std::vector<rtl::Label> leaders;
+  LabelSet leader_set;
+
+  explicit LeaderFinder(rtl::Callable const &cbl) {
+    add_leader(cbl.enter);
+    for (auto const &l : cbl.schedule)
+      cbl.body.at(l)->accept(l, *this);
+    for (auto const &l : cbl.schedule) {
+      auto it = fallins.find(l);
+      if (it != fallins.end() && it->second > 1)
+        add_leader(l);
+    }
+  }
+
+  void visit(rtl::Label const &, rtl::Move const &mv) override {
+    fallins[mv.succ]++;
+  }
+  void visit(rtl::Label const &, rtl::Copy const &cp) override {
+    fallins[cp.succ]++;
+  }
+  void visit(rtl::Label const &, rtl::Load const &ld) override {
+    fallins[ld.succ]++;
+  }
+  void visit(rtl::Label const &, rtl::Store const &st) override {
+    fallins[st.succ]++;
+  }
+  void visit(rtl::Label const &, rtl::Binop const &bo) override {
+    fallins[bo.succ]++;
+  }
+  void visit(rtl::Label const &, rtl::Unop const &uo) override {
+    fallins[uo.succ]++;
+  }
+  void visit(rtl::Label const &, rtl::Call const &c) override {
+    fallins[c.succ]++;
+  }
+  void visit(rtl::Label const &, rtl::Ubranch const &ub) override {
+    add_leader(ub.succ);
+    add_leader(ub.fail);
+  }
+  void visit(rtl::Label const &, rtl::Bbranch const &bb) override {
+    add_leader(bb.succ);
+    add_leader(bb.fail);
+  }
+  void visit(rtl::Label const &, rtl::Goto const &go) override {
+    add_leader(go.succ);
+  }
+  void visit(rtl::Label const &, rtl::Return const &) override {}
+};
+
 class Blocker : public rtl::InstrVisitor {
 private:
   source::Program::GlobalVarTable const &global_vars;
   rtl::Callable const &rtl_cbl;
   std::vector<rtl::Label> leaders;
-  std::unordered_map<int, int> latest_version;
+  LabelSet const &leader_set;
   std::vector<rtl::Label> outlabels;
   std::vector<ssa::InstrPtr> body;
-  rtl::LabelMap<std::vector<rtl::Label>> parents;
+  // Set by the visitors of straight-line instructions to their successor
+  bool has_next = false;
+  rtl::Label next{-1};
 
-public:
-  ssa::Callable ssa_cbl;
-  Blocker(source::Program::GlobalVarTable const &global_vars,
-                rtl::Callable const &rtl_cbl,
-                std::vector<rtl::Label> leaders,
-                std::unordered_map<int, int> latest_version)
-        :global_vars{global_vars}, rtl_cbl{rtl_cbl},
-         leaders{leaders}, 
-         latest_version{latest_version}, 
-         ssa_cbl{rtl_cbl.name}{
-    
-    for (auto const &parg : rtl_cbl.input_regs){
-      ssa_cbl.input_regs.push_back(ssa::Pseudo{parg.id, latest_version[parg.id]});
-      latest_version[parg.id] = latest_version[parg.id] + 1;
-    }
+  void fall_through(rtl::Label const &succ) {
+    has_next = true;
+    next = succ;
+  }
 
-    ssa_cbl.enter = rtl_cbl.enter;
-    ssa_cbl.type=  rtl_cbl.type;
-    //Make the simple blocks
-    for (auto &l : leaders){
-        rtl_cbl.body.at(l)->accept(l, *this);
-        if (l.id != ssa_cbl.enter.id){
-          for (auto ps : this->latest_version){
-            std::vector<ssa::Pseudo> args;
-            // Add empty phi functions
-            if (ps.first != -1){
-              body.insert(body.begin(), ssa::Phi::make(args, ssa::Pseudo{ps.first, ps.second}));
-            }
-            this->latest_version[ps.first] = ps.second + 1;
-          }
-        }
-        else{
-          for (auto ps : this->latest_version){
-            bool doit = true;
-            for (auto const &inps : rtl_cbl.input_regs ){
-              if (inps.id == ps.first || ps.first == -1){
-                doit = false;
-              }
-            }
-            if (doit){
-              std::vector<ssa::Pseudo> args;
-              // Add empty phi functions
-              body.insert(body.begin(), ssa::Move::make(0, ssa::Pseudo{ps.first, ps.second}));
-              this->latest_version[ps.first] = ps.second + 1;
-            }
-          }
-        }
-        ssa_cbl.add_block(l, ssa::BBlock::make(outlabels, body));
-        body.clear();
-        outlabels.clear();
+  /**
+   * Collect the instructions from a leader up to the end of its block. A
+   * straight-line successor that is itself a leader closes the block with an
+   * explicit goto.
+   */
+  void make_block(rtl::Label const &leader) {
+    auto l = leader;
+    for (;;) {
+      has_next = false;
+      rtl_cbl.body.at(l)->accept(l, *this);
+      if (!has_next)
+        return;
+      l = next;
+      if (leader_set.find(l) != leader_set.end()) {
+        body.push_back(ssa::Goto::make());
+        outlabels.push_back(l);
+        return;
+      }
     }
+  }
 
-    // Initialize the predecessor strucure
-    for (auto &blc : ssa_cbl.body){
-      std::vector<rtl::Label> parent;
-      parents[blc.first] = parent;
-    }
+  /**
+   * Every rtl pseudo that occurs in the callable gets a dense index so that
+   * the per-pseudo analyses below can use vectors instead of maps.
+   */
+  std::unordered_map<int, int> pseudo_index;
+  std::vector<int> pseudo_ids;
 
-    //Fill up the predecessor structure
-    for (auto &blc : ssa_cbl.body){
-      for (auto &l: blc.second->outlabels){
-        parents[l].push_back(blc.first);
-      }
-    }
+  int index_of(int id) {
+    auto it = pseudo_index.find(id);
+    if (it != pseudo_index.end())
+      return it->second;
+    pseudo_index.insert({id, static_cast<int>(pseudo_ids.size())});
+    pseudo_ids.push_back(id);
+    return static_cast<int>(pseudo_ids.size()) - 1;
+  }
 
-    //Update the arguments of the phi functions
-    for (auto &blc : ssa_cbl.body){
-      std::unordered_map<int, std::vector<int>> phi_args;
-      for (auto &lpred : parents[blc.first]){
-        auto pred = ssa_cbl.body.at(lpred);
-        std::unordered_map<int, int> recents = pred->recent_versions();
-        for (auto &ps : recents){
-          auto it = phi_args.find( ps.first); 
-          if (it != phi_args.end()){
-            phi_args[ps.first].push_back(ps.second);
-          } 
-          else{
-            phi_args[ps.first] = std::vector<int>{ps.second};
-          }
-        }
+  ssa::BBlock &block_at(ssa::DomTree const &dom, int b) {
+    return *ssa_cbl.body.at(dom.order[b]);
+  }
+
+  /**
+   * Insert the phi functions of pruned SSA form: a phi for a pseudo is placed
+   * on the iterated dominance frontier of its definitions, but only where the
+   * pseudo is live-in. Returns the pseudos that are live-in at the enter
+   * block, which are implicitly defined there.
+   */
+  std::vector<int> place_phis(ssa::DomTree const &dom) {
+    int nblocks = dom.size();
+    // Definition blocks and upward-exposed uses of every pseudo
+    std::vector<std::vector<int>> def_blocks, use_blocks;
+    std::vector<int> def_stamp, use_stamp;
+    auto touch = [&](int v) {
+      if (v >= static_cast<int>(def_blocks.size())) {
+        def_blocks.resize(v + 1);
+        use_blocks.resize(v + 1);
+        def_stamp.resize(v + 1, -1);
+        use_stamp.resize(v + 1, -1);
       }
-      for (auto &i : blc.second->body){
-        if (auto fi = std::dynamic_pointer_cast<ssa::Phi>(i)){
-          auto it = phi_args.find(fi->dest.id);
-          if (it != phi_args.end()){
-            for (auto &version : phi_args[fi->dest.id]){
-              fi->args.push_back(ssa::Pseudo{fi->dest.id, version });
-            }
+    };
+    for (auto const &in : ssa_cbl.input_regs)
+      touch(index_of(in.id));
+    for (int b = 0; b < nblocks; b++) {
+      for (auto &instr : block_at(dom, b).body) {
+        for (auto *r : instr->getReads()) {
+          if (r->id == -1)
+            continue;
+          int v = index_of(r->id);
+          touch(v);
+          if (def_stamp[v] != b && use_stamp[v] != b) {
+            use_stamp[v] = b;
+            use_blocks[v].push_back(b);
           }
         }
+        auto *w = instr->getWrite();
+        if (w == nullptr || w->id == -1)
+          continue;
+        int v = index_of(w->id);
+        touch(v);
+        if (def_stamp[v] != b) {
+          def_stamp[v] = b;
+          def_blocks[v].push_back(b);
+        }
       }
     }
 
-    for (auto &blc: ssa_cbl.body){
-      ssa::PseudoMap<rtl::Label> location;
-      for (auto &lpred : parents[blc.first]){
-        auto pred = ssa_cbl.body.at(lpred);
-        for (auto &pdest : pred->getDests()){
-          location[pdest] = lpred;
+    std::unordered_set<int> inputs;
+    for (auto const &in : ssa_cbl.input_regs)
+      inputs.insert(index_of(in.id));
+
+    std::vector<int> entry_live;
+    std::vector<std::vector<int>> phis(nblocks);
+    // The stamps hold the pseudo currently being processed
+    std::vector<int> defines(nblocks, -1), live(nblocks, -1),
+        has_phi(nblocks, -1);
+    std::vector<int> work;
+    for (int v = 0; v < static_cast<int>(def_blocks.size()); v++) {
+      for (int b : def_blocks[v])
+        defines[b] = v;
+      // Live-in blocks: walk backwards from the upward-exposed uses,
+      // stopping at the blocks that define v
+      work = use_blocks[v];
+      for (int b : work)
+        live[b] = v;
+      while (!work.empty()) {
+        int b = work.back();
+        work.pop_back();
+        for (int p : dom.preds[b]) {
+          if (live[p] == v || defines[p] == v)
+            continue;
+          live[p] = v;
+          work.push_back(p);
         }
       }
-      for (auto &i : blc.second->body){
-        if (auto fi = std::dynamic_pointer_cast<ssa::Phi>(i)){
-          for (auto &p : fi->args){
-            fi->preds.push_back(location[p]);
+      // The enter block implicitly defines the inputs and anything that
+      // would otherwise be read uninitialized
+      auto defs = def_blocks[v];
+      if ((live[0] == v || inputs.count(v) > 0) && defines[0] != v) {
+        defines[0] = v;
+        defs.push_back(0);
+      }
+      if (live[0] == v && inputs.count(v) == 0)
+        entry_live.push_back(v);
+      // Iterated dominance frontier, pruned by liveness
+      work = defs;
+      while (!work.empty()) {
+        int b = work.back();
+        work.pop_back();
+        for (int f : dom.frontier[b]) {
+          if (has_phi[f] == v || live[f] != v)
+            continue;
+          has_phi[f] = v;
+          phis[f].push_back(v);
+          if (defines[f] != v) {
+            defines[f] = v;
+            work.push_back(f);
           }
         }
       }
     }
-/*
-    //remove empty phi functions
-    for (auto &blc : ssa_cbl.body){
-        std::vector<std::vector<ssa::InstrPtr>::iterator> to_erase;
-        for (auto it = blc.second->body.begin(); 
-            it != blc.second->body.end();
-            it++)
-        {
-          if (auto fi = std::dynamic_pointer_cast<ssa::Phi>(*it)){
-            if (fi->args.size() == 0){
-              to_erase.push_back(it);
-            }
-          }
-        }
-        std::vector<ssa::InstrPtr> new_body;
-        for (auto it = blc.second->body.begin(); 
-            it != blc.second->body.end();
-            it++)
-        {
-          if (std::find(to_erase.begin(), to_erase.end(), it) == to_erase.end()){
-            new_body.push_back(*it);
-          }
-        }
-        blc.second->body = new_body;
+
+    for (int b = 0; b < nblocks; b++) {
+      if (phis[b].empty())
+        continue;
+      auto &blk = block_at(dom, b);
+      std::vector<ssa::InstrPtr> new_body;
+      for (int v : phis[b])
+        new_body.push_back(ssa::Phi::make(std::vector<ssa::Pseudo>{},
+                                          ssa::Pseudo{pseudo_ids[v], -1}));
+      new_body.insert(new_body.end(), blk.body.begin(), blk.body.end());
+      blk.body = std::move(new_body);
+    }
+    return entry_live;
+  }
+
+  /**
+   * Assign versions by walking the dominator tree with an explicit stack,
+   * keeping a stack of live versions per pseudo. Phi arguments are filled in
+   * from each predecessor as it is visited.
+   */
+  void rename(ssa::DomTree const &dom, std::vector<int> const &entry_live) {
+    std::vector<std::vector<int>> versions(pseudo_ids.size());
+    std::vector<int> next_version(pseudo_ids.size(), 1);
+    std::vector<int> pushed; // pseudos whose versions must be popped
+    auto define = [&](ssa::Pseudo &ps) {
+      int v = index_of(ps.id);
+      ps.version = next_version[v]++;
+      versions[v].push_back(ps.version);
+      pushed.push_back(v);
+    };
+    auto current = [&](int id) {
+      auto const &vs = versions[index_of(id)];
+      if (vs.empty())
+        throw std::runtime_error("SSA: use of undefined pseudo");
+      return vs.back();
+    };
+
+    for (auto const &in : ssa_cbl.input_regs)
+      versions[index_of(in.id)].push_back(in.version);
+    // pseudos read before being written are initialized to 0 on entry
+    std::vector<ssa::InstrPtr> inits;
+    for (int v : entry_live) {
+      ssa::Pseudo ps{pseudo_ids[v], -1};
+      define(ps);
+      inits.push_back(ssa::Move::make(0, ps));
     }
+    pushed.clear();
 
-*/
-    //Replace the reads
-    for (auto &blc: ssa_cbl.body){
-      std::unordered_map<int, int> recents;
-      for (auto  &parg : ssa_cbl.input_regs){
-        recents.insert_or_assign(parg.id, parg.version);
+    std::vector<std::pair<int, std::size_t>> stack{{0, 0}};
+    std::vector<std::size_t> marks;
+    auto enter = [&](int b) {
+      marks.push_back(pushed.size());
+      auto &blk = block_at(dom, b);
+      for (auto &instr : blk.body) {
+        if (!std::dynamic_pointer_cast<ssa::Phi>(instr))
+          for (auto *r : instr->getReads())
+            if (r->id != -1)
+              r->version = current(r->id);
+        auto *w = instr->getWrite();
+        if (w != nullptr && w->id != -1)
+          define(*w);
+      }
+      for (int s : dom.succs[b]) {
+        for (auto &instr : block_at(dom, s).body) {
+          auto fi = std::dynamic_pointer_cast<ssa::Phi>(instr);
+          if (!fi)
+            break;
+          fi->args.push_back(ssa::Pseudo{fi->dest.id, current(fi->dest.id)});
+          fi->preds.push_back(dom.order[b]);
+        }
       }
-      for (auto &i : blc.second->body){
-        i->update_reads(recents);
-        auto recent = i->getDest();
-        recents.insert_or_assign(recent.id, recent.version);
+    };
+    enter(0);
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      if (top.second < dom.children[top.first].size()) {
+        int child = dom.children[top.first][top.second++];
+        enter(child);
+        stack.push_back({child, 0});
+        continue;
       }
+      for (auto mark = marks.back(); pushed.size() > mark; pushed.pop_back())
+        versions[pushed.back()].pop_back();
+      marks.pop_back();
+      stack.pop_back();
     }
+    auto &enter_blk = block_at(dom, 0);
+    enter_blk.body.insert(enter_blk.body.begin(), inits.begin(), inits.end());
+  }
+
+public:
+  ssa::Callable ssa_cbl;
+  Blocker(source::Program::GlobalVarTable const &global_vars,
+          rtl::Callable const &rtl_cbl, std::vector<rtl::Label> leaders,
+          LabelSet const &leader_set)
+      : global_vars{global_vars}, rtl_cbl{rtl_cbl}, leaders{leaders},
+        leader_set{leader_set}, ssa_cbl{rtl_cbl.name} {
+    ssa_cbl.numbering = rtl_cbl.numbering;
+    rtl::Numbering::Scope scope{ssa_cbl.numbering};
+    for (auto const &parg : rtl_cbl.input_regs)
+      ssa_cbl.input_regs.push_back(ssa::Pseudo{parg.id, 0});
 
+    ssa_cbl.enter = rtl_cbl.enter;
+    ssa_cbl.leave = rtl_cbl.leave;
+    ssa_cbl.type = rtl_cbl.type;
+    // Make the simple blocks, with all versions still unassigned
+    bool enter_is_target = false;
+    for (auto &l : leaders) {
+      make_block(l);
+      for (auto const &out : outlabels)
+        enter_is_target = enter_is_target || out == ssa_cbl.enter;
+      ssa_cbl.add_block(l, ssa::BBlock::make(outlabels, body));
+      body.clear();
+      outlabels.clear();
+    }
+    // The enter block must not have predecessors (e.g. a loop at the very
+    // start of the callable), since it carries the implicit definitions
+    if (enter_is_target) {
+      auto old_enter = ssa_cbl.enter;
+      ssa_cbl.enter = rtl::fresh_label();
+      ssa_cbl.add_block(ssa_cbl.enter,
+                        ssa::BBlock::make(std::vector<rtl::Label>{old_enter},
+                                          std::vector<ssa::InstrPtr>{
+                                              ssa::Goto::make()}));
+      std::rotate(ssa_cbl.schedule.rbegin(), ssa_cbl.schedule.rbegin() + 1,
+                  ssa_cbl.schedule.rend());
+    }
 
-    //Minimize ssa
-    bool done = false;
-    while (!done){
-      std::cout << ssa_cbl << '\n';
-      ssa::PseudoMap<int> replace;
-      done = true;
-      for (auto &blc: ssa_cbl.body){
-        std::vector<std::vector<ssa::InstrPtr>::iterator> to_erase;
-        for (auto it = blc.second->body.begin(); 
-            it != blc.second->body.end();
-            it++)
-        {
-          if (auto fi = std::dynamic_pointer_cast<ssa::Phi>(*it)){
-            if (fi->args.size() == 0){
-              done = false;
-              to_erase.push_back(it);
-            }
-            else{
-              std::unordered_set<int> arg_versions;
-              //idk how else to find the pseudo that will
-              //potentialy by replaced i know this is not great
-              ssa::Pseudo other;
-              for (auto &arg: fi->args){
-                arg_versions.insert(arg.version);
-                //I will only use this if there is one pseudo different than the destination
-                if (arg.version != fi->dest.version){
-                  other = arg;
-                }
-              }
-              if (arg_versions.size() == 2){
-                if (arg_versions.find(fi->dest.version) != arg_versions.end()){
-                  done = false;
-                  replace.insert_or_assign(other, fi->dest.version);
-                  //ssa_cbl.replace_all(replace);
-                }
-              } 
-              if (arg_versions.size() == 1){
-                if (arg_versions.find(fi->dest.version) != arg_versions.end()){
-                  done = false;
-                  to_erase.push_back(it);
-                }
-                else{
-                  done = false;
-                  replace.insert_or_assign(other, fi->dest.version);
-                } 
-              } 
-            } 
-          }
-        }
-        std::vector<ssa::InstrPtr> new_body;
-        for (auto it = blc.second->body.begin(); 
-            it != blc.second->body.end();
-            it++)
-        {
-          if (std::find(to_erase.begin(), to_erase.end(), it) == to_erase.end()){
-            new_body.push_back(*it);
-          }
-        }
-        blc.second->body = new_body;
+    ssa::DomTree dom{ssa_cbl};
+    // Drop the blocks that can never be reached
+    {
+      std::vector<rtl::Label> schedule;
+      for (auto const &l : ssa_cbl.schedule) {
+        if (dom.reachable(l))
+          schedule.push_back(l);
+        else
+          ssa_cbl.body.erase(l);
       }
-      ssa_cbl.replace_all(replace);
+      ssa_cbl.schedule = std::move(schedule);
     }
+
+    auto entry_live = place_phis(dom);
+    rename(dom, entry_live);
+
+    ssa::remove_redundant_phis(ssa_cbl);
   }
 
   void visit(rtl::Label const &, rtl::Move const &mv) override {
-    ssa::Pseudo dest{mv.dest.id,  latest_version[mv.dest.id]};
-    latest_version[mv.dest.id] = latest_version[mv.dest.id] + 1;
+    ssa::Pseudo dest{mv.dest.id, -1};
     body.push_back(ssa::Move::make(mv.source, dest));
-    auto l = mv.succ;
-    rtl_cbl.body.at(l)->accept(l, *this);
+    fall_through(mv.succ);
   }
 
   void visit(rtl::Label const &, rtl::Copy const &cp) override {
     ssa::Pseudo src{cp.source.id, -1};
-    ssa::Pseudo dst{cp.dest.id, latest_version[cp.dest.id]};
-    latest_version[cp.dest.id] = latest_version[cp.dest.id] + 1;
+    ssa::Pseudo dst{cp.dest.id, -1};
     body.push_back(ssa::Copy::make(src, dst));
-    auto l = cp.succ;
-    rtl_cbl.body.at(l)->accept(l, *this);
+    fall_through(cp.succ);
   }
 
   void visit(rtl::Label const &, rtl::Load const &ld) override {
-    ssa::Pseudo dst{ld.dest.id, latest_version[ld.dest.id]};
-    latest_version[ld.dest.id] = latest_version[ld.dest.id] + 1;
+    ssa::Pseudo dst{ld.dest.id, -1};
     body.push_back(ssa::Load::make(ld.source, ld.offset, dst));
-    auto l = ld.succ;
-    rtl_cbl.body.at(l)->accept(l, *this);
+    fall_through(ld.succ);
   }
 
   void visit(rtl::Label const &, rtl::Store const &st) override {
     ssa::Pseudo src{st.source.id, -1};
     body.push_back(ssa::Store::make(src, st.dest, st.offset)); 
-    auto l = st.succ;
-    rtl_cbl.body.at(l)->accept(l, *this);
+    fall_through(st.succ);
   }
 
   void visit(rtl::Label const &, rtl::Binop const &bo) override {
     ssa::Pseudo src1{bo.source.id, -1};
     ssa::Pseudo src2{bo.dest.id, -1};
-    ssa::Pseudo dest{bo.dest.id, latest_version[bo.dest.id]};
-    latest_version[bo.dest.id] = latest_version[bo.dest.id] + 1;
+    ssa::Pseudo dest{bo.dest.id, -1};
     body.push_back(ssa::Binop::make(bo.opcode, src1, src2, dest)); 
-    auto l = bo.succ;
-    rtl_cbl.body.at(l)->accept(l, *this);
+    fall_through(bo.succ);
   }
 
   void visit(rtl::Label const &, rtl::Unop const &uo) override {
     ssa::Pseudo arg{uo.arg.id, -1};
-    ssa::Pseudo dest{uo.arg.id, latest_version[uo.arg.id]};
-    latest_version[uo.arg.id] = latest_version[uo.arg.id] + 1;
+    ssa::Pseudo dest{uo.arg.id, -1};
     body.push_back(ssa::Unop::make(uo.opcode, arg, dest)); 
-    auto l = uo.succ;
-    rtl_cbl.body.at(l)->accept(l, *this);
+    fall_through(uo.succ);
   }
 
   void visit(rtl::Label const &, rtl::Ubranch const &ub) override {
@@ -318,11 +461,9 @@ public:
       ssa::Pseudo sarg{a.id, -1};
       args.push_back(sarg);
     }
-    ssa::Pseudo sret{c.ret.id, latest_version[c.ret.id]};
-    latest_version[c.ret.id] = latest_version[c.ret.id] + 1;
+    ssa::Pseudo sret{c.ret.id, -1};
     body.push_back(ssa::Call::make(c.func, args ,sret));
-    auto l = c.succ;
-    rtl_cbl.body.at(l)->accept(l, *this);
+    fall_through(c.succ);
   }
 
   void visit(rtl::Label const &, rtl::Return const &r) override {
@@ -337,47 +478,18 @@ public:
   
 };
 
+ssa::Callable blocks_generate(source::Program::GlobalVarTable const &global_vars,
+                              rtl::Callable const &cbl) {
+  LeaderFinder finder{cbl};
+  Blocker blocker{global_vars, cbl, finder.leaders, finder.leader_set};
+  return std::move(blocker.ssa_cbl);
+}
+
 ssa::Program blocks_generate(source::Program::GlobalVarTable const &global_vars,
                         rtl::Program &prog) {
   ssa::Program ret;
-  for (auto &cbl : prog) {
-    std::vector<rtl::Label> leaders;
-    leaders.push_back(cbl.enter);
-    std::cout << cbl.name << std::endl;
-    std::unordered_map<int, int> latest_version;
-    for (auto &l : cbl.schedule) {
-      auto i = cbl.body.at(l);
-      for (auto ps : i->getPseudos()){
-        latest_version.insert_or_assign(ps.id, 0);
-      }
-      if (auto bb = std::dynamic_pointer_cast<const rtl::Bbranch>(i)){
-        if (std::find(leaders.begin(), leaders.end(), bb->succ) == leaders.end()) {
-          leaders.push_back(bb->succ);
-        }
-        if (std::find(leaders.begin(), leaders.end(), bb->fail) == leaders.end()) {
-          leaders.push_back(bb->fail);
-        }
-      }
-      if (auto ub = std::dynamic_pointer_cast<const rtl::Ubranch>(i)){
-        if (std::find(leaders.begin(), leaders.end(), ub->succ) == leaders.end()) {
-          leaders.push_back(ub->succ);
-        }
-        if (std::find(leaders.begin(), leaders.end(), ub->fail) == leaders.end()) {
-          leaders.push_back(ub->fail);
-        }
-      }
-      if (auto gt = std::dynamic_pointer_cast<const rtl::Goto>(i)){
-        if (std::find(leaders.begin(), leaders.end(), gt->succ) == leaders.end()) {
-          leaders.push_back(gt->succ);
-        }
-      }
-    }
-    for (auto &l : leaders){
-      std::cout << l << std::endl;
-    }
-    Blocker blocker{global_vars, cbl, leaders, latest_version};
-    ret.push_back(blocker.ssa_cbl);
-  } 
+  for (auto &cbl : prog)
+    ret.push_back(blocks_generate(global_vars, cbl));
   return ret;
 }
 } // namespace bx
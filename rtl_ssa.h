@@ -5,6 +5,9 @@
 
 namespace bx {
 
+ssa::Callable blocks_generate(source::Program::GlobalVarTable const &,
+                              rtl::Callable const &);
+
 ssa::Program blocks_generate(source::Program::GlobalVarTable const &,
                         rtl::Program  &);
 
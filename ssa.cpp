@@ -1,3 +1,5 @@
+#include <algorithm>
+
 #include "ssa.h"
 #include "rtl.h"
 
@@ -56,6 +58,78 @@ std::ostream &operator<<(std::ostream &out, Callable const &cbl) {
   return out << "END CALLABLE\n\n";
 }
 
+Pseudo Callable::fresh_version(int id) const {
+  int version = 0;
+  for (auto const &in : input_regs)
+    if (in.id == id)
+      version = std::max(version, in.version);
+  for (auto const &blc : body)
+    for (auto const &i : blc.second->body)
+      for (auto const &ps : i->getPseudos())
+        if (ps.id == id)
+          version = std::max(version, ps.version);
+  return Pseudo{id, version + 1};
+}
+
+DefUse::DefUse(Callable &cbl) {
+  for (auto const &lab : cbl.schedule)
+    for (auto const &instr : cbl.body.at(lab)->body)
+      add(instr);
+}
+
+InstrPtr DefUse::def(Pseudo const &ps) const {
+  auto it = defs.find(ps);
+  return it == defs.end() ? nullptr : it->second;
+}
+
+std::vector<Use> const &DefUse::uses(Pseudo const &ps) const {
+  static const std::vector<Use> none;
+  auto it = users.find(ps);
+  return it == users.end() ? none : it->second;
+}
+
+void DefUse::replaceAllUsesWith(Pseudo const &from, Pseudo const &to) {
+  if (PseudoEq{}(from, to))
+    return;
+  auto it = users.find(from);
+  if (it == users.end())
+    return;
+  auto moved = std::move(it->second);
+  users.erase(it);
+  auto &to_users = users[to];
+  for (auto &use : moved) {
+    *use.slot = to;
+    to_users.push_back(std::move(use));
+  }
+}
+
+void DefUse::add(InstrPtr const &instr) {
+  if (auto *dest = instr->getWrite())
+    if (dest->id != -1)
+      defs.insert_or_assign(*dest, instr);
+  for (auto *slot : instr->getReads())
+    users[*slot].push_back(Use{instr, slot});
+}
+
+void DefUse::remove(InstrPtr const &instr) {
+  if (auto *dest = instr->getWrite()) {
+    auto it = defs.find(*dest);
+    if (it != defs.end() && it->second == instr)
+      defs.erase(it);
+  }
+  for (auto *slot : instr->getReads()) {
+    auto it = users.find(*slot);
+    if (it == users.end())
+      continue;
+    auto &list = it->second;
+    list.erase(std::remove_if(list.begin(), list.end(),
+                              [&](Use const &use) { return use.instr == instr; }),
+               list.end());
+    if (list.empty())
+      users.erase(it);
+  }
+}
+
 std::unordered_map<int, int> BBlock::recent_versions(){
   std::unordered_map<int, int> ret;
   for (auto &i : body){
@@ -99,8 +99,14 @@ struct Instr {
   virtual std::ostream &print(std::ostream &out) const = 0;
   virtual void accept(Label const &lab, InstrVisitor &vis) = 0;
   virtual std::vector<Pseudo> getPseudos() const = 0;
-  virtual void update_reads(std::unordered_map<int, int> table) = 0;
-  virtual void update_all(PseudoMap<int> table) = 0;
+  // slots of the pseudos read by the instruction
+  virtual std::vector<Pseudo *> getReads() = 0;
+  // slot of the pseudo written by the instruction, if any
+  virtual Pseudo *getWrite() = 0;
+  // a copy of the instruction, for passes that duplicate code
+  virtual std::shared_ptr<Instr> clone() const = 0;
+  virtual void update_reads(std::unordered_map<int, int> const &table) = 0;
+  virtual void update_all(PseudoMap<int> const &table) = 0;
   virtual Pseudo getDest() = 0;
 };
 
@@ -121,14 +127,20 @@ struct Move : public Instr {
     return std::vector<Pseudo>{dest};
   }
 
-  void update_reads(std::unordered_map<int, int> table){(void)table;}
+  void update_reads(std::unordered_map<int, int> const &table){(void)table;}
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(dest) != table.end()){
-      dest.version = table[dest];
+      dest.version = table.at(dest);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{};
+  }
+
+  Pseudo *getWrite() override { return &dest; }
+
   Pseudo getDest(){
     return dest;
   }
@@ -136,6 +148,9 @@ struct Move : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "move " << source << ", " << dest;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Move>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Move, int64_t source, Pseudo dest)
       : source{source}, dest{dest} {}
@@ -148,21 +163,27 @@ struct Copy : public Instr {
     return std::vector<Pseudo>{dest, src};
   }
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     if (table.find(src.id) != table.end()){
-      src.version = table[src.id];
+      src.version = table.at(src.id);
     }
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(src) != table.end()){
-      src.version = table[src];
+      src.version = table.at(src);
     }
     if (table.find(dest) != table.end()){
-      dest.version = table[dest];
+      dest.version = table.at(dest);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{&src};
+  }
+
+  Pseudo *getWrite() override { return &dest; }
+
   Pseudo getDest(){
     return dest;
   }
@@ -170,6 +191,9 @@ struct Copy : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "copy " << src << ", " << dest;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Copy>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Copy, Pseudo src, Pseudo dest)
       : src{src}, dest{dest} {}
@@ -181,14 +205,20 @@ struct Load : public Instr {
   int offset;
   Pseudo dest;
 
-  void update_reads(std::unordered_map<int, int> table){(void)table;}
+  void update_reads(std::unordered_map<int, int> const &table){(void)table;}
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(dest) != table.end()){
-      dest.version = table[dest];
+      dest.version = table.at(dest);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{};
+  }
+
+  Pseudo *getWrite() override { return &dest; }
+
   Pseudo getDest(){
     return dest;
   }
@@ -200,6 +230,9 @@ struct Load : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "load " << src << '+' << offset << ", " << dest;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Load>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Load, std::string const &src, int offset, Pseudo dest)
       : src{src}, offset{offset}, dest{dest} {}
@@ -210,18 +243,24 @@ struct Store : public Instr {
   std::string dest;
   int offset;
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     if (table.find(src.id) != table.end()){
-      src.version = table[src.id];
+      src.version = table.at(src.id);
     }
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(src) != table.end()){
-      src.version = table[src];
+      src.version = table.at(src);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{&src};
+  }
+
+  Pseudo *getWrite() override { return nullptr; }
+
   Pseudo getDest(){
     return Pseudo{-1, -1};
   }
@@ -233,6 +272,9 @@ struct Store : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "store " << src << ", " << dest << '+' << offset;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Store>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Store, Pseudo src, std::string const &dest, int offset)
       : src{src}, dest{dest}, offset{offset} {}
@@ -244,22 +286,28 @@ struct Unop : public Instr {
   Pseudo arg;
   Pseudo dest;
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     if (table.find(arg.id) != table.end()){
-      arg.version = table[arg.id];
+      arg.version = table.at(arg.id);
     }
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(arg) != table.end()){
-      arg.version = table[arg];
+      arg.version = table.at(arg);
     }
     if (table.find(dest) != table.end()){
-      dest.version = table[dest];
+      dest.version = table.at(dest);
     }
   }
 
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{&arg};
+  }
+
+  Pseudo *getWrite() override { return &dest; }
+
   Pseudo getDest(){
     return dest;
   }
@@ -271,6 +319,9 @@ struct Unop : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "unop " << code_map.at(opcode) << ", " << arg << " >> " << dest;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Unop>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Unop, Code opcode, Pseudo arg, Pseudo dest)
       : opcode{opcode}, arg{arg}, dest{dest}{}
@@ -285,27 +336,33 @@ struct Binop : public Instr {
   Code opcode;
   Pseudo src1, src2, dest;
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     if (table.find(src1.id) != table.end()){
-      src1.version = table[src1.id];
+      src1.version = table.at(src1.id);
     }
     if (table.find(src2.id) != table.end()){
-      src2.version = table[src2.id];
+      src2.version = table.at(src2.id);
     }
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(src1) != table.end()){
-      src1.version = table[src1];
+      src1.version = table.at(src1);
     }
     if (table.find(src2) != table.end()){
-      src2.version = table[src2];
+      src2.version = table.at(src2);
     }
     if (table.find(dest) != table.end()){
-      dest.version = table[dest];
+      dest.version = table.at(dest);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{&src1, &src2};
+  }
+
+  Pseudo *getWrite() override { return &dest; }
+
   Pseudo getDest(){
     return dest;
   }
@@ -317,6 +374,9 @@ struct Binop : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "binop " << code_map.at(opcode) << ", " << src1 << ", " << src2 << " >> " << dest;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Binop>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Binop, Code opcode, Pseudo src1, Pseudo src2, Pseudo dest)
       : opcode{opcode}, src1{src1}, src2{src2} ,dest{dest} {}
@@ -331,18 +391,24 @@ struct Ubranch : public Instr {
   Code opcode;
   Pseudo arg;
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     if (table.find(arg.id) != table.end()){
-      arg.version = table[arg.id];
+      arg.version = table.at(arg.id);
     }
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(arg) != table.end()){
-      arg.version = table[arg];
+      arg.version = table.at(arg);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{&arg};
+  }
+
+  Pseudo *getWrite() override { return nullptr; }
+
   Pseudo getDest(){
     return Pseudo{-1, -1};
   }
@@ -354,6 +420,9 @@ struct Ubranch : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "ubranch " << code_map.at(opcode) << ", " << arg;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Ubranch>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Ubranch, Code opcode, Pseudo arg)
       : opcode{opcode}, arg{arg} {}
@@ -372,24 +441,30 @@ struct Bbranch : public Instr {
     return std::vector<Pseudo>{arg1, arg2};
   }
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     if (table.find(arg1.id) != table.end()){
-      arg1.version = table[arg1.id];
+      arg1.version = table.at(arg1.id);
     }
     if (table.find(arg2.id) != table.end()){
-      arg2.version = table[arg2.id];
+      arg2.version = table.at(arg2.id);
     }
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(arg1) != table.end()){
-      arg1.version = table[arg1];
+      arg1.version = table.at(arg1);
     }
     if (table.find(arg2) != table.end()){
-      arg2.version = table[arg2];
+      arg2.version = table.at(arg2);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{&arg1, &arg2};
+  }
+
+  Pseudo *getWrite() override { return nullptr; }
+
   Pseudo getDest(){
     return Pseudo{-1, -1};
   }
@@ -398,6 +473,9 @@ struct Bbranch : public Instr {
     return out << "bbranch " << code_map.at(opcode) << ", " << arg1 << ", "
                << arg2;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Bbranch>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Bbranch, Code opcode, Pseudo arg1, Pseudo arg2)
       : opcode{opcode}, arg1{arg1}, arg2{arg2} {}
@@ -411,12 +489,18 @@ struct Goto : public Instr {
     return std::vector<Pseudo>{};
   }
 
-  void update_reads(std::unordered_map<int, int> table){(void)table;}
+  void update_reads(std::unordered_map<int, int> const &table){(void)table;}
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     (void)table;
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{};
+  }
+
+  Pseudo *getWrite() override { return nullptr; }
+
   Pseudo getDest(){
     return Pseudo{-1, -1};
   }
@@ -424,6 +508,9 @@ struct Goto : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "goto  --> ";
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Goto>(*this);
+  }
   MAKE_VISITABLE
   static std::shared_ptr<Goto> make() {
     return std::shared_ptr<Goto>{new Goto()};
@@ -445,25 +532,34 @@ struct Call : public Instr {
     return pseudos;
   }
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     for (auto &arg : args){
       if (table.find(arg.id) != table.end()){
-        arg.version = table[arg.id];
+        arg.version = table.at(arg.id);
       }
     }
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     for (auto &arg : args){
       if (table.find(arg) != table.end()){
-        arg.version = table[arg];
+        arg.version = table.at(arg);
       }
     }
     if (table.find(ret) != table.end()){
-      ret.version = table[ret];
+      ret.version = table.at(ret);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    std::vector<Pseudo *> reads;
+    for (auto &arg : args)
+      reads.push_back(&arg);
+    return reads;
+  }
+
+  Pseudo *getWrite() override { return &ret; }
+
   Pseudo getDest(){
     return ret;
   }
@@ -477,6 +573,9 @@ struct Call : public Instr {
     }
     return out << ") >> " << ret;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Call>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Call, std::string func, std::vector<Pseudo> args, Pseudo ret)
       : func{func}, args{args}, ret{ret} {}
@@ -489,18 +588,24 @@ struct Return : public Instr {
     return std::vector<Pseudo>{arg};
   }
 
-  void update_reads(std::unordered_map<int, int> table){
+  void update_reads(std::unordered_map<int, int> const &table){
     if (table.find(arg.id) != table.end()){
-      arg.version = table[arg.id];
+      arg.version = table.at(arg.id);
     } 
   }
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     if (table.find(arg) != table.end()){
-      arg.version = table[arg];
+      arg.version = table.at(arg);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    return std::vector<Pseudo *>{&arg};
+  }
+
+  Pseudo *getWrite() override { return nullptr; }
+
   Pseudo getDest(){
     return Pseudo{-1, -1};
   }
@@ -508,6 +613,9 @@ struct Return : public Instr {
   std::ostream &print(std::ostream &out) const override {
     return out << "return"<< arg;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Return>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Return, Pseudo arg) : arg{arg} {}
 };
@@ -526,19 +634,28 @@ struct Phi : public Instr{
     return pseudos;
   }
 
-  void update_reads(std::unordered_map<int, int> table){(void)table;}
+  void update_reads(std::unordered_map<int, int> const &table){(void)table;}
 
-  void update_all(PseudoMap<int> table){
+  void update_all(PseudoMap<int> const &table){
     for (auto &arg : args){
       if (table.find(arg) != table.end()){
-        arg.version = table[arg];
+        arg.version = table.at(arg);
       }
     }
     if (table.find(dest) != table.end()){
-      dest.version = table[dest];
+      dest.version = table.at(dest);
     }
   }
 
+  std::vector<Pseudo *> getReads() override {
+    std::vector<Pseudo *> reads;
+    for (auto &arg : args)
+      reads.push_back(&arg);
+    return reads;
+  }
+
+  Pseudo *getWrite() override { return &dest; }
+
   Pseudo getDest(){
     return dest;
   }
@@ -558,6 +675,9 @@ struct Phi : public Instr{
     }
     return out << ") >> " << dest;
   }
+  std::shared_ptr<Instr> clone() const override {
+    return std::make_shared<Phi>(*this);
+  }
   MAKE_VISITABLE
   CONSTRUCTOR(Phi, std::vector<Pseudo> args, Pseudo dest)
       : args{args}, dest{dest} {}
@@ -593,6 +713,7 @@ struct Callable {
   rtl::LabelMap<BBlockPtr> body;
   std::string type;
   std::vector<Label> schedule; // the order in which the labels are scheduled
+  rtl::Numbering numbering;
   explicit Callable(std::string name) : name{name} {}
   void add_block(Label lab, BBlockPtr block) {
     if (body.find(lab) != body.end()) {
@@ -603,7 +724,9 @@ struct Callable {
     schedule.push_back(lab);
     body.insert_or_assign(lab, std::move(block));
   }
-  void replace_all(PseudoMap<int> table){
+  // a version of the pseudo id that occurs nowhere in the callable yet
+  Pseudo fresh_version(int id) const;
+  void replace_all(PseudoMap<int> const &table){
     for (auto &blc : body){
       for (auto &i : blc.second->body){
         i->update_all(table);
@@ -613,6 +736,40 @@ struct Callable {
 };
 std::ostream &operator<<(std::ostream &out, Callable const &cbl);
 
+/** A use of a pseudo: the instruction and the operand slot reading it */
+struct Use {
+  InstrPtr instr;
+  Pseudo *slot;
+};
+
+/**
+ * Def-use chains of a callable, keyed on the full (id, version) pseudo.
+ *
+ * Uses hold on to their instruction, so a slot stays valid after the
+ * instruction is taken out of its block. Passes that insert or delete
+ * instructions keep the chains current with add() and remove(); operand
+ * vectors (Call, Phi) must not be resized while they are registered.
+ */
+class DefUse {
+public:
+  explicit DefUse(Callable &cbl);
+
+  /** The defining instruction, or nullptr for inputs and undefined pseudos */
+  InstrPtr def(Pseudo const &ps) const;
+  std::vector<Use> const &uses(Pseudo const &ps) const;
+  bool unused(Pseudo const &ps) const { return uses(ps).empty(); }
+
+  /** Rewrite every use of from to read to instead; O(number of uses) */
+  void replaceAllUsesWith(Pseudo const &from, Pseudo const &to);
+
+  void add(InstrPtr const &instr);
+  void remove(InstrPtr const &instr);
+
+private:
+  PseudoMap<InstrPtr> defs;
+  PseudoMap<std::vector<Use>> users;
+};
+
 using Program = std::vector<Callable>;
 
 } //namespace ssa
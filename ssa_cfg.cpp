@@ -0,0 +1,218 @@
+/**
+ * CFG simplification
+ *
+ * Repeats four clean-ups until none of them applies:
+ *
+ *   - a branch whose two targets are the same block becomes a goto
+ *   - blocks that cannot be reached from the enter block are deleted
+ *   - a block holding only a goto is bypassed, its predecessors jumping
+ *     straight to its successor
+ *   - a block with a single predecessor that jumps only to it is appended to
+ *     that predecessor; its phis, which can only have one argument, are
+ *     replaced by that argument
+ *
+ * Phi arguments follow their edges throughout: they are dropped with the
+ * edges that disappear and relabelled when an edge gets a new source.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+std::vector<std::shared_ptr<Phi>> phis_of(BBlock const &blk) {
+  std::vector<std::shared_ptr<Phi>> phis;
+  for (auto const &instr : blk.body) {
+    auto phi = std::dynamic_pointer_cast<Phi>(instr);
+    if (!phi)
+      break;
+    phis.push_back(phi);
+  }
+  return phis;
+}
+
+void drop_incoming(Phi &phi, std::size_t i) {
+  phi.args.erase(phi.args.begin() + i);
+  phi.preds.erase(phi.preds.begin() + i);
+}
+
+class CfgSimplifier {
+private:
+  Callable &cbl;
+  rtl::LabelMap<std::vector<Label>> preds; // one entry per edge
+  int count = 0;
+
+  void compute_preds() {
+    preds.clear();
+    for (auto const &lab : cbl.schedule)
+      for (auto const &out : cbl.body.at(lab)->outlabels)
+        preds[out].push_back(lab);
+  }
+
+  void erase_block(Label const &lab) {
+    count += static_cast<int>(cbl.body.at(lab)->body.size());
+    cbl.body.erase(lab);
+    cbl.schedule.erase(std::find(cbl.schedule.begin(), cbl.schedule.end(), lab));
+  }
+
+  bool fold_branches() {
+    bool changed = false;
+    for (auto const &lab : cbl.schedule) {
+      auto &blk = *cbl.body.at(lab);
+      if (blk.outlabels.size() != 2 || !(blk.outlabels[0] == blk.outlabels[1]))
+        continue;
+      auto target = blk.outlabels[0];
+      blk.body.back() = Goto::make();
+      blk.outlabels = {target};
+      for (auto const &phi : phis_of(*cbl.body.at(target))) {
+        auto pos = std::find(phi->preds.rbegin(), phi->preds.rend(), lab);
+        drop_incoming(*phi, phi->preds.rend() - pos - 1);
+      }
+      count++;
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool remove_unreachable() {
+    rtl::LabelMap<bool> seen{{cbl.enter, true}};
+    std::vector<Label> work{cbl.enter};
+    while (!work.empty()) {
+      auto lab = work.back();
+      work.pop_back();
+      for (auto const &out : cbl.body.at(lab)->outlabels)
+        if (!seen[out]) {
+          seen[out] = true;
+          work.push_back(out);
+        }
+    }
+    std::vector<Label> dead;
+    for (auto const &lab : cbl.schedule)
+      if (!seen[lab])
+        dead.push_back(lab);
+    if (dead.empty())
+      return false;
+    for (auto const &lab : dead)
+      erase_block(lab);
+    for (auto const &lab : cbl.schedule)
+      for (auto const &phi : phis_of(*cbl.body.at(lab)))
+        for (std::size_t i = phi->preds.size(); i-- > 0;)
+          if (cbl.body.find(phi->preds[i]) == cbl.body.end())
+            drop_incoming(*phi, i);
+    return true;
+  }
+
+  bool thread_jumps() {
+    bool changed = false;
+    compute_preds();
+    std::vector<Label> schedule = cbl.schedule;
+    for (auto const &lab : schedule) {
+      auto &blk = *cbl.body.at(lab);
+      if (lab == cbl.enter || blk.body.size() != 1 ||
+          !std::dynamic_pointer_cast<Goto>(blk.body[0]) || blk.outlabels[0] == lab)
+        continue;
+      auto succ = blk.outlabels[0];
+      auto &into = preds[lab];
+      auto &succ_preds = preds[succ];
+      auto succ_phis = phis_of(*cbl.body.at(succ));
+      // A phi cannot tell apart two edges from the same block
+      bool clash = !succ_phis.empty() &&
+                   std::any_of(into.begin(), into.end(), [&](Label const &p) {
+                     return std::find(succ_preds.begin(), succ_preds.end(), p) !=
+                            succ_preds.end();
+                   });
+      if (clash)
+        continue;
+      for (auto const &p : into)
+        for (auto &out : cbl.body.at(p)->outlabels)
+          if (out == lab)
+            out = succ;
+      for (auto const &phi : succ_phis) {
+        auto i = std::find(phi->preds.begin(), phi->preds.end(), lab) -
+                 phi->preds.begin();
+        auto arg = phi->args[i];
+        drop_incoming(*phi, i);
+        for (auto const &p : into) {
+          phi->args.push_back(arg);
+          phi->preds.push_back(p);
+        }
+      }
+      succ_preds.erase(std::remove(succ_preds.begin(), succ_preds.end(), lab),
+                       succ_preds.end());
+      succ_preds.insert(succ_preds.end(), into.begin(), into.end());
+      erase_block(lab);
+      changed = true;
+    }
+    return changed;
+  }
+
+  bool merge_blocks() {
+    bool changed = false;
+    compute_preds();
+    PseudoMap<Pseudo> replaced; // destinations of the phis merged away
+    std::vector<Label> schedule = cbl.schedule;
+    for (auto const &lab : schedule) {
+      auto const &into = preds[lab];
+      if (lab == cbl.enter || into.size() != 1 || into[0] == lab)
+        continue;
+      auto pred = into[0];
+      auto &pred_blk = *cbl.body.at(pred);
+      if (pred_blk.outlabels.size() != 1 ||
+          !std::dynamic_pointer_cast<Goto>(pred_blk.body.back()))
+        continue;
+      auto &blk = *cbl.body.at(lab);
+      pred_blk.body.pop_back();
+      for (auto const &instr : blk.body) {
+        if (auto phi = std::dynamic_pointer_cast<Phi>(instr))
+          replaced[phi->dest] = phi->args.at(0);
+        else
+          pred_blk.body.push_back(instr);
+      }
+      pred_blk.outlabels = blk.outlabels;
+      for (auto const &out : blk.outlabels) {
+        for (auto const &phi : phis_of(*cbl.body.at(out)))
+          std::replace(phi->preds.begin(), phi->preds.end(), lab, pred);
+        std::replace(preds[out].begin(), preds[out].end(), lab, pred);
+      }
+      count++; // the goto
+      blk.body.clear();
+      erase_block(lab);
+      changed = true;
+    }
+    if (!replaced.empty())
+      for (auto const &lab : cbl.schedule)
+        for (auto const &instr : cbl.body.at(lab)->body)
+          for (auto *r : instr->getReads())
+            for (auto it = replaced.find(*r); it != replaced.end();
+                 it = replaced.find(*r))
+              *r = it->second;
+    return changed;
+  }
+
+public:
+  explicit CfgSimplifier(Callable &cbl) : cbl{cbl} {}
+
+  int run() {
+    bool changed = true;
+    while (changed) {
+      changed = fold_branches();
+      changed = remove_unreachable() || changed;
+      changed = thread_jumps() || changed;
+      changed = merge_blocks() || changed;
+    }
+    return count;
+  }
+};
+
+} // namespace
+
+int simplify_cfg(Callable &cbl) { return CfgSimplifier{cbl}.run(); }
+
+} // namespace ssa
+} // namespace bx
@@ -0,0 +1,48 @@
+/**
+ * Copy propagation
+ *
+ * In SSA form the source of a copy is defined before the copy and never
+ * changes afterwards, so every use of the destination, phi arguments
+ * included, can read the source directly and the copy disappears. Chains of
+ * copies collapse whatever the order they are visited in, since each rewrite
+ * also redirects the copies further down the chain.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+int propagate_copies(Callable &cbl) {
+  DefUse du{cbl};
+  std::unordered_set<Instr const *> dead;
+  for (auto const &lab : cbl.schedule) {
+    for (auto const &instr : cbl.body.at(lab)->body) {
+      auto cp = std::dynamic_pointer_cast<Copy>(instr);
+      if (!cp || cp->dest.id == -1)
+        continue;
+      du.remove(instr);
+      du.replaceAllUsesWith(cp->dest, cp->src);
+      dead.insert(instr.get());
+    }
+  }
+  if (dead.empty())
+    return 0;
+  for (auto const &lab : cbl.schedule) {
+    auto &body = cbl.body.at(lab)->body;
+    body.erase(std::remove_if(body.begin(), body.end(),
+                              [&](InstrPtr const &instr) {
+                                return dead.count(instr.get()) != 0;
+                              }),
+               body.end());
+  }
+  return static_cast<int>(dead.size());
+}
+
+} // namespace ssa
+} // namespace bx
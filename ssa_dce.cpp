@@ -0,0 +1,68 @@
+/**
+ * Aggressive dead code elimination
+ *
+ * Mark and sweep: stores, calls, returns and the control flow instructions
+ * are live to begin with, and so is the definition of every pseudo a live
+ * instruction reads. Everything left unmarked computes a value nobody needs
+ * and is deleted.
+ *
+ * A branch is live until CFG simplification finds that both its arms lead to
+ * the same place, which usually takes this pass emptying them first, so
+ * ssa::optimize runs the two in turn until the CFG stops changing.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+bool is_root(InstrPtr const &instr) {
+  return std::dynamic_pointer_cast<Store>(instr) ||
+         std::dynamic_pointer_cast<Call>(instr) ||
+         std::dynamic_pointer_cast<Return>(instr) ||
+         std::dynamic_pointer_cast<Ubranch>(instr) ||
+         std::dynamic_pointer_cast<Bbranch>(instr) ||
+         std::dynamic_pointer_cast<Goto>(instr);
+}
+
+} // namespace
+
+int eliminate_dead_code(Callable &cbl) {
+  DefUse du{cbl};
+  std::unordered_set<Instr const *> live;
+  std::vector<InstrPtr> work;
+  for (auto const &lab : cbl.schedule)
+    for (auto const &instr : cbl.body.at(lab)->body)
+      if (is_root(instr) && live.insert(instr.get()).second)
+        work.push_back(instr);
+  while (!work.empty()) {
+    auto instr = work.back();
+    work.pop_back();
+    for (auto *r : instr->getReads()) {
+      auto def = du.def(*r);
+      if (def && live.insert(def.get()).second)
+        work.push_back(def);
+    }
+  }
+
+  int count = 0;
+  for (auto const &lab : cbl.schedule) {
+    auto &body = cbl.body.at(lab)->body;
+    auto end = std::remove_if(body.begin(), body.end(), [&](InstrPtr const &instr) {
+      return live.count(instr.get()) == 0;
+    });
+    count += static_cast<int>(body.end() - end);
+    body.erase(end, body.end());
+  }
+  return count;
+}
+
+} // namespace ssa
+} // namespace bx
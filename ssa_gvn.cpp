@@ -0,0 +1,222 @@
+/**
+ * Dominator-scoped global value numbering
+ *
+ * The blocks are walked in a preorder of the dominator tree with a scoped
+ * table from expressions to the pseudo that first computed them: anything
+ * available on entry to a block was computed in one of its dominators, so a
+ * second computation of the same expression can be replaced by the first.
+ *
+ * Copies get the number of their source. Loads are only valid as long as
+ * memory has not changed, so their table is cleared by every call and every
+ * store (which then makes its own value available to later loads), and a
+ * block only inherits the loads of its immediate dominator when that
+ * dominator is its sole predecessor.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+#include "dominators.h"
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+struct Expr {
+  enum Kind { MOVE, UNOP, BINOP, PHI } kind;
+  int opcode;
+  int64_t cst;
+  Label block; // phis only merge the same values within a block
+  std::vector<Pseudo> args;
+
+  bool operator==(Expr const &other) const {
+    return kind == other.kind && opcode == other.opcode && cst == other.cst &&
+           block == other.block && args.size() == other.args.size() &&
+           std::equal(args.begin(), args.end(), other.args.begin(), PseudoEq{});
+  }
+};
+
+struct ExprHash {
+  std::size_t operator()(Expr const &e) const noexcept {
+    std::size_t h = std::hash<int>{}(e.kind);
+    auto mix = [&](std::size_t v) { h ^= v + 0x9e3779b9 + (h << 6) + (h >> 2); };
+    mix(std::hash<int>{}(e.opcode));
+    mix(std::hash<int64_t>{}(e.cst));
+    mix(std::hash<int>{}(e.block.id));
+    for (auto const &a : e.args)
+      mix(PseudoHash{}(a));
+    return h;
+  }
+};
+
+bool commutative(Binop::Code op) {
+  switch (op) {
+  case Binop::Code::ADD:
+  case Binop::Code::MUL:
+  case Binop::Code::AND:
+  case Binop::Code::OR:
+  case Binop::Code::XOR:
+    return true;
+  default:
+    return false;
+  }
+}
+
+using LoadTable = std::map<std::pair<std::string, int>, Pseudo>;
+
+class ValueNumberer {
+private:
+  Callable &cbl;
+  DomTree dom;
+  DefUse du;
+  std::unordered_map<Expr, Pseudo, ExprHash> available;
+  // Entries added in each open scope, undone when the scope is left
+  std::vector<std::vector<Expr>> scopes;
+  std::unordered_set<Instr const *> dead;
+  PseudoMap<Pseudo> copy_of; // copies share the number of their source
+  int count = 0;
+
+  Pseudo canon(Pseudo const &ps) const {
+    auto it = copy_of.find(ps);
+    return it == copy_of.end() ? ps : it->second;
+  }
+
+  /** The key of an instruction whose result only depends on its operands */
+  bool key(Label const &lab, InstrPtr const &instr, Expr &e) const {
+    if (auto mv = std::dynamic_pointer_cast<Move>(instr)) {
+      e = Expr{Expr::MOVE, 0, mv->source, Label{-1}, {}};
+    } else if (auto uo = std::dynamic_pointer_cast<Unop>(instr)) {
+      e = Expr{Expr::UNOP, static_cast<int>(uo->opcode), 0, Label{-1},
+               {canon(uo->arg)}};
+    } else if (auto bo = std::dynamic_pointer_cast<Binop>(instr)) {
+      e = Expr{Expr::BINOP, static_cast<int>(bo->opcode), 0, Label{-1},
+               {canon(bo->src1), canon(bo->src2)}};
+      if (commutative(bo->opcode) &&
+          std::make_pair(e.args[1].id, e.args[1].version) <
+              std::make_pair(e.args[0].id, e.args[0].version))
+        std::swap(e.args[0], e.args[1]);
+    } else if (auto fi = std::dynamic_pointer_cast<Phi>(instr)) {
+      e = Expr{Expr::PHI, 0, 0, lab, {}};
+      // Pair each argument with its predecessor so that order does not matter
+      std::vector<std::pair<int, Pseudo>> incoming;
+      for (std::size_t i = 0; i < fi->args.size(); i++)
+        incoming.push_back({fi->preds[i].id, canon(fi->args[i])});
+      std::sort(incoming.begin(), incoming.end(),
+                [](auto const &a, auto const &b) { return a.first < b.first; });
+      for (auto const &in : incoming) {
+        e.args.push_back(Pseudo{in.first, -2});
+        e.args.push_back(in.second);
+      }
+    } else {
+      return false;
+    }
+    return true;
+  }
+
+  void replace(InstrPtr const &instr, Pseudo const &by) {
+    auto dest = *instr->getWrite();
+    du.remove(instr);
+    du.replaceAllUsesWith(dest, by);
+    dead.insert(instr.get());
+    count++;
+  }
+
+  void number(int b, LoadTable &loads) {
+    auto const &lab = dom.order[b];
+    for (auto const &instr : cbl.body.at(lab)->body) {
+      if (auto cp = std::dynamic_pointer_cast<Copy>(instr)) {
+        copy_of[cp->dest] = canon(cp->src);
+        continue;
+      }
+      if (auto st = std::dynamic_pointer_cast<Store>(instr)) {
+        // Later loads of the same global read back the stored value
+        loads.clear();
+        loads.insert({{st->dest, st->offset}, st->src});
+        continue;
+      }
+      if (std::dynamic_pointer_cast<Call>(instr)) {
+        loads.clear();
+        continue;
+      }
+      if (auto ld = std::dynamic_pointer_cast<Load>(instr)) {
+        auto slot = std::make_pair(ld->src, ld->offset);
+        auto it = loads.find(slot);
+        if (it != loads.end())
+          replace(instr, it->second);
+        else
+          loads.insert({slot, ld->dest});
+        continue;
+      }
+      Expr e;
+      if (!key(lab, instr, e))
+        continue;
+      auto it = available.find(e);
+      if (it != available.end()) {
+        replace(instr, it->second);
+        continue;
+      }
+      available.insert({e, *instr->getWrite()});
+      scopes.back().push_back(std::move(e));
+    }
+  }
+
+public:
+  explicit ValueNumberer(Callable &cbl) : cbl{cbl}, dom{cbl}, du{cbl} {}
+
+  int run() {
+    struct Frame {
+      int block;
+      std::size_t next_child;
+      LoadTable loads;
+    };
+    std::vector<Frame> stack;
+    stack.push_back({0, 0, {}});
+    scopes.emplace_back();
+    number(0, stack.back().loads);
+    while (!stack.empty()) {
+      auto &top = stack.back();
+      auto const &kids = dom.children[top.block];
+      if (top.next_child < kids.size()) {
+        int child = kids[top.next_child++];
+        bool straight =
+            dom.preds[child].size() == 1 && dom.preds[child][0] == top.block;
+        stack.push_back({child, 0, straight ? top.loads : LoadTable{}});
+        scopes.emplace_back();
+        number(child, stack.back().loads);
+        continue;
+      }
+      for (auto const &e : scopes.back())
+        available.erase(e);
+      scopes.pop_back();
+      stack.pop_back();
+    }
+    if (count == 0)
+      return 0;
+    for (auto const &lab : cbl.schedule) {
+      auto &body = cbl.body.at(lab)->body;
+      body.erase(std::remove_if(body.begin(), body.end(),
+                                [&](InstrPtr const &instr) {
+                                  return dead.count(instr.get()) != 0;
+                                }),
+                 body.end());
+    }
+    return count;
+  }
+};
+
+} // namespace
+
+int number_values(Callable &cbl) { return ValueNumberer{cbl}.run(); }
+
+} // namespace ssa
+} // namespace bx
@@ -0,0 +1,291 @@
+/**
+ * Function inlining
+ *
+ * The call graph is split into strongly connected components, which are
+ * processed callees first, so a callee has already absorbed its own small
+ * callees when it is considered for inlining. Calls within a component
+ * (recursion) are never inlined.
+ *
+ * A call is inlined when the size of the callee, less the instructions the
+ * call itself costs, fits the threshold. Calls inside loops are assumed to run
+ * more often and get a threshold doubled for every level of nesting (up to
+ * three), and no caller is allowed to grow beyond a fixed size.
+ *
+ * Inlining splits the calling block after the call. The callee blocks are
+ * cloned with fresh labels and fresh pseudo ids (the versions are kept), its
+ * parameters are replaced by the arguments of the call, and each return
+ * becomes a jump to the rest of the calling block, where a phi merges the
+ * returned values into the result of the call.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "dominators.h"
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+constexpr int max_caller_size = 10000;
+
+int size_of(Callable const &cbl) {
+  int size = 0;
+  for (auto const &blc : cbl.body)
+    for (auto const &instr : blc.second->body)
+      if (!std::dynamic_pointer_cast<Phi>(instr) &&
+          !std::dynamic_pointer_cast<Goto>(instr))
+        size++;
+  return size;
+}
+
+} // namespace
+
+std::vector<std::vector<int>>
+call_graph_sccs(std::vector<std::vector<int>> const &calls) {
+  int n = static_cast<int>(calls.size());
+  std::vector<std::vector<int>> result;
+  std::vector<int> index(n, -1), low(n, 0), stack;
+  std::vector<bool> on_stack(n, false);
+  std::vector<std::pair<int, std::size_t>> frames;
+  int counter = 0;
+  for (int root = 0; root < n; root++) {
+    if (index[root] != -1)
+      continue;
+    frames.push_back({root, 0});
+    index[root] = low[root] = counter++;
+    stack.push_back(root);
+    on_stack[root] = true;
+    while (!frames.empty()) {
+      int v = frames.back().first;
+      if (frames.back().second < calls[v].size()) {
+        int w = calls[v][frames.back().second++];
+        if (index[w] == -1) {
+          index[w] = low[w] = counter++;
+          stack.push_back(w);
+          on_stack[w] = true;
+          frames.push_back({w, 0});
+        } else if (on_stack[w]) {
+          low[v] = std::min(low[v], index[w]);
+        }
+        continue;
+      }
+      frames.pop_back();
+      if (!frames.empty())
+        low[frames.back().first] = std::min(low[frames.back().first], low[v]);
+      if (low[v] != index[v])
+        continue;
+      std::vector<int> scc;
+      int w;
+      do {
+        w = stack.back();
+        stack.pop_back();
+        on_stack[w] = false;
+        scc.push_back(w);
+      } while (w != v);
+      result.push_back(std::move(scc));
+    }
+  }
+  return result;
+}
+
+namespace {
+
+class Inliner {
+private:
+  int threshold;
+  CalleeLookup const &lookup;
+  int count = 0;
+
+  /** Loop nesting depth of every block of the caller */
+  rtl::LabelMap<int> loop_depths(Callable const &cbl) {
+    DomTree dom{cbl};
+    rtl::LabelMap<int> depth;
+    for (auto const &loop : find_loops(dom))
+      for (int b : loop.blocks)
+        depth[dom.order[b]]++;
+    return depth;
+  }
+
+  bool worth_it(Callable const &callee, Call const &call, int depth,
+                int caller_size, int callee_size) const {
+    int saved = static_cast<int>(call.args.size()) + 2; // call, return, moves
+    int budget = threshold << std::min(depth, 3);
+    return callee_size - saved <= budget &&
+           caller_size + callee_size <= max_caller_size &&
+           !callee.body.empty();
+  }
+
+  /**
+   * Replace the call at position pos of block lab by a copy of the callee.
+   * Returns the label of the block holding the instructions after the call.
+   */
+  Label expand(Callable &caller, Label const &lab, std::size_t pos,
+               Callable const &callee) {
+    auto &blk = *caller.body.at(lab);
+    auto call = std::dynamic_pointer_cast<Call>(blk.body[pos]);
+
+    // The rest of the block moves to a new block, which its successors now
+    // see as their predecessor
+    auto rest = rtl::fresh_label();
+    std::vector<InstrPtr> rest_body(blk.body.begin() + pos + 1, blk.body.end());
+    for (auto const &out : blk.outlabels)
+      for (auto &instr : caller.body.at(out)->body)
+        if (auto phi = std::dynamic_pointer_cast<Phi>(instr))
+          std::replace(phi->preds.begin(), phi->preds.end(), lab, rest);
+    auto rest_outs = blk.outlabels;
+
+    rtl::LabelMap<Label> labels;
+    for (auto const &l : callee.schedule)
+      labels[l] = rtl::fresh_label();
+    std::unordered_map<int, int> ids;
+    PseudoMap<Pseudo> params;
+    for (std::size_t i = 0; i < callee.input_regs.size(); i++)
+      params[callee.input_regs[i]] = call->args[i];
+    auto rename = [&](Pseudo &ps) {
+      if (ps.id == -1)
+        return;
+      auto param = params.find(ps);
+      if (param != params.end()) {
+        ps = param->second;
+        return;
+      }
+      auto it = ids.find(ps.id);
+      if (it == ids.end())
+        it = ids.insert({ps.id, rtl::fresh_pseudo().id}).first;
+      ps.id = it->second;
+    };
+
+    std::vector<Pseudo> results;
+    std::vector<Label> result_preds;
+    std::vector<Label> cloned;
+    for (auto const &l : callee.schedule) {
+      auto const &src = *callee.body.at(l);
+      std::vector<InstrPtr> body;
+      std::vector<Label> outs;
+      for (auto const &out : src.outlabels)
+        outs.push_back(labels.at(out));
+      for (auto const &instr : src.body) {
+        if (auto ret = std::dynamic_pointer_cast<Return>(instr)) {
+          auto value = ret->arg;
+          rename(value);
+          results.push_back(value);
+          result_preds.push_back(labels.at(l));
+          body.push_back(Goto::make());
+          outs = {rest};
+          break;
+        }
+        auto copy = instr->clone();
+        for (auto *r : copy->getReads())
+          rename(*r);
+        if (auto *w = copy->getWrite())
+          rename(*w);
+        if (auto phi = std::dynamic_pointer_cast<Phi>(copy))
+          for (auto &pred : phi->preds)
+            pred = labels.at(pred);
+        body.push_back(copy);
+      }
+      caller.body.insert_or_assign(labels.at(l), BBlock::make(outs, body));
+      cloned.push_back(labels.at(l));
+    }
+
+    if (call->ret.id != -1 && !results.empty()) {
+      auto phi = Phi::make(results, call->ret);
+      phi->preds = result_preds;
+      rest_body.insert(rest_body.begin(), phi);
+    }
+    blk.body.resize(pos);
+    blk.body.push_back(Goto::make());
+    blk.outlabels = {labels.at(callee.enter)};
+    caller.body.insert_or_assign(rest, BBlock::make(rest_outs, rest_body));
+
+    auto at = std::find(caller.schedule.begin(), caller.schedule.end(), lab) + 1;
+    at = caller.schedule.insert(at, cloned.begin(), cloned.end()) + cloned.size();
+    caller.schedule.insert(at, rest);
+    count++;
+    return rest;
+  }
+
+public:
+  Inliner(int threshold, CalleeLookup const &lookup)
+      : threshold{threshold}, lookup{lookup} {}
+
+  int inline_into(Callable &caller) {
+    rtl::Numbering::Scope scope{caller.numbering};
+    auto depths = loop_depths(caller);
+    int caller_size = size_of(caller);
+    std::vector<std::pair<Label, int>> work;
+    for (auto const &l : caller.schedule)
+      work.push_back({l, depths[l]});
+    while (!work.empty()) {
+      auto lab = work.back().first;
+      int depth = work.back().second;
+      work.pop_back();
+      auto &body = caller.body.at(lab)->body;
+      for (std::size_t pos = 0; pos < body.size(); pos++) {
+        auto call = std::dynamic_pointer_cast<Call>(body[pos]);
+        if (!call)
+          continue;
+        auto const *callee = lookup(call->func);
+        if (!callee)
+          continue;
+        auto const &callee_cbl = *callee;
+        int callee_size = size_of(callee_cbl);
+        if (!worth_it(callee_cbl, *call, depth, caller_size, callee_size))
+          continue;
+        caller_size += callee_size;
+        work.push_back({expand(caller, lab, pos, callee_cbl), depth});
+        break;
+      }
+    }
+    return count;
+  }
+};
+
+} // namespace
+
+int inline_calls(Callable &caller, CalleeLookup const &lookup, int threshold) {
+  return Inliner{threshold, lookup}.inline_into(caller);
+}
+
+int inline_calls(Program &prog, int threshold) {
+  std::unordered_map<std::string, int> by_name;
+  for (int i = 0; i < static_cast<int>(prog.size()); i++)
+    by_name[prog[i].name] = i;
+  std::vector<std::vector<int>> calls(prog.size());
+  for (int i = 0; i < static_cast<int>(prog.size()); i++)
+    for (auto const &blc : prog[i].body)
+      for (auto const &instr : blc.second->body)
+        if (auto call = std::dynamic_pointer_cast<Call>(instr)) {
+          auto it = by_name.find(call->func);
+          if (it != by_name.end())
+            calls[i].push_back(it->second);
+        }
+  auto sccs = call_graph_sccs(calls);
+  std::vector<int> component(prog.size(), -1);
+  for (int c = 0; c < static_cast<int>(sccs.size()); c++)
+    for (int f : sccs[c])
+      component[f] = c;
+  int caller = -1;
+  CalleeLookup lookup = [&](std::string const &func) -> Callable const * {
+    auto it = by_name.find(func);
+    if (it == by_name.end() || component[it->second] == component[caller])
+      return nullptr;
+    return &prog[it->second];
+  };
+  int count = 0;
+  for (auto const &scc : sccs)
+    for (int f : scc) {
+      caller = f;
+      count += inline_calls(prog[f], lookup, threshold);
+    }
+  return count;
+}
+
+} // namespace ssa
+} // namespace bx
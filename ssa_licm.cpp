@@ -0,0 +1,183 @@
+/**
+ * Loop-invariant code motion
+ *
+ * Natural loops are found from the back edges of the CFG, i.e. the edges
+ * whose target dominates their source; the loops sharing a header are merged.
+ * Every loop first gets a preheader, a block that is the only way into the
+ * header from outside the loop. Then, from the innermost loop outwards, the
+ * side-effect free instructions whose operands are all defined outside the
+ * loop (or by instructions already hoisted) are moved to the end of the
+ * preheader. Since a preheader lies inside any enclosing loop, invariants
+ * keep moving outwards as long as they stay invariant.
+ *
+ * Global loads are hoisted when the loop neither stores to that global nor
+ * calls anything but the runtime printing functions.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <string>
+#include <unordered_set>
+#include <vector>
+
+#include "dominators.h"
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+/** Calls that cannot read or write a BX global */
+bool pure_runtime(std::string const &func) {
+  return func == "bx_print_int" || func == "bx_print_bool";
+}
+
+class LoopHoister {
+private:
+  Callable &cbl;
+  int count = 0;
+
+  /**
+   * Make sure the header has a single predecessor outside the loop whose only
+   * successor is the header, creating one if necessary.
+   */
+  Label preheader(DomTree const &dom, Loop const &loop) {
+    int h = dom.index.at(loop.header);
+    std::vector<int> outside;
+    for (int p : dom.preds[h])
+      if (!std::binary_search(loop.blocks.begin(), loop.blocks.end(), p) &&
+          std::find(outside.begin(), outside.end(), p) == outside.end())
+        outside.push_back(p);
+    if (outside.size() == 1 && dom.succs[outside[0]].size() == 1)
+      return dom.order[outside[0]];
+
+    auto pre = rtl::fresh_label();
+    std::vector<Label> outside_labels;
+    for (int p : outside) {
+      outside_labels.push_back(dom.order[p]);
+      for (auto &out : cbl.body.at(dom.order[p])->outlabels)
+        if (out == loop.header)
+          out = pre;
+    }
+    auto is_outside = [&](Label const &l) {
+      return std::find(outside_labels.begin(), outside_labels.end(), l) !=
+             outside_labels.end();
+    };
+    std::vector<InstrPtr> pre_body;
+    for (auto &instr : cbl.body.at(loop.header)->body) {
+      auto phi = std::dynamic_pointer_cast<Phi>(instr);
+      if (!phi)
+        break;
+      // The header keeps the arguments from inside the loop, the others are
+      // merged in the preheader
+      std::vector<Pseudo> args, pre_args;
+      std::vector<Label> preds, pre_preds;
+      for (std::size_t i = 0; i < phi->args.size(); i++) {
+        bool out = is_outside(phi->preds[i]);
+        (out ? pre_args : args).push_back(phi->args[i]);
+        (out ? pre_preds : preds).push_back(phi->preds[i]);
+      }
+      auto merged = pre_args.front();
+      bool same = std::all_of(pre_args.begin(), pre_args.end(),
+                              [&](Pseudo const &a) { return PseudoEq{}(a, merged); });
+      if (!same) {
+        merged = cbl.fresh_version(phi->dest.id);
+        auto pre_phi = Phi::make(pre_args, merged);
+        pre_phi->preds = pre_preds;
+        pre_body.push_back(pre_phi);
+      }
+      args.push_back(merged);
+      preds.push_back(pre);
+      phi->args = std::move(args);
+      phi->preds = std::move(preds);
+    }
+    pre_body.push_back(Goto::make());
+    cbl.body.insert_or_assign(
+        pre, BBlock::make(std::vector<Label>{loop.header}, pre_body));
+    auto pos = std::find(cbl.schedule.begin(), cbl.schedule.end(), loop.header);
+    cbl.schedule.insert(pos, pre);
+    return pre;
+  }
+
+  bool hoistable(InstrPtr const &instr, std::unordered_set<std::string> const &stored,
+                 bool calls) const {
+    if (auto bo = std::dynamic_pointer_cast<Binop>(instr))
+      // A division could fault on an iteration that would never run it
+      return bo->opcode != Binop::Code::DIV && bo->opcode != Binop::Code::REM;
+    if (auto ld = std::dynamic_pointer_cast<Load>(instr))
+      return !calls && stored.count(ld->src) == 0;
+    return std::dynamic_pointer_cast<Move>(instr) ||
+           std::dynamic_pointer_cast<Copy>(instr) ||
+           std::dynamic_pointer_cast<Unop>(instr);
+  }
+
+  void hoist(DomTree const &dom, Loop const &loop, Label const &pre) {
+    std::unordered_set<std::string> stored;
+    bool calls = false;
+    PseudoMap<bool> inside; // pseudos defined in the loop
+    for (int b : loop.blocks) {
+      for (auto const &instr : cbl.body.at(dom.order[b])->body) {
+        if (auto st = std::dynamic_pointer_cast<Store>(instr))
+          stored.insert(st->dest);
+        if (auto c = std::dynamic_pointer_cast<Call>(instr))
+          calls = calls || !pure_runtime(c->func);
+        if (auto *w = instr->getWrite())
+          inside[*w] = true;
+      }
+    }
+    auto &pre_body = cbl.body.at(pre)->body;
+    // Blocks in reverse postorder see definitions before their uses
+    for (int b : loop.blocks) {
+      auto &body = cbl.body.at(dom.order[b])->body;
+      std::vector<InstrPtr> kept;
+      for (auto &instr : body) {
+        bool invariant = hoistable(instr, stored, calls);
+        for (auto *r : instr->getReads())
+          invariant = invariant && inside.count(*r) == 0;
+        if (!invariant) {
+          kept.push_back(instr);
+          continue;
+        }
+        inside.erase(*instr->getWrite());
+        pre_body.insert(pre_body.end() - 1, instr);
+        count++;
+      }
+      body = std::move(kept);
+    }
+  }
+
+public:
+  explicit LoopHoister(Callable &cbl) : cbl{cbl} {}
+
+  int run() {
+    {
+      DomTree dom{cbl};
+      auto loops = find_loops(dom);
+      if (loops.empty())
+        return 0;
+      for (auto const &loop : loops)
+        preheader(dom, loop);
+    }
+    // The preheaders changed the CFG, so look at the loops again
+    DomTree dom{cbl};
+    auto loops = find_loops(dom);
+    std::stable_sort(loops.begin(), loops.end(),
+                     [](Loop const &a, Loop const &b) {
+                       return a.blocks.size() < b.blocks.size();
+                     });
+    for (auto const &loop : loops)
+      hoist(dom, loop, preheader(dom, loop));
+    return count;
+  }
+};
+
+} // namespace
+
+int hoist_invariants(Callable &cbl) {
+  rtl::Numbering::Scope scope{cbl.numbering};
+  return LoopHoister{cbl}.run();
+}
+
+} // namespace ssa
+} // namespace bx
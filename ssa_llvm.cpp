@@ -22,23 +22,23 @@
 #include "ssa_llvm.h"
 #include "rtl.h"
 
-int condCounter = 0;
-
-int Counter = 0;
-
-std::map<std::string, std::string> type_table;
-
-
 namespace bx {
 
 using namespace llvm;
 
+namespace {
+
 class InstrCompiler : public ssa::InstrVisitor {
 private:
   source::Program::GlobalVarTable const &global_vars;
 
   std::string funcname;
 
+  LlvmTypes const &types;
+
+  // LLVM values are named x0, x1, ... in each callable
+  int counter = 0;
+
   LlvmProgram body{};
 
   void append(std::shared_ptr<Llvm> line) { body.push_back(std::move(line)); }
@@ -56,8 +56,8 @@ public:
 
   std::string translate(ssa::Pseudo const ps){
     if (translation.find(ps) == translation.end()){
-      translation[ps] = "x" + std::to_string(Counter);
-      Counter++;
+      translation[ps] = "x" + std::to_string(counter);
+      counter++;
       return translation[ps];
     }
     else{
@@ -71,8 +71,8 @@ public:
 
   
   InstrCompiler(source::Program::GlobalVarTable const &global_vars,
-                std::string funcname, std::string type)
-      : global_vars{global_vars}, funcname{funcname}, type{type} {
+                std::string funcname, std::string type, LlvmTypes const &types)
+      : global_vars{global_vars}, funcname{funcname}, types{types}, type{type} {
 
   }
 
@@ -111,41 +111,50 @@ public:
 
   void visit(rtl::Label const &, ssa::Store const &st) override {
     std::string src = translate(st.src);
-    append(Llvm::load(st.dest, "i64", "i64", src));
+    append(Llvm::store(src, "i64", "i64", st.dest));
   }
 
+  // Like the AMD64 instructions, dest = src2 op src1
   void visit(rtl::Label const &, ssa::Binop const &bo) override {
     std::string src1 = translate(bo.src1);
     std::string src2 = translate(bo.src2);
     std::string dest = translate(bo.dest);
     switch (bo.opcode) {
     case rtl::Binop::ADD:
-      append(Llvm::addq(dest, "i64", src1, src2));
+      append(Llvm::addq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::SUB:
-      append(Llvm::subq(dest, "i64", src1, src2));
+      append(Llvm::subq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::AND:
-      append(Llvm::andq(dest, "i64", src1, src2));
+      append(Llvm::andq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::OR:
-      append(Llvm::orq(dest, "i64", src1, src2));
+      append(Llvm::orq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::XOR:
-      append(Llvm::xorq(dest, "i64", src1, src2));
+      append(Llvm::xorq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::MUL:
-      append(Llvm::mulq(dest, "i64", src1, src2));
+      append(Llvm::mulq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::DIV:
-      append(Llvm::udivq(dest, "i64", src1, src2));
+      append(Llvm::sdivq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::REM:
+      append(Llvm::sremq(dest, "i64", src2, src1));
       break;
     case rtl::Binop::SAL:
-      break;
-    case rtl::Binop::SAR:
-      break;
+    case rtl::Binop::SAR: {
+      // shifting by 64 or more is poison in LLVM, but AMD64 masks the count
+      std::string count = "x" + std::to_string(counter);
+      counter++;
+      append(Llvm::andq(count, "i64", src1, 63));
+      if (bo.opcode == rtl::Binop::SAL)
+        append(Llvm::shlq(dest, "i64", src2, count));
+      else
+        append(Llvm::ashrq(dest, "i64", src2, count));
+    } break;
     }
   }
 
@@ -154,36 +163,35 @@ public:
     std::string arg = translate(uo.arg);
     switch (uo.opcode) {
     case rtl::Unop::NEG:
-      append(Llvm::mulq(dest, "i64", arg, -1));
+      append(Llvm::subq(dest, "i64", 0, arg));
       break;
     case rtl::Unop::NOT:
-      append(Llvm::xorq(dest, "i64", arg, 1));
+      append(Llvm::xorq(dest, "i64", arg, -1));
       break;
     }
   }
 
   void visit(rtl::Label const &, ssa::Ubranch const &ub) override {
     std::string arg = translate(ub.arg);
-    std::string cond = "x" + std::to_string(Counter);
-    Counter++;
-    condCounter++;
+    std::string cond = "x" + std::to_string(counter);
+    counter++;
     switch (ub.opcode) {
     case rtl::Ubranch::JZ:
-      append(Llvm::eqq(cond, "i64", arg, 1));
+      append(Llvm::eqq(cond, "i64", arg, 0));
       break;
     case rtl::Ubranch::JNZ:
-      append(Llvm::neq(cond, "i64", arg, 1));
+      append(Llvm::neq(cond, "i64", arg, 0));
       break;
     }
     append(Llvm::br_cond(cond, "L" + std::to_string(outlabels[0].id), 
-          std::to_string(outlabels[1].id)));
+          "L" + std::to_string(outlabels[1].id)));
   }
 
   void visit(rtl::Label const &, ssa::Bbranch const &bb) override {
     std::string arg1 = translate(bb.arg1);
     std::string arg2 = translate(bb.arg2);
-    std::string cond = "x" + std::to_string(Counter);
-    Counter++;
+    std::string cond = "x" + std::to_string(counter);
+    counter++;
     switch (bb.opcode) {
     case rtl::Bbranch::JE:
       append(Llvm::eqq(cond, "i64", arg1, arg2));
@@ -219,7 +227,8 @@ public:
       std::vector<std::string> foo{"i64", arg};
       args.push_back(foo);
     }
-    append(Llvm::call(c.func, type_table[c.func], args));
+    std::string result = c.ret.id == -1 ? "" : translate(c.ret);
+    append(Llvm::call(c.func, types.at(c.func), args, result));
   }
 
   void visit(rtl::Label const &, ssa::Return const &r) override {
@@ -250,9 +259,32 @@ public:
   }
 };
 
-LlvmProgram llvm_generate(source::Program::GlobalVarTable const &global_vars,
-                        ssa::Program const &prog) {
+} // namespace
+
+LlvmTypes llvm_types(ssa::Program const &prog) {
+  LlvmTypes types;
+  types["bx_print_int"] = "void";
+  types["bx_print_bool"] = "void";
+  for (auto const &cbl : prog)
+    types[cbl.name] = cbl.type;
+  return types;
+}
+
+LlvmTypes llvm_types(source::Program const &prog) {
+  LlvmTypes types;
+  types["bx_print_int"] = "void";
+  types["bx_print_bool"] = "void";
+  for (auto const &cbl : prog.callables)
+    types[cbl.first] = cbl.second->return_ty == source::Type::UNKNOWN
+                           ? "void"
+                           : "i64";
+  return types;
+}
+
+LlvmProgram llvm_globals(source::Program::GlobalVarTable const &global_vars) {
   LlvmProgram llvm_prog;
+  llvm_prog.push_back(Llvm::declare("bx_print_int", "void", 1));
+  llvm_prog.push_back(Llvm::declare("bx_print_bool", "void", 1));
   for (auto const &v : global_vars) {
     switch (v.second->ty) {
     case source::Type::BOOL: {
@@ -270,23 +302,30 @@ LlvmProgram llvm_generate(source::Program::GlobalVarTable const &global_vars,
       throw std::runtime_error("Invalid global variable");
     }
   }
-  type_table["bx_print_int"] = "void";
-  for (auto const &cbl : prog) {
-    type_table[cbl.name] = cbl.type;
-  }
-  for (auto const &cbl : prog) {
-    InstrCompiler icomp{global_vars, cbl.name, cbl.type};
-    icomp.args = cbl.input_regs;
-    for (auto const &l : cbl.schedule) {
-      icomp.append_label(l);
-      icomp.outlabels = cbl.body.at(l)->outlabels;
-      for (auto &instr : cbl.body.at(l)->body){
-        instr->accept(l, icomp);
-      }
+  return llvm_prog;
+}
+
+LlvmProgram llvm_generate(source::Program::GlobalVarTable const &global_vars,
+                          ssa::Callable const &cbl, LlvmTypes const &types) {
+  InstrCompiler icomp{global_vars, cbl.name, cbl.type, types};
+  icomp.args = cbl.input_regs;
+  for (auto const &l : cbl.schedule) {
+    icomp.append_label(l);
+    icomp.outlabels = cbl.body.at(l)->outlabels;
+    for (auto &instr : cbl.body.at(l)->body){
+      instr->accept(l, icomp);
     }
-    for (auto &i : icomp.finalize())
-      llvm_prog.push_back(std::move(i));
   }
+  return icomp.finalize();
+}
+
+LlvmProgram llvm_generate(source::Program::GlobalVarTable const &global_vars,
+                        ssa::Program const &prog) {
+  auto llvm_prog = llvm_globals(global_vars);
+  auto types = llvm_types(prog);
+  for (auto const &cbl : prog)
+    for (auto &i : llvm_generate(global_vars, cbl, types))
+      llvm_prog.push_back(std::move(i));
   return llvm_prog;
 }
 
@@ -1,5 +1,8 @@
 #pragma once
 
+#include <map>
+#include <string>
+
 #include "llvm.h"
 #include "ssa.h"
 
@@ -7,7 +10,25 @@ namespace bx {
 
 using LlvmProgram = std::vector<std::shared_ptr<llvm::Llvm>>;
 
+/** The LLVM return type of every callable, runtime functions included */
+using LlvmTypes = std::map<std::string, std::string>;
+
+LlvmTypes llvm_types(ssa::Program const &);
+
+/** The same, read off the source program before any of it is compiled */
+LlvmTypes llvm_types(source::Program const &);
+
+/** The definitions of the global variables */
+LlvmProgram llvm_globals(source::Program::GlobalVarTable const &);
+
+/**
+ * The definition of one callable. Its value names are its own, so callables
+ * can be compiled in any order or at the same time.
+ */
+LlvmProgram llvm_generate(source::Program::GlobalVarTable const &,
+                          ssa::Callable const &, LlvmTypes const &);
+
 LlvmProgram llvm_generate(source::Program::GlobalVarTable const &,
                         ssa::Program const &);
 
-} // namespace bx
\ No newline at end of file
+} // namespace bx
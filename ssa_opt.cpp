@@ -0,0 +1,35 @@
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+void optimize(Callable &cbl, PassStats &stats) {
+  stats["cfg"] += simplify_cfg(cbl);
+  stats["copyprop"] += propagate_copies(cbl);
+  stats["sccp"] += propagate_constants(cbl);
+  stats["gvn"] += number_values(cbl);
+  stats["licm"] += hoist_invariants(cbl);
+  stats["phi"] += remove_redundant_phis(cbl);
+  // Dead code leaves empty diamonds whose branch only CFG simplification can
+  // remove, and that in turn leaves the condition of the branch dead
+  for (bool changed = true; changed;) {
+    stats["dce"] += eliminate_dead_code(cbl);
+    int simplified = simplify_cfg(cbl);
+    stats["cfg"] += simplified;
+    changed = simplified > 0;
+  }
+}
+
+PassStats optimize(Program &prog, int inline_threshold) {
+  PassStats stats;
+  // Tail calls first, so that the loops they become can be inlined
+  for (auto &cbl : prog)
+    stats["tailcall"] += eliminate_tail_calls(cbl);
+  stats["inline"] += inline_calls(prog, inline_threshold);
+  for (auto &cbl : prog)
+    optimize(cbl, stats);
+  return stats;
+}
+
+} // namespace ssa
+} // namespace bx
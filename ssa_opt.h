@@ -0,0 +1,120 @@
+#pragma once
+
+#include <functional>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "ssa.h"
+
+/** Optimisation passes over the SSA representation */
+
+namespace bx {
+
+namespace ssa {
+
+/**
+ * Remove the phis that merge a single value (besides themselves), including
+ * groups of phis that only reference each other and one outside value.
+ * Returns the number of phis removed.
+ */
+int remove_redundant_phis(Callable &cbl);
+
+/**
+ * Turn self tail calls into jumps back to the start of the callable, whose
+ * enter block becomes a loop header with a phi for every parameter. Returns
+ * the number of calls removed.
+ */
+int eliminate_tail_calls(Callable &cbl);
+
+/**
+ * Copy propagation: every use of a copy's destination, phi arguments
+ * included, reads its source instead and the copy is deleted. Returns the
+ * number of copies removed.
+ */
+int propagate_copies(Callable &cbl);
+
+/**
+ * Sparse conditional constant propagation: folds the pseudos that are
+ * constant on every path that can run into moves, turns branches with a
+ * known outcome into gotos and deletes the blocks that cannot be reached.
+ * Returns the number of instructions folded or removed.
+ */
+int propagate_constants(Callable &cbl);
+
+/**
+ * Dominator-scoped value numbering: a move, unop, binop, phi or global load
+ * that recomputes a value already available in a dominator is deleted and
+ * its uses are redirected. Returns the number of instructions removed.
+ */
+int number_values(Callable &cbl);
+
+/**
+ * Loop-invariant code motion: gives every natural loop a preheader and moves
+ * the loop-invariant moves, copies, unops, non-dividing binops and global
+ * loads there. Returns the number of instructions hoisted.
+ */
+int hoist_invariants(Callable &cbl);
+
+/**
+ * CFG simplification: folds branches with identical targets, deletes
+ * unreachable blocks, bypasses blocks that only jump on and merges blocks
+ * into their unique predecessor, keeping the phis in step. Returns the number
+ * of instructions removed or rewritten.
+ */
+int simplify_cfg(Callable &cbl);
+
+/**
+ * Aggressive dead code elimination: only stores, calls, returns, control
+ * flow and whatever they transitively read survive. Returns the number of
+ * instructions removed.
+ */
+int eliminate_dead_code(Callable &cbl);
+
+constexpr int default_inline_threshold = 20;
+
+/**
+ * Inline the calls whose callee is small enough: its size less the cost of
+ * the call must fit the threshold, which doubles for every level of loop
+ * nesting around the call. The call graph is processed callees first and
+ * recursive calls are left alone. Returns the number of calls inlined.
+ */
+int inline_calls(Program &prog, int threshold = default_inline_threshold);
+
+/**
+ * The callee of a given name to inline, or nullptr if calls to it must stay
+ * calls (e.g. it is not known, or recursion would make inlining go on
+ * forever)
+ */
+using CalleeLookup = std::function<Callable const *(std::string const &)>;
+
+/**
+ * Inline into a single caller, with the callees that lookup finds as they
+ * are. Returns the number of calls inlined.
+ */
+int inline_calls(Callable &caller, CalleeLookup const &lookup,
+                 int threshold = default_inline_threshold);
+
+/**
+ * The strongly connected components of a call graph, given by the callees of
+ * every callable (Tarjan). They come out callees first.
+ */
+std::vector<std::vector<int>>
+call_graph_sccs(std::vector<std::vector<int>> const &calls);
+
+/** Number of instructions each pass removed or rewrote, keyed by pass name */
+using PassStats = std::map<std::string, int>;
+
+/**
+ * The passes that run on each callable once inlining is done, which only
+ * look at the callable itself. Adds to stats.
+ */
+void optimize(Callable &cbl, PassStats &stats);
+
+/** Run the optimisation pipeline over every callable of the program */
+PassStats optimize(Program &prog,
+                   int inline_threshold = default_inline_threshold);
+
+} // namespace ssa
+
+} // namespace bx
@@ -0,0 +1,196 @@
+/**
+ * Redundant phi elimination
+ *
+ * This follows the SCC-based algorithm of Braun et al., "Simple and Efficient
+ * Construction of Static Single Assignment Form" (CC 2013). A set of phis
+ * that are strongly connected through their arguments and receive a single
+ * value from outside the set is redundant: every phi in it can be replaced by
+ * that value. The SCCs are visited in topological order, so the arguments of
+ * a phi are final by the time it is examined, and every phi is looked at a
+ * bounded number of times rather than once per fixpoint iteration.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <vector>
+
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+class PhiEliminator {
+private:
+  Callable &cbl;
+  std::vector<std::shared_ptr<Phi>> phis;
+  PseudoMap<int> phi_of; // phi destination -> index in phis
+  DefUse du;
+  std::vector<bool> removed;
+  std::vector<int> set_stamp, scc_stamp, dfs_index, dfs_low;
+  std::vector<bool> on_stack;
+  int stamp = 0;
+  int count = 0;
+
+  /** The phi defining ps if it belongs to the set being examined, or -1 */
+  int phi_in_set(Pseudo const &ps, int set) const {
+    auto it = phi_of.find(ps);
+    if (it == phi_of.end() || set_stamp[it->second] != set)
+      return -1;
+    return it->second;
+  }
+
+  /**
+   * Tarjan's algorithm restricted to the given phis, with an explicit stack.
+   * SCCs come out in reverse topological order, i.e. operands first.
+   */
+  std::vector<std::vector<int>> sccs(std::vector<int> const &subset) {
+    int set = ++stamp;
+    for (int p : subset) {
+      set_stamp[p] = set;
+      dfs_index[p] = -1;
+    }
+    std::vector<std::vector<int>> result;
+    std::vector<int> scc_stack;
+    std::vector<std::pair<int, std::size_t>> call;
+    int counter = 0;
+    auto start = [&](int p) {
+      dfs_index[p] = dfs_low[p] = counter++;
+      scc_stack.push_back(p);
+      on_stack[p] = true;
+      call.push_back({p, 0});
+    };
+    for (int root : subset) {
+      if (dfs_index[root] != -1)
+        continue;
+      start(root);
+      while (!call.empty()) {
+        int p = call.back().first;
+        auto &args = phis[p]->args;
+        if (call.back().second < args.size()) {
+          int q = phi_in_set(args[call.back().second++], set);
+          if (q == -1)
+            continue;
+          if (dfs_index[q] == -1)
+            start(q);
+          else if (on_stack[q])
+            dfs_low[p] = std::min(dfs_low[p], dfs_index[q]);
+          continue;
+        }
+        call.pop_back();
+        if (!call.empty()) {
+          int parent = call.back().first;
+          dfs_low[parent] = std::min(dfs_low[parent], dfs_low[p]);
+        }
+        if (dfs_low[p] != dfs_index[p])
+          continue;
+        std::vector<int> scc;
+        int q;
+        do {
+          q = scc_stack.back();
+          scc_stack.pop_back();
+          on_stack[q] = false;
+          scc.push_back(q);
+        } while (q != p);
+        result.push_back(std::move(scc));
+      }
+    }
+    return result;
+  }
+
+  /**
+   * Replace the SCC by its unique outside value if there is one; otherwise
+   * the phis with only inner arguments may still form smaller redundant SCCs
+   * and are returned for another round.
+   */
+  std::vector<int> process(std::vector<int> const &scc) {
+    int members = ++stamp;
+    for (int p : scc)
+      scc_stamp[p] = members;
+    std::vector<Pseudo> outer;
+    std::vector<int> inner;
+    for (int p : scc) {
+      bool is_inner = true;
+      for (auto const &arg : phis[p]->args) {
+        auto it = phi_of.find(arg);
+        if (it != phi_of.end() && scc_stamp[it->second] == members)
+          continue;
+        is_inner = false;
+        if (outer.size() < 2 &&
+            std::find_if(outer.begin(), outer.end(), [&](Pseudo const &o) {
+              return PseudoEq{}(o, arg);
+            }) == outer.end())
+          outer.push_back(arg);
+      }
+      if (is_inner)
+        inner.push_back(p);
+    }
+    if (outer.size() == 1) {
+      for (int p : scc) {
+        removed[p] = true;
+        count++;
+        du.remove(phis[p]);
+      }
+      for (int p : scc)
+        du.replaceAllUsesWith(phis[p]->dest, outer[0]);
+      return {};
+    }
+    if (outer.size() > 1 && inner.size() < scc.size())
+      return inner;
+    return {};
+  }
+
+public:
+  explicit PhiEliminator(Callable &cbl) : cbl{cbl}, du{cbl} {
+    for (auto const &l : cbl.schedule) {
+      for (auto &instr : cbl.body.at(l)->body) {
+        if (auto fi = std::dynamic_pointer_cast<Phi>(instr)) {
+          phi_of[fi->dest] = static_cast<int>(phis.size());
+          phis.push_back(fi);
+        }
+      }
+    }
+    removed.assign(phis.size(), false);
+    set_stamp.assign(phis.size(), 0);
+    scc_stamp.assign(phis.size(), 0);
+    dfs_index.assign(phis.size(), -1);
+    dfs_low.assign(phis.size(), -1);
+    on_stack.assign(phis.size(), false);
+  }
+
+  int run() {
+    std::vector<std::vector<int>> work;
+    work.emplace_back();
+    for (int p = 0; p < static_cast<int>(phis.size()); p++)
+      work.back().push_back(p);
+    while (!work.empty()) {
+      auto subset = std::move(work.back());
+      work.pop_back();
+      for (auto const &scc : sccs(subset)) {
+        auto inner = process(scc);
+        if (!inner.empty())
+          work.push_back(std::move(inner));
+      }
+    }
+    if (count == 0)
+      return 0;
+    for (auto const &l : cbl.schedule) {
+      auto &body = cbl.body.at(l)->body;
+      body.erase(std::remove_if(body.begin(), body.end(),
+                                [&](InstrPtr const &instr) {
+                                  auto fi = std::dynamic_pointer_cast<Phi>(instr);
+                                  return fi && removed[phi_of.at(fi->dest)];
+                                }),
+                 body.end());
+    }
+    return count;
+  }
+};
+
+} // namespace
+
+int remove_redundant_phis(Callable &cbl) { return PhiEliminator{cbl}.run(); }
+
+} // namespace ssa
+} // namespace bx
@@ -0,0 +1,272 @@
+/**
+ * This file translates SSA back to RTL
+ *
+ * Classes:
+ *
+ *     bx::Lowerer:
+ *         A visitor that lays out the instructions of every block as RTL
+ *         and puts the phi copies on the edges
+ *
+ *  Functions
+ *
+ *     rtl::Callable rtl_generate(cbl)
+ *         The translation of one callable
+ *
+ *     rtl::Program rtl_generate(prog)
+ *         The main translation function
+ */
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+
+#include "ssa_rtl.h"
+
+namespace bx {
+
+namespace {
+
+using CopyList = std::vector<std::pair<rtl::Pseudo, rtl::Pseudo>>; // src, dest
+
+/**
+ * Order the parallel copy so that no destination is written before the
+ * copies that read its old value. Only cycles block that: one is broken by
+ * saving a destination in scratch and reading scratch instead. A single
+ * scratch pseudo does for all the cycles, since a broken cycle is drained
+ * completely before the next one gets stuck.
+ */
+CopyList sequentialise(CopyList pending, rtl::Pseudo const &scratch) {
+  CopyList out;
+  pending.erase(std::remove_if(pending.begin(), pending.end(),
+                               [](auto const &c) { return c.first == c.second; }),
+                pending.end());
+  auto read = [&](rtl::Pseudo const &ps) {
+    return std::any_of(pending.begin(), pending.end(),
+                       [&](auto const &c) { return c.first == ps; });
+  };
+  while (!pending.empty()) {
+    auto ready = std::find_if(pending.begin(), pending.end(),
+                              [&](auto const &c) { return !read(c.second); });
+    if (ready != pending.end()) {
+      out.push_back(*ready);
+      pending.erase(ready);
+      continue;
+    }
+    auto saved = pending.front().second;
+    out.push_back({saved, scratch});
+    for (auto &c : pending)
+      if (c.first == saved)
+        c.first = scratch;
+  }
+  return out;
+}
+
+} // namespace
+
+class Lowerer : public ssa::InstrVisitor {
+private:
+  ssa::Callable &ssa_cbl;
+  ssa::PseudoMap<rtl::Pseudo> names;
+  rtl::Pseudo scratch = rtl::discard_pr;
+
+  // The block being laid out and the label of its next instruction
+  ssa::Label block{-1};
+  rtl::Label cur{-1};
+  // Edge blocks, laid out after the block that jumps to them
+  std::vector<std::pair<rtl::Label, CopyList>> edges;
+  std::vector<rtl::Label> edge_targets;
+
+  rtl::Pseudo name(ssa::Pseudo const &ps) {
+    if (ps.id == rtl::discard_pr.id)
+      return rtl::discard_pr;
+    auto it = names.find(ps);
+    if (it != names.end())
+      return it->second;
+    auto fresh = rtl::fresh_pseudo();
+    names.insert({ps, fresh});
+    return fresh;
+  }
+
+  /** Add instr at the current label, and move on to a fresh one */
+  template <typename Make> void straight(Make const &make) {
+    auto next = rtl::fresh_label();
+    rtl_cbl.add_instr(cur, make(next));
+    cur = next;
+  }
+
+  /** The phi copies of the edge from the current block to succ */
+  CopyList phi_copies(ssa::Label const &succ) {
+    CopyList copies;
+    for (auto const &instr : ssa_cbl.body.at(succ)->body) {
+      auto phi = std::dynamic_pointer_cast<ssa::Phi>(instr);
+      if (!phi)
+        break;
+      for (std::size_t k = 0; k < phi->preds.size(); k++)
+        if (phi->preds[k] == block) {
+          copies.push_back({name(phi->args[k]), name(phi->dest)});
+          break;
+        }
+    }
+    if (!copies.empty() && scratch == rtl::discard_pr)
+      scratch = rtl::fresh_pseudo();
+    return copies;
+  }
+
+  /** Lay the copies out from lab, then go on to succ */
+  void add_copies(rtl::Label lab, CopyList const &copies,
+                  rtl::Label const &succ) {
+    auto seq = sequentialise(copies, scratch);
+    if (seq.empty()) {
+      rtl_cbl.add_instr(lab, rtl::Goto::make(succ));
+      return;
+    }
+    for (std::size_t i = 0; i < seq.size(); i++) {
+      auto next = i + 1 < seq.size() ? rtl::fresh_label() : succ;
+      rtl_cbl.add_instr(lab, rtl::Copy::make(seq[i].first, seq[i].second, next));
+      lab = next;
+    }
+  }
+
+  /**
+   * Where a branch of the current block to succ must jump: succ itself, or a
+   * new block with the phi copies of the edge when succ has phis
+   */
+  rtl::Label branch_target(ssa::Label const &succ) {
+    auto copies = phi_copies(succ);
+    if (copies.empty())
+      return succ;
+    auto lab = rtl::fresh_label();
+    edges.push_back({lab, std::move(copies)});
+    edge_targets.push_back(succ);
+    return lab;
+  }
+
+  ssa::BBlock const &current() const { return *ssa_cbl.body.at(block); }
+
+public:
+  rtl::Callable rtl_cbl;
+
+  explicit Lowerer(ssa::Callable &ssa_cbl)
+      : ssa_cbl{ssa_cbl}, rtl_cbl{ssa_cbl.name} {
+    rtl_cbl.numbering = ssa_cbl.numbering;
+    rtl::Numbering::Scope scope{rtl_cbl.numbering};
+    rtl_cbl.enter = ssa_cbl.enter;
+    rtl_cbl.leave = ssa_cbl.leave;
+    rtl_cbl.type = ssa_cbl.type;
+    rtl_cbl.output_reg = rtl::discard_pr;
+    for (auto const &in : ssa_cbl.input_regs)
+      rtl_cbl.input_regs.push_back(name(in));
+    for (auto const &lab : ssa_cbl.schedule) {
+      block = lab;
+      cur = lab;
+      for (auto const &instr : ssa_cbl.body.at(lab)->body)
+        instr->accept(lab, *this);
+      for (std::size_t i = 0; i < edges.size(); i++)
+        add_copies(edges[i].first, edges[i].second, edge_targets[i]);
+      edges.clear();
+      edge_targets.clear();
+    }
+  }
+
+  void visit(rtl::Label const &, ssa::Move const &mv) override {
+    straight([&](rtl::Label const &next) {
+      return rtl::Move::make(mv.source, name(mv.dest), next);
+    });
+  }
+
+  void visit(rtl::Label const &, ssa::Copy const &cp) override {
+    straight([&](rtl::Label const &next) {
+      return rtl::Copy::make(name(cp.src), name(cp.dest), next);
+    });
+  }
+
+  void visit(rtl::Label const &, ssa::Load const &ld) override {
+    straight([&](rtl::Label const &next) {
+      return rtl::Load::make(ld.src, ld.offset, name(ld.dest), next);
+    });
+  }
+
+  void visit(rtl::Label const &, ssa::Store const &st) override {
+    straight([&](rtl::Label const &next) {
+      return rtl::Store::make(name(st.src), st.dest, st.offset, next);
+    });
+  }
+
+  void visit(rtl::Label const &, ssa::Binop const &bo) override {
+    // dest = src2 OP src1, in the two address form of RTL
+    auto dest = name(bo.dest);
+    straight([&](rtl::Label const &next) {
+      return rtl::Copy::make(name(bo.src2), dest, next);
+    });
+    straight([&](rtl::Label const &next) {
+      return rtl::Binop::make(bo.opcode, name(bo.src1), dest, next);
+    });
+  }
+
+  void visit(rtl::Label const &, ssa::Unop const &uo) override {
+    auto dest = name(uo.dest);
+    straight([&](rtl::Label const &next) {
+      return rtl::Copy::make(name(uo.arg), dest, next);
+    });
+    straight([&](rtl::Label const &next) {
+      return rtl::Unop::make(uo.opcode, dest, next);
+    });
+  }
+
+  void visit(rtl::Label const &, ssa::Bbranch const &bb) override {
+    auto const &outs = current().outlabels;
+    rtl_cbl.add_instr(cur, rtl::Bbranch::make(bb.opcode, name(bb.arg1),
+                                              name(bb.arg2),
+                                              branch_target(outs[0]),
+                                              branch_target(outs[1])));
+  }
+
+  void visit(rtl::Label const &, ssa::Ubranch const &ub) override {
+    auto const &outs = current().outlabels;
+    rtl_cbl.add_instr(cur, rtl::Ubranch::make(ub.opcode, name(ub.arg),
+                                              branch_target(outs[0]),
+                                              branch_target(outs[1])));
+  }
+
+  void visit(rtl::Label const &, ssa::Goto const &) override {
+    // a single successor: its phi copies go at the end of this block
+    auto const &succ = current().outlabels.at(0);
+    add_copies(cur, phi_copies(succ), succ);
+  }
+
+  void visit(rtl::Label const &, ssa::Call const &c) override {
+    std::vector<rtl::Pseudo> args;
+    for (auto const &a : c.args)
+      args.push_back(name(a));
+    straight([&](rtl::Label const &next) {
+      return rtl::Call::make(c.func, args, name(c.ret), next);
+    });
+  }
+
+  void visit(rtl::Label const &, ssa::Return const &r) override {
+    auto arg = name(r.arg);
+    if (rtl_cbl.output_reg == rtl::discard_pr) {
+      rtl_cbl.output_reg = arg;
+      rtl_cbl.leave = cur;
+    }
+    rtl_cbl.add_instr(cur, rtl::Return::make(arg));
+  }
+
+  void visit(rtl::Label const &, ssa::Phi const &) override {
+    // on the incoming edges
+  }
+};
+
+rtl::Callable rtl_generate(ssa::Callable &cbl) {
+  Lowerer lowerer{cbl};
+  return std::move(lowerer.rtl_cbl);
+}
+
+rtl::Program rtl_generate(ssa::Program &prog) {
+  rtl::Program ret;
+  for (auto &cbl : prog)
+    ret.push_back(rtl_generate(cbl));
+  return ret;
+}
+
+} // namespace bx
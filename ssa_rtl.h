@@ -0,0 +1,21 @@
+#pragma once
+
+#include "rtl.h"
+#include "ssa.h"
+
+namespace bx {
+
+/**
+ * Out-of-SSA translation: the optimised SSA program back to RTL, so that the
+ * native backend starts from the same middle end as the LLVM one. Every
+ * (pseudo, version) pair becomes its own RTL pseudo, and the phis of a block
+ * become copies on its incoming edges: at the end of a predecessor with a
+ * single successor, and in a new block on the edge otherwise (a critical
+ * edge split). The copies of an edge are a parallel copy, sequentialised
+ * with a scratch pseudo to break the cycles.
+ */
+rtl::Callable rtl_generate(ssa::Callable &cbl);
+
+rtl::Program rtl_generate(ssa::Program &prog);
+
+} // namespace bx
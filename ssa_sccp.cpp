@@ -0,0 +1,354 @@
+/**
+ * Sparse conditional constant propagation
+ *
+ * The algorithm of Wegman and Zadeck, "Constant Propagation with Conditional
+ * Branches" (TOPLAS 1991). Every pseudo starts at top (no value seen yet) and
+ * only ever moves down to a constant and then to bottom (not a constant).
+ * Blocks are only evaluated once an edge into them is known to be taken, and
+ * a phi only meets the arguments that arrive along such edges, so constants
+ * survive through branches whose other side can never run.
+ *
+ * Afterwards every constant pseudo is defined by a move, branches with a
+ * known outcome become gotos and the blocks that were never reached are
+ * deleted along with the phi arguments that came from them.
+ */
+
+#include <algorithm>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+struct Value {
+  enum Kind { TOP, CONST, BOTTOM } kind = TOP;
+  int64_t cst = 0;
+
+  static Value constant(int64_t c) { return Value{CONST, c}; }
+  static Value bottom() { return Value{BOTTOM, 0}; }
+  bool operator==(Value const &other) const {
+    return kind == other.kind && (kind != CONST || cst == other.cst);
+  }
+  bool operator!=(Value const &other) const { return !(*this == other); }
+};
+
+Value meet(Value const &a, Value const &b) {
+  if (a.kind == Value::TOP)
+    return b;
+  if (b.kind == Value::TOP)
+    return a;
+  if (a == b)
+    return a;
+  return Value::bottom();
+}
+
+/** Folds a binop the way the target computes dest = src2 OP src1 */
+Value fold(Binop::Code op, int64_t dst, int64_t src) {
+  auto udst = static_cast<uint64_t>(dst), usrc = static_cast<uint64_t>(src);
+  switch (op) {
+  case Binop::Code::ADD:
+    return Value::constant(static_cast<int64_t>(udst + usrc));
+  case Binop::Code::SUB:
+    return Value::constant(static_cast<int64_t>(udst - usrc));
+  case Binop::Code::MUL:
+    return Value::constant(static_cast<int64_t>(udst * usrc));
+  case Binop::Code::DIV:
+  case Binop::Code::REM:
+    // Leave the run-time fault where it is
+    if (src == 0 || (dst == INT64_MIN && src == -1))
+      return Value::bottom();
+    return Value::constant(op == Binop::Code::DIV ? dst / src : dst % src);
+  case Binop::Code::SAL:
+  case Binop::Code::SAR:
+    if (src < 0 || src > 63)
+      return Value::bottom();
+    return Value::constant(op == Binop::Code::SAL
+                               ? static_cast<int64_t>(udst << src)
+                               : dst >> src);
+  case Binop::Code::AND:
+    return Value::constant(dst & src);
+  case Binop::Code::OR:
+    return Value::constant(dst | src);
+  case Binop::Code::XOR:
+    return Value::constant(dst ^ src);
+  }
+  return Value::bottom();
+}
+
+bool taken(Bbranch::Code op, int64_t a, int64_t b) {
+  switch (op) {
+  case Bbranch::Code::JE:
+    return a == b;
+  case Bbranch::Code::JNE:
+    return a != b;
+  case Bbranch::Code::JL:
+  case Bbranch::Code::JNGE:
+    return a < b;
+  case Bbranch::Code::JLE:
+  case Bbranch::Code::JNG:
+    return a <= b;
+  case Bbranch::Code::JG:
+  case Bbranch::Code::JNLE:
+    return a > b;
+  case Bbranch::Code::JGE:
+  case Bbranch::Code::JNL:
+    return a >= b;
+  }
+  return false;
+}
+
+class Propagator : public InstrVisitor {
+private:
+  Callable &cbl;
+  DefUse du;
+  rtl::LabelMap<int> block_index;
+  std::unordered_map<Instr const *, int> block_of;
+  PseudoMap<Value> values;
+  std::vector<bool> executable;
+  std::unordered_set<int64_t> edges; // taken edges, see edge()
+  std::vector<std::pair<int, int>> flow_work;
+  std::vector<InstrPtr> ssa_work;
+  int current = 0; // block of the instruction being evaluated
+  int count = 0;
+
+  int64_t edge(int from, int to) const {
+    return static_cast<int64_t>(from) * static_cast<int64_t>(cbl.schedule.size()) + to;
+  }
+
+  BBlock &block(int b) { return *cbl.body.at(cbl.schedule[b]); }
+
+  Value value(Pseudo const &ps) const {
+    auto it = values.find(ps);
+    return it == values.end() ? Value{} : it->second;
+  }
+
+  void lower(Pseudo const &ps, Value const &v) {
+    if (ps.id == -1)
+      return;
+    auto old = value(ps);
+    auto now = meet(old, v);
+    if (now == old)
+      return;
+    values[ps] = now;
+    for (auto const &use : du.uses(ps))
+      ssa_work.push_back(use.instr);
+  }
+
+  void take(int out) {
+    auto const &to = block(current).outlabels.at(out);
+    flow_work.push_back({current, block_index.at(to)});
+  }
+
+  void evaluate(int b, InstrPtr const &instr) {
+    current = b;
+    instr->accept(cbl.schedule[b], *this);
+  }
+
+public:
+  explicit Propagator(Callable &cbl) : cbl{cbl}, du{cbl} {
+    int n = static_cast<int>(cbl.schedule.size());
+    for (int b = 0; b < n; b++) {
+      block_index[cbl.schedule[b]] = b;
+      for (auto const &instr : block(b).body)
+        block_of[instr.get()] = b;
+    }
+    executable.assign(n, false);
+    for (auto const &in : cbl.input_regs)
+      values[in] = Value::bottom();
+  }
+
+  int run() {
+    int enter = block_index.at(cbl.enter);
+    executable[enter] = true;
+    for (auto const &instr : block(enter).body)
+      evaluate(enter, instr);
+    while (!flow_work.empty() || !ssa_work.empty()) {
+      while (!flow_work.empty()) {
+        auto e = flow_work.back();
+        flow_work.pop_back();
+        if (!edges.insert(edge(e.first, e.second)).second)
+          continue;
+        bool first_visit = !executable[e.second];
+        executable[e.second] = true;
+        for (auto const &instr : block(e.second).body) {
+          bool is_phi = std::dynamic_pointer_cast<Phi>(instr) != nullptr;
+          if (!is_phi && !first_visit)
+            break;
+          evaluate(e.second, instr);
+        }
+      }
+      while (!ssa_work.empty()) {
+        auto instr = ssa_work.back();
+        ssa_work.pop_back();
+        int b = block_of.at(instr.get());
+        if (executable[b])
+          evaluate(b, instr);
+      }
+    }
+    rewrite();
+    return count;
+  }
+
+  void visit(Label const &, Move const &mv) override {
+    lower(mv.dest, Value::constant(mv.source));
+  }
+
+  void visit(Label const &, Copy const &cp) override {
+    lower(cp.dest, value(cp.src));
+  }
+
+  void visit(Label const &, Load const &ld) override {
+    lower(ld.dest, Value::bottom());
+  }
+
+  void visit(Label const &, Store const &) override {}
+
+  void visit(Label const &, Binop const &bo) override {
+    auto src = value(bo.src1), dst = value(bo.src2);
+    if (src.kind == Value::BOTTOM || dst.kind == Value::BOTTOM)
+      lower(bo.dest, Value::bottom());
+    else if (src.kind == Value::CONST && dst.kind == Value::CONST)
+      lower(bo.dest, fold(bo.opcode, dst.cst, src.cst));
+  }
+
+  void visit(Label const &, Unop const &uo) override {
+    auto arg = value(uo.arg);
+    if (arg.kind != Value::CONST) {
+      lower(uo.dest, arg);
+      return;
+    }
+    auto u = static_cast<uint64_t>(arg.cst);
+    lower(uo.dest, Value::constant(static_cast<int64_t>(
+                       uo.opcode == Unop::Code::NEG ? 0 - u : ~u)));
+  }
+
+  void visit(Label const &, Ubranch const &ub) override {
+    auto arg = value(ub.arg);
+    if (arg.kind == Value::TOP)
+      return;
+    if (arg.kind == Value::BOTTOM) {
+      take(0);
+      take(1);
+      return;
+    }
+    bool zero = arg.cst == 0;
+    take((ub.opcode == Ubranch::Code::JZ) == zero ? 0 : 1);
+  }
+
+  void visit(Label const &, Bbranch const &bb) override {
+    auto a = value(bb.arg1), b = value(bb.arg2);
+    if (a.kind == Value::BOTTOM || b.kind == Value::BOTTOM) {
+      take(0);
+      take(1);
+    } else if (a.kind == Value::CONST && b.kind == Value::CONST) {
+      take(taken(bb.opcode, a.cst, b.cst) ? 0 : 1);
+    }
+  }
+
+  void visit(Label const &, Goto const &) override { take(0); }
+
+  void visit(Label const &, Call const &c) override {
+    lower(c.ret, Value::bottom());
+  }
+
+  void visit(Label const &, Return const &) override {}
+
+  void visit(Label const &, Phi const &phi) override {
+    Value v;
+    for (std::size_t i = 0; i < phi.args.size(); i++) {
+      auto from = block_index.find(phi.preds[i]);
+      if (from != block_index.end() &&
+          edges.count(edge(from->second, current)) != 0)
+        v = meet(v, value(phi.args[i]));
+    }
+    lower(phi.dest, v);
+  }
+
+private:
+  void rewrite() {
+    std::vector<Label> schedule;
+    for (int b = 0; b < static_cast<int>(cbl.schedule.size()); b++) {
+      auto const &lab = cbl.schedule[b];
+      if (!executable[b]) {
+        count += static_cast<int>(block(b).body.size());
+        cbl.body.erase(lab);
+        continue;
+      }
+      schedule.push_back(lab);
+      auto &blk = block(b);
+      std::vector<InstrPtr> phis, rest, folded_phis;
+      for (auto &instr : blk.body) {
+        auto phi = std::dynamic_pointer_cast<Phi>(instr);
+        auto *dest = instr->getWrite();
+        auto v = dest == nullptr ? Value{} : value(*dest);
+        if (v.kind == Value::CONST && !std::dynamic_pointer_cast<Move>(instr) &&
+            !std::dynamic_pointer_cast<Call>(instr)) {
+          // Constant phis become moves right after the remaining phis
+          (phi ? folded_phis : rest).push_back(Move::make(v.cst, *dest));
+          count++;
+          continue;
+        }
+        if (phi) {
+          prune(b, *phi);
+          phis.push_back(instr);
+        } else {
+          rest.push_back(instr);
+        }
+      }
+      blk.body = std::move(phis);
+      blk.body.insert(blk.body.end(), folded_phis.begin(), folded_phis.end());
+      blk.body.insert(blk.body.end(), rest.begin(), rest.end());
+      settle_branch(b);
+    }
+    cbl.schedule = std::move(schedule);
+  }
+
+  /** Drop the phi arguments arriving along edges that are never taken */
+  void prune(int b, Phi &phi) {
+    std::vector<Pseudo> args;
+    std::vector<Label> preds;
+    for (std::size_t i = 0; i < phi.args.size(); i++) {
+      auto from = block_index.find(phi.preds[i]);
+      if (from == block_index.end() || edges.count(edge(from->second, b)) == 0)
+        continue;
+      args.push_back(phi.args[i]);
+      preds.push_back(phi.preds[i]);
+    }
+    phi.args = std::move(args);
+    phi.preds = std::move(preds);
+  }
+
+  /** Turn a branch with a single taken edge into a goto */
+  void settle_branch(int b) {
+    auto &blk = block(b);
+    if (blk.outlabels.size() < 2 || blk.body.empty())
+      return;
+    std::vector<Label> outs;
+    for (auto const &out : blk.outlabels)
+      if (edges.count(edge(b, block_index.at(out))) != 0 &&
+          std::find(outs.begin(), outs.end(), out) == outs.end())
+        outs.push_back(out);
+    if (outs.empty())
+      throw std::runtime_error("SCCP: reachable branch with no taken edge");
+    if (outs.size() == blk.outlabels.size())
+      return;
+    blk.body.back() = Goto::make();
+    blk.outlabels = std::move(outs);
+    count++;
+  }
+};
+
+} // namespace
+
+int propagate_constants(Callable &cbl) { return Propagator{cbl}.run(); }
+
+} // namespace ssa
+} // namespace bx
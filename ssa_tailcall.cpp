@@ -0,0 +1,203 @@
+/**
+ * Self tail calls to loops
+ *
+ * A call of the enclosing callable whose result (if any) is only copied and
+ * then returned is replaced by a jump back to the old enter block, which
+ * becomes the header of a loop with one phi per parameter. A new enter block
+ * in front of it feeds the phis the original inputs; each tail call site
+ * feeds them its arguments.
+ */
+
+#include <algorithm>
+#include <memory>
+#include <unordered_set>
+#include <vector>
+
+#include "ssa_opt.h"
+
+namespace bx {
+namespace ssa {
+
+namespace {
+
+class TailCalls {
+private:
+  Callable &cbl;
+  DefUse du;
+
+  struct Site {
+    Label block;
+    std::shared_ptr<Call> call;
+    std::vector<InstrPtr> removed; // the call and the copies of its result
+  };
+
+  /**
+   * Matches a block ending in a self call whose result flows unchanged to
+   * the return of the leave block.
+   */
+  bool tail_site(Label const &lab, Site &site) {
+    auto &blk = *cbl.body.at(lab);
+    auto const &body = blk.body;
+    if (body.empty() || !std::dynamic_pointer_cast<Goto>(body.back()) ||
+        blk.outlabels.size() != 1 || !(blk.outlabels[0] == cbl.leave))
+      return false;
+    // Walk back over the copies to the call
+    std::size_t i = body.size() - 1;
+    std::vector<std::shared_ptr<Copy>> copies;
+    while (i > 0) {
+      auto cp = std::dynamic_pointer_cast<Copy>(body[i - 1]);
+      if (!cp)
+        break;
+      copies.push_back(cp);
+      i--;
+    }
+    if (i == 0)
+      return false;
+    auto call = std::dynamic_pointer_cast<Call>(body[i - 1]);
+    if (!call || call->func != cbl.name ||
+        call->args.size() != cbl.input_regs.size())
+      return false;
+    std::reverse(copies.begin(), copies.end());
+
+    site = Site{lab, call, {call}};
+    std::unordered_set<Instr const *> chain{call.get()};
+    auto value = call->ret;
+    for (auto const &cp : copies) {
+      if (!PseudoEq{}(cp->src, value))
+        return false;
+      value = cp->dest;
+      chain.insert(cp.get());
+      site.removed.push_back(cp);
+    }
+
+    // The leave block may only merge the returned value
+    auto const &leave = cbl.body.at(cbl.leave)->body;
+    if (leave.empty())
+      return false;
+    auto ret = std::dynamic_pointer_cast<Return>(leave.back());
+    if (!ret)
+      return false;
+    std::shared_ptr<Phi> merge;
+    for (std::size_t k = 0; k + 1 < leave.size(); k++) {
+      auto phi = std::dynamic_pointer_cast<Phi>(leave[k]);
+      if (!phi || merge)
+        return false;
+      merge = phi;
+    }
+    if (ret->arg.id == -1) {
+      if (merge)
+        return false;
+    } else if (merge) {
+      if (!PseudoEq{}(ret->arg, merge->dest))
+        return false;
+      auto pos = std::find(merge->preds.begin(), merge->preds.end(), lab);
+      if (pos == merge->preds.end() ||
+          !PseudoEq{}(merge->args[pos - merge->preds.begin()], value))
+        return false;
+      chain.insert(merge.get());
+    } else if (!PseudoEq{}(ret->arg, value)) {
+      return false;
+    }
+    if (value.id == -1)
+      return true;
+    // Nothing else may look at the result
+    for (auto const &instr : site.removed) {
+      auto *dest = instr->getWrite();
+      if (dest->id == -1)
+        continue;
+      for (auto const &use : du.uses(*dest))
+        if (chain.count(use.instr.get()) == 0 && use.instr != ret)
+          return false;
+    }
+    return true;
+  }
+
+public:
+  explicit TailCalls(Callable &cbl) : cbl{cbl}, du{cbl} {}
+
+  int run() {
+    std::vector<Site> sites;
+    for (auto const &lab : cbl.schedule) {
+      Site site;
+      if (tail_site(lab, site))
+        sites.push_back(std::move(site));
+    }
+    if (sites.empty())
+      return 0;
+
+    // The old enter block becomes the loop header, reading new versions of
+    // the parameters
+    auto header = cbl.enter;
+    std::vector<Pseudo> params;
+    for (auto const &in : cbl.input_regs) {
+      auto fresh = cbl.fresh_version(in.id);
+      du.replaceAllUsesWith(in, fresh);
+      params.push_back(fresh);
+    }
+    auto enter = rtl::fresh_label();
+    std::vector<InstrPtr> phis;
+    for (std::size_t p = 0; p < params.size(); p++) {
+      std::vector<Pseudo> args{cbl.input_regs[p]};
+      std::vector<Label> preds{enter};
+      for (auto const &site : sites) {
+        args.push_back(site.call->args[p]);
+        preds.push_back(site.block);
+      }
+      auto phi = Phi::make(args, params[p]);
+      phi->preds = preds;
+      phis.push_back(phi);
+    }
+    auto &header_body = cbl.body.at(header)->body;
+    header_body.insert(header_body.begin(), phis.begin(), phis.end());
+
+    cbl.enter = enter;
+    cbl.body.insert_or_assign(
+        enter, BBlock::make(std::vector<Label>{header},
+                            std::vector<InstrPtr>{Goto::make()}));
+    cbl.schedule.insert(cbl.schedule.begin(), enter);
+
+    auto &leave = *cbl.body.at(cbl.leave);
+    for (auto const &site : sites) {
+      auto &blk = *cbl.body.at(site.block);
+      blk.body.erase(std::remove_if(blk.body.begin(), blk.body.end(),
+                                    [&](InstrPtr const &instr) {
+                                      return std::find(site.removed.begin(),
+                                                       site.removed.end(),
+                                                       instr) !=
+                                             site.removed.end();
+                                    }),
+                     blk.body.end());
+      blk.outlabels = {header};
+      for (auto &instr : leave.body) {
+        auto phi = std::dynamic_pointer_cast<Phi>(instr);
+        if (!phi)
+          continue;
+        auto pos = std::find(phi->preds.begin(), phi->preds.end(), site.block);
+        phi->args.erase(phi->args.begin() + (pos - phi->preds.begin()));
+        phi->preds.erase(pos);
+      }
+    }
+
+    // If every path to the leave block was a tail call, it is now dead
+    bool reached = false;
+    for (auto const &lab : cbl.schedule)
+      for (auto const &out : cbl.body.at(lab)->outlabels)
+        reached = reached || out == cbl.leave;
+    if (!reached) {
+      cbl.body.erase(cbl.leave);
+      cbl.schedule.erase(
+          std::find(cbl.schedule.begin(), cbl.schedule.end(), cbl.leave));
+    }
+    return static_cast<int>(sites.size());
+  }
+};
+
+} // namespace
+
+int eliminate_tail_calls(Callable &cbl) {
+  rtl::Numbering::Scope scope{cbl.numbering};
+  return TailCalls{cbl}.run();
+}
+
+} // namespace ssa
+} // namespace bx
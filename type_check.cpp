@@ -2,6 +2,7 @@
 
 #include <algorithm>
 #include <map>
+#include <unordered_map>
 
 namespace bx {
 using namespace source;
@@ -28,33 +29,47 @@ struct VarInfo {
   VarInfo(VarInfo &&) = default;
 };
 
+using VMap = std::map<std::string, std::shared_ptr<VarInfo>>;
+
+/**
+ * What the body of a callable can see besides its own variables: the global
+ * variables and the signatures of the callables. It is built once and only
+ * read, so the callables can be checked at the same time.
+ */
+struct Environment {
+  VMap globals;
+  Program::CallTable const &callables;
+
+  explicit Environment(Program const &source_prog)
+      : callables{source_prog.callables} {
+    for (auto const &gv : source_prog.global_vars)
+      globals.insert_or_assign(gv.first,
+                               std::make_shared<VarInfo>(gv.second->ty, 0));
+  }
+};
+
+/** The checker of one callable, whose scopes are its own */
 class TypeChecker : public StmtVisitor, public ExprVisitor {
 private:
-  source::Program &source_prog;
-  using VMap = std::map<std::string, std::shared_ptr<VarInfo>>;
-  std::vector<VMap> symbol_map;
-  int current_depth;
+  Environment const &env;
+  std::vector<VMap> symbol_map; // symbol_map[d - 1] is the scope at depth d
+  int current_depth = 0;
   Type current_return_ty = Type::UNKNOWN;
 
   VarInfo *lookup_var(std::string const &var) {
-    for (int depth = current_depth; depth >= 0; depth--) {
-      auto const &map = symbol_map[depth];
-      auto local_search = map.find(var);
-      if (local_search != map.end())
+    for (auto map = symbol_map.crbegin(); map != symbol_map.crend(); ++map) {
+      auto local_search = map->find(var);
+      if (local_search != map->end())
         return local_search->second.get();
     }
+    auto global_search = env.globals.find(var);
+    if (global_search != env.globals.end())
+      return global_search->second.get();
     return nullptr;
   }
 
 public:
-  TypeChecker(source::Program &source_prog)
-      : source_prog{source_prog}, current_depth{1} {
-    VMap gv_map;
-    for (auto const &gv : source_prog.global_vars)
-      gv_map.insert_or_assign(gv.first,
-                              std::make_shared<VarInfo>(gv.second->ty, 0));
-    symbol_map.push_back(std::move(gv_map));
-  }
+  explicit TypeChecker(Environment const &env) : env{env} {}
 
   // Callables
 
@@ -102,7 +117,7 @@ public:
   }
 
   void visit(Declare const &dec) override {
-    auto &map = symbol_map[current_depth];
+    auto &map = symbol_map.back();
     if (map.find(dec.var) != map.end())
       panic("Variable " + dec.var + " already declared in this scope");
     visit_checked(dec.init, dec.ty);
@@ -222,8 +237,8 @@ public:
   }
 
   void visit(Call const &ca) override {
-    auto const &cbl = source_prog.callables.find(ca.func);
-    if (cbl == source_prog.callables.end())
+    auto const &cbl = env.callables.find(ca.func);
+    if (cbl == env.callables.end())
       panic("Unknown function/procedure: " + ca.func);
     auto const &params = cbl->second->args;
     if (ca.args.size() != params.size())
@@ -235,10 +250,27 @@ public:
   }
 };
 
-void type_check(Program &src_prog) {
-  TypeChecker tyc{src_prog};
-  for (auto &cbl : src_prog.callables)
-    tyc.visit(*cbl.second);
+void type_check(Program &src_prog, WorkPool &pool) {
+  Environment env{src_prog};
+  std::vector<Callable const *> callables;
+  for (auto const &cbl : src_prog.callables)
+    callables.push_back(cbl.second.get());
+  // Each callable stops at its first error; the errors of all of them are
+  // reported together, in the order of the callables
+  std::vector<std::string> errors(callables.size());
+  pool.run(callables.size(), [&](std::size_t i) {
+    try {
+      TypeChecker{env}.visit(*callables[i]);
+    } catch (std::runtime_error const &e) {
+      errors[i] = e.what();
+    }
+  });
+  std::string report;
+  for (auto const &error : errors)
+    if (!error.empty())
+      report += (report.empty() ? "" : "\n") + error;
+  if (!report.empty())
+    panic(report);
   // check that the main() proc is present
   auto const &main_proc = src_prog.callables.find("main");
   if (main_proc == src_prog.callables.end() ||
@@ -246,5 +278,10 @@ void type_check(Program &src_prog) {
     panic("Cannot find main() procedure");
 }
 
+void type_check(Program &src_prog) {
+  WorkPool pool{1};
+  type_check(src_prog, pool);
+}
+
 } // namespace check
 } // namespace bx
\ No newline at end of file
@@ -1,10 +1,19 @@
 #pragma once
 
 #include "ast.h"
+#include "work_pool.h"
 
 namespace bx {
 namespace check {
 
+/**
+ * Type check every callable, one task of the pool each. A callable stops at
+ * its first error, and the errors of all the callables are thrown together
+ * as one std::runtime_error, one per line in the order of the callables.
+ */
+void type_check(bx::source::Program &, WorkPool &);
+
+/** The same on the calling thread */
 void type_check(bx::source::Program &);
 
 }
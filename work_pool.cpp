@@ -0,0 +1,106 @@
+#include <algorithm>
+
+#include "work_pool.h"
+
+namespace bx {
+
+WorkPool::WorkPool(unsigned threads) {
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+  for (unsigned w = 0; w < threads; w++)
+    deques.push_back(std::make_unique<Deque>());
+  for (unsigned w = 1; w < threads; w++)
+    this->threads.emplace_back([this, w] { work(w); });
+}
+
+WorkPool::~WorkPool() {
+  {
+    std::lock_guard<std::mutex> guard{lock};
+    stopping = true;
+  }
+  wake.notify_all();
+  for (auto &t : threads)
+    t.join();
+}
+
+void WorkPool::run(std::size_t n, Task const &task) {
+  if (n == 0)
+    return;
+  std::size_t workers = deques.size();
+  {
+    std::lock_guard<std::mutex> guard{lock};
+    this->task = &task;
+    pending = n;
+    failure = nullptr;
+    for (std::size_t w = 0; w < workers; w++) {
+      std::lock_guard<std::mutex> dguard{deques[w]->lock};
+      for (std::size_t i = w * n / workers; i < (w + 1) * n / workers; i++)
+        deques[w]->tasks.push_back(i);
+    }
+    batch++;
+  }
+  wake.notify_all();
+  drain(0);
+  std::unique_lock<std::mutex> guard{lock};
+  done.wait(guard, [this] { return pending == 0; });
+  this->task = nullptr;
+  if (failure)
+    std::rethrow_exception(failure);
+}
+
+bool WorkPool::next(unsigned self, std::size_t &index) {
+  {
+    auto &own = *deques[self];
+    std::lock_guard<std::mutex> guard{own.lock};
+    if (!own.tasks.empty()) {
+      index = own.tasks.front();
+      own.tasks.pop_front();
+      return true;
+    }
+  }
+  for (std::size_t k = 1; k < deques.size(); k++) {
+    auto &victim = *deques[(self + k) % deques.size()];
+    std::lock_guard<std::mutex> guard{victim.lock};
+    if (!victim.tasks.empty()) {
+      index = victim.tasks.back();
+      victim.tasks.pop_back();
+      return true;
+    }
+  }
+  return false;
+}
+
+void WorkPool::drain(unsigned self) {
+  std::size_t index;
+  while (next(self, index)) {
+    std::exception_ptr error;
+    try {
+      (*task)(index);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    std::lock_guard<std::mutex> guard{lock};
+    if (error && (!failure || index < failed_task)) {
+      failure = error;
+      failed_task = index;
+    }
+    if (--pending == 0)
+      done.notify_all();
+  }
+}
+
+void WorkPool::work(unsigned self) {
+  std::uint64_t seen = 0;
+  while (true) {
+    {
+      std::unique_lock<std::mutex> guard{lock};
+      wake.wait(guard, [&] { return stopping || batch != seen; });
+      if (stopping)
+        return;
+      seen = batch;
+    }
+    drain(self);
+  }
+}
+
+} // namespace bx
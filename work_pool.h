@@ -0,0 +1,67 @@
+#pragma once
+
+/**
+ * A work-stealing pool of threads for the per-callable stages
+ *
+ * A batch of n tasks, numbered 0 to n - 1, is dealt out in contiguous runs to
+ * one deque per worker, the calling thread being worker 0. A worker takes
+ * tasks from the front of its own deque and, once that is empty, steals from
+ * the back of the others', so that a few large callables do not leave the
+ * other threads idle. Tasks store their results at their own number, which
+ * keeps the output in program order whatever the schedule was.
+ */
+
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace bx {
+
+class WorkPool {
+public:
+  using Task = std::function<void(std::size_t)>;
+
+  /** A pool of the given number of threads; 0 for one per hardware thread */
+  explicit WorkPool(unsigned threads = 0);
+  ~WorkPool();
+  WorkPool(WorkPool const &) = delete;
+  WorkPool &operator=(WorkPool const &) = delete;
+
+  unsigned size() const { return static_cast<unsigned>(deques.size()); }
+
+  /**
+   * Run task(0), ..., task(n - 1) and wait for all of them. If tasks throw,
+   * the exception of the lowest numbered one is rethrown.
+   */
+  void run(std::size_t n, Task const &task);
+
+private:
+  struct Deque {
+    std::mutex lock;
+    std::deque<std::size_t> tasks;
+  };
+  std::vector<std::unique_ptr<Deque>> deques;
+  std::vector<std::thread> threads;
+
+  std::mutex lock;
+  std::condition_variable wake, done;
+  Task const *task = nullptr;
+  std::uint64_t batch = 0;
+  std::size_t pending = 0;
+  bool stopping = false;
+  std::size_t failed_task = 0;
+  std::exception_ptr failure;
+
+  bool next(unsigned self, std::size_t &index);
+  void drain(unsigned self);
+  void work(unsigned self);
+};
+
+} // namespace bx